@@ -65,6 +65,34 @@ static const char *LIFECYCLE_TAG = "LIFECYCLE";
 static void (*s_wifi_on_ready_cb)(void) = NULL;
 static bool s_wifi_started = false;
 static esp_netif_t *s_wifi_netif = NULL;
+static int64_t s_wifi_connect_t0_us = 0;
+static int64_t s_wifi_connect_us = 0;
+
+#ifdef CONFIG_LCM_WIFI_FAST_CONNECT
+// Last AP and lease that produced an IP, kept in its own namespace so the
+// provisioning-owned 'wifi_cfg' keys stay untouched. NVS checksums every
+// entry, so a torn write reads back as missing rather than as garbage.
+#define WIFI_FAST_NAMESPACE "wifi_fast"
+#define WIFI_FAST_KEY       "ap"
+#define WIFI_FAST_VERSION   1
+
+typedef struct {
+    uint8_t  version;
+    uint8_t  channel;
+    uint8_t  bssid[6];
+    uint32_t ssid_hash;     // FNV-1a of the SSID the entry was learned on
+    uint32_t ip;            // last DHCP lease, lwIP byte order
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;
+} wifi_fast_cache_t;
+
+static wifi_fast_cache_t s_wifi_cache;
+static bool s_wifi_cache_valid = false;
+static bool s_wifi_directed = false;    // connecting to the cached BSSID/channel
+static bool s_wifi_static_ip = false;   // DHCP client stopped, cached lease applied
+static bool s_wifi_got_ip = false;      // since the last (re)connect attempt
+#endif
 
 static const uint32_t k_post_reset_magic = 0xC0DEC0DE;
 #ifndef CONFIG_LCM_RESTART_COUNTER_TIMEOUT_MS
@@ -186,16 +214,155 @@ static esp_err_t nvs_load_wifi(char **out_ssid, char **out_pass) {
     return ESP_OK;
 }
 
+#ifdef CONFIG_LCM_WIFI_FAST_CONNECT
+static uint32_t wifi_ssid_hash(const uint8_t *ssid, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len && ssid[i] != '\0'; i++) {
+        h = (h ^ ssid[i]) * 16777619u;
+    }
+    return h;
+}
+
+static bool wifi_cache_load(uint32_t ssid_hash, wifi_fast_cache_t *out) {
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_FAST_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;       // nothing cached yet
+    }
+    size_t len = sizeof(*out);
+    esp_err_t err = nvs_get_blob(handle, WIFI_FAST_KEY, out, &len);
+    nvs_close(handle);
+
+    if (err != ESP_OK || len != sizeof(*out) || out->version != WIFI_FAST_VERSION) {
+        return false;
+    }
+    if (out->ssid_hash != ssid_hash) {
+        ESP_LOGI(WIFI_TAG, "Cached AP belongs to another SSID; doing a full scan");
+        return false;
+    }
+    return out->channel != 0;
+}
+
+static void wifi_cache_store(const wifi_fast_cache_t *entry) {
+    if (s_wifi_cache_valid && memcmp(&s_wifi_cache, entry, sizeof(*entry)) == 0) {
+        return;             // unchanged, spare the flash
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(WIFI_FAST_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGW(WIFI_TAG, "NVS open failed for namespace '%s': %s",
+                 WIFI_FAST_NAMESPACE, esp_err_to_name(err));
+        return;
+    }
+    err = nvs_set_blob(handle, WIFI_FAST_KEY, entry, sizeof(*entry));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(WIFI_TAG, "Failed to cache AP: %s", esp_err_to_name(err));
+        return;
+    }
+    s_wifi_cache = *entry;
+    s_wifi_cache_valid = true;
+    ESP_LOGI(WIFI_TAG, "Cached AP %02x:%02x:%02x:%02x:%02x:%02x on channel %u",
+             entry->bssid[0], entry->bssid[1], entry->bssid[2],
+             entry->bssid[3], entry->bssid[4], entry->bssid[5], entry->channel);
+}
+
+// The cached AP did not answer (moved channel, replaced, powered off): forget
+// the hints for the rest of this boot and let the driver scan every channel.
+// The next successful connect refreshes the cache.
+static void wifi_fast_fallback(void) {
+    wifi_config_t wc;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wc) == ESP_OK) {
+        wc.sta.bssid_set = false;
+        wc.sta.channel = 0;
+        wc.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        esp_wifi_set_config(WIFI_IF_STA, &wc);
+    }
+    if (s_wifi_static_ip) {
+        esp_netif_dhcpc_start(s_wifi_netif);
+        s_wifi_static_ip = false;
+    }
+    s_wifi_directed = false;
+    ESP_LOGW(WIFI_TAG, "Directed connect failed; falling back to full scan and DHCP");
+}
+
+static void wifi_fast_learn(const ip_event_got_ip_t *event) {
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+
+    wifi_fast_cache_t entry = { 0 };
+    entry.version   = WIFI_FAST_VERSION;
+    entry.channel   = ap.primary;
+    memcpy(entry.bssid, ap.bssid, sizeof(entry.bssid));
+    entry.ssid_hash = wifi_ssid_hash(ap.ssid, sizeof(ap.ssid));
+    entry.ip        = event->ip_info.ip.addr;
+    entry.netmask   = event->ip_info.netmask.addr;
+    entry.gw        = event->ip_info.gw.addr;
+
+    esp_netif_dns_info_t dns;
+    if (esp_netif_get_dns_info(s_wifi_netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK) {
+        entry.dns = dns.ip.u_addr.ip4.addr;
+    }
+    wifi_cache_store(&entry);
+}
+
+#ifdef CONFIG_LCM_WIFI_STATIC_IP
+// Reuse the last DHCP lease so the station is addressable as soon as it
+// associates, skipping the DHCP DISCOVER/OFFER round trips.
+static void wifi_fast_apply_lease(void) {
+    if (s_wifi_cache.ip == 0 || s_wifi_cache.netmask == 0) {
+        return;
+    }
+    esp_netif_ip_info_t info = {
+        .ip      = { .addr = s_wifi_cache.ip },
+        .netmask = { .addr = s_wifi_cache.netmask },
+        .gw      = { .addr = s_wifi_cache.gw },
+    };
+    esp_err_t err = esp_netif_dhcpc_stop(s_wifi_netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
+        ESP_LOGW(WIFI_TAG, "DHCP stop failed: %s", esp_err_to_name(err));
+        return;
+    }
+    if (esp_netif_set_ip_info(s_wifi_netif, &info) != ESP_OK) {
+        esp_netif_dhcpc_start(s_wifi_netif);
+        return;
+    }
+    if (s_wifi_cache.dns != 0) {
+        esp_netif_dns_info_t dns = { 0 };
+        dns.ip.type = ESP_IPADDR_TYPE_V4;
+        dns.ip.u_addr.ip4.addr = s_wifi_cache.dns;
+        esp_netif_set_dns_info(s_wifi_netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+    s_wifi_static_ip = true;
+    ESP_LOGI(WIFI_TAG, "Using cached lease " IPSTR, IP2STR(&info.ip));
+}
+#endif
+#endif
+
 static void wifi_event_handler(void *arg, esp_event_base_t base, int32_t id, void *data) {
     if (base == WIFI_EVENT) {
         switch (id) {
             case WIFI_EVENT_STA_START:
                 ESP_LOGI(WIFI_TAG, "STA start -> connect");
+                s_wifi_connect_t0_us = esp_timer_get_time();
                 esp_wifi_connect();
                 break;
             case WIFI_EVENT_STA_DISCONNECTED: {
                 wifi_event_sta_disconnected_t *disc = (wifi_event_sta_disconnected_t *)data;
                 ESP_LOGW(WIFI_TAG, "Disconnected (reason=%d). Reconnecting...", disc ? disc->reason : -1);
+#ifdef CONFIG_LCM_WIFI_FAST_CONNECT
+                if (s_wifi_directed && !s_wifi_got_ip) {
+                    wifi_fast_fallback();
+                }
+                s_wifi_got_ip = false;
+#endif
+                s_wifi_connect_t0_us = esp_timer_get_time();
                 esp_wifi_connect();
                 break;
             }
@@ -204,7 +371,20 @@ static void wifi_event_handler(void *arg, esp_event_base_t base, int32_t id, voi
         }
     } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)data;
-        ESP_LOGI(WIFI_TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+        s_wifi_connect_us = esp_timer_get_time() - s_wifi_connect_t0_us;
+#ifdef CONFIG_LCM_WIFI_FAST_CONNECT
+        s_wifi_got_ip = true;
+        ESP_LOGI(WIFI_TAG, "Got IP: " IPSTR " in %" PRId64 " ms (%s, %s)",
+                 IP2STR(&event->ip_info.ip), s_wifi_connect_us / 1000,
+                 s_wifi_directed ? "cached AP" : "full scan",
+                 s_wifi_static_ip ? "cached lease" : "DHCP");
+        if (!s_wifi_static_ip) {
+            wifi_fast_learn(event);
+        }
+#else
+        ESP_LOGI(WIFI_TAG, "Got IP: " IPSTR " in %" PRId64 " ms",
+                 IP2STR(&event->ip_info.ip), s_wifi_connect_us / 1000);
+#endif
         if (s_wifi_on_ready_cb != NULL) {
             s_wifi_on_ready_cb();
         }
@@ -577,6 +757,23 @@ esp_err_t wifi_start(void (*on_ready)(void)) {
         wc.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
     }
 
+#ifdef CONFIG_LCM_WIFI_FAST_CONNECT
+    // Skip the all-channel scan when the last AP is known: probe its channel
+    // first and join that BSSID directly.
+    s_wifi_cache_valid = wifi_cache_load(wifi_ssid_hash(wc.sta.ssid, sizeof(wc.sta.ssid)),
+                                         &s_wifi_cache);
+    s_wifi_directed = s_wifi_cache_valid;
+    s_wifi_got_ip = false;
+    if (s_wifi_directed) {
+        wc.sta.bssid_set = true;
+        memcpy(wc.sta.bssid, s_wifi_cache.bssid, sizeof(wc.sta.bssid));
+        wc.sta.channel = s_wifi_cache.channel;
+        wc.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        wc.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+#endif
+
     err = esp_netif_init();
     if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
         ESP_LOGE(WIFI_TAG, "Failed to init netif: %s", esp_err_to_name(err));
@@ -594,6 +791,11 @@ esp_err_t wifi_start(void (*on_ready)(void)) {
             return ESP_ERR_NO_MEM;
         }
     }
+#if defined(CONFIG_LCM_WIFI_FAST_CONNECT) && defined(CONFIG_LCM_WIFI_STATIC_IP)
+    if (s_wifi_directed) {
+        wifi_fast_apply_lease();
+    }
+#endif
 
     WIFI_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
     WIFI_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
@@ -672,11 +874,19 @@ esp_err_t wifi_stop(void) {
 
     s_wifi_started = false;
     s_wifi_on_ready_cb = NULL;
+#ifdef CONFIG_LCM_WIFI_FAST_CONNECT
+    s_wifi_directed = false;
+    s_wifi_static_ip = false;
+#endif
 
     ESP_LOGI(WIFI_TAG, "WiFi driver stopped");
     return result;
 }
 
+int64_t wifi_last_connect_us(void) {
+    return s_wifi_connect_us;
+}
+
 esp_err_t lifecycle_nvs_init(void) {
     return lifecycle_ensure_nvs_initialized(LIFECYCLE_TAG);
 }
@@ -762,6 +972,32 @@ const char *lifecycle_get_firmware_revision_string(void) {
     return NULL;
 }
 
+esp_err_t lifecycle_set_installed_version(const char *version) {
+    if (version == NULL || version[0] == '\0') {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("fwcfg", NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGW(LIFECYCLE_TAG, "Unable to open fwcfg namespace: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_set_str(handle, "installed_ver", version);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(LIFECYCLE_TAG, "Failed to store installed version: %s", esp_err_to_name(err));
+    } else {
+        ESP_LOGI(LIFECYCLE_TAG, "Installed firmware version set to %s", version);
+    }
+    return err;
+}
+
 void lifecycle_handle_ota_trigger(homekit_characteristic_t *characteristic,
                                   const homekit_value_t value) {
     if (characteristic == NULL) {
@@ -925,6 +1161,16 @@ static void erase_wifi_credentials(void) {
     }
 
     nvs_close(handle);
+
+#ifdef CONFIG_LCM_WIFI_FAST_CONNECT
+    // The cached AP and lease belong to the old network.
+    if (nvs_open(WIFI_FAST_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        if (nvs_erase_all(handle) == ESP_OK) {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+#endif
 }
 
 static void erase_nvs_partition(void) {
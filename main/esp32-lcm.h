@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sdkconfig.h>
+#include <stdint.h>
 
 #include <esp_err.h>
 #include <homekit/homekit.h>
@@ -26,6 +27,67 @@
 
 #define API_OTA_TRIGGER HOMEKIT_CHARACTERISTIC_(CUSTOM_OTA_TRIGGER, false)
 
+// Read-only diagnostics text; the firmware formats it on demand in _getter.
+#define HOMEKIT_CHARACTERISTIC_CUSTOM_LATENCY_STATS HOMEKIT_CUSTOM_UUID("F0000002")
+#define HOMEKIT_DECLARE_CHARACTERISTIC_CUSTOM_LATENCY_STATS(_value, ...) \
+    .type = HOMEKIT_CHARACTERISTIC_CUSTOM_LATENCY_STATS, \
+    .description = "LatencyStats", \
+    .format = homekit_format_string, \
+    .permissions = homekit_permissions_paired_read, \
+    .max_len = (int[]) {384}, \
+    .value = HOMEKIT_STRING_(_value, .is_static = true), \
+    ##__VA_ARGS__
+
+#define API_LATENCY_STATS(_getter) \
+    HOMEKIT_CHARACTERISTIC_(CUSTOM_LATENCY_STATS, "", .getter_ex = (_getter))
+
+// Read-only task stack and heap headroom; formatted on demand in _getter.
+#define HOMEKIT_CHARACTERISTIC_CUSTOM_TASK_STATS HOMEKIT_CUSTOM_UUID("F0000003")
+#define HOMEKIT_DECLARE_CHARACTERISTIC_CUSTOM_TASK_STATS(_value, ...) \
+    .type = HOMEKIT_CHARACTERISTIC_CUSTOM_TASK_STATS, \
+    .description = "TaskStats", \
+    .format = homekit_format_string, \
+    .permissions = homekit_permissions_paired_read, \
+    .max_len = (int[]) {256}, \
+    .value = HOMEKIT_STRING_(_value, .is_static = true), \
+    ##__VA_ARGS__
+
+#define API_TASK_STATS(_getter) \
+    HOMEKIT_CHARACTERISTIC_(CUSTOM_TASK_STATS, "", .getter_ex = (_getter))
+
+// Read-only: the sample events recorded since the previous read, oldest
+// first; each read drains what it returns. Formatted on demand in _getter.
+#define HOMEKIT_CHARACTERISTIC_CUSTOM_EVENT_LOG HOMEKIT_CUSTOM_UUID("F0000004")
+#define HOMEKIT_DECLARE_CHARACTERISTIC_CUSTOM_EVENT_LOG(_value, ...) \
+    .type = HOMEKIT_CHARACTERISTIC_CUSTOM_EVENT_LOG, \
+    .description = "EventLog", \
+    .format = homekit_format_string, \
+    .permissions = homekit_permissions_paired_read, \
+    .max_len = (int[]) {256}, \
+    .value = HOMEKIT_STRING_(_value, .is_static = true), \
+    ##__VA_ARGS__
+
+#define API_EVENT_LOG(_getter) \
+    HOMEKIT_CHARACTERISTIC_(CUSTOM_EVENT_LOG, "", .getter_ex = (_getter))
+
+// Sample log verbosity: 0 = record only, 1 = also print on the serial console.
+#define HOMEKIT_CHARACTERISTIC_CUSTOM_SAMPLE_LOG HOMEKIT_CUSTOM_UUID("F0000005")
+#define HOMEKIT_DECLARE_CHARACTERISTIC_CUSTOM_SAMPLE_LOG(_value, ...) \
+    .type = HOMEKIT_CHARACTERISTIC_CUSTOM_SAMPLE_LOG, \
+    .description = "SampleLog", \
+    .format = homekit_format_uint8, \
+    .permissions = homekit_permissions_paired_read \
+        | homekit_permissions_paired_write, \
+    .min_value = (float[]) {0}, \
+    .max_value = (float[]) {1}, \
+    .min_step = (float[]) {1}, \
+    .value = HOMEKIT_UINT8_(_value), \
+    ##__VA_ARGS__
+
+#define API_SAMPLE_LOG(_value, _getter, _setter) \
+    HOMEKIT_CHARACTERISTIC_(CUSTOM_SAMPLE_LOG, _value, \
+                            .getter_ex = (_getter), .setter_ex = (_setter))
+
 #ifndef LIFECYCLE_DEFAULT_FW_VERSION
 #ifdef CONFIG_APP_PROJECT_VER
 #define LIFECYCLE_DEFAULT_FW_VERSION CONFIG_APP_PROJECT_VER
@@ -67,6 +129,11 @@ esp_err_t lifecycle_init_firmware_revision(homekit_characteristic_t *revision,
 // has been initialised yet.
 const char *lifecycle_get_firmware_revision_string(void);
 
+// Record the version of a firmware image installed by the application itself
+// (in-app OTA), so the revision characteristic and the Lifecycle Manager see it
+// after the reboot.
+esp_err_t lifecycle_set_installed_version(const char *version);
+
 // Verwerk de custom HomeKit OTA trigger. Gebruik dit als setter van de characteristic.
 void lifecycle_handle_ota_trigger(homekit_characteristic_t *characteristic,
                                   const homekit_value_t value);
@@ -86,6 +153,11 @@ esp_err_t wifi_start(void (*on_ready)(void));
 // Optioneel: stop WiFi netjes.
 esp_err_t wifi_stop(void);
 
+// Duration of the most recent connect in microseconds: from STA start (or the
+// disconnect that triggered the reconnect) to IP_EVENT_STA_GOT_IP. Valid from
+// inside the 'on_ready' callback; 0 before the first connect.
+int64_t wifi_last_connect_us(void);
+
 #ifdef __cplusplus
 }
 #endif
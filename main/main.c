@@ -42,21 +42,45 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <esp_log.h>
 #include <esp_err.h>
 #include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <nvs.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 
 #include <driver/gpio.h>
+#include <esp_wifi.h>
 
-#ifdef CONFIG_WIND_SENSOR_ENABLE
+#ifdef CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+#define SUNSHADE_LIGHT_SLEEP 1
+#endif
+#endif
+
+#if defined(CONFIG_WIND_SENSOR_ENABLE) && defined(CONFIG_WIND_SENSOR_ADC_DMA)
+#include <esp_adc/adc_continuous.h>
+#endif
+
+#if (defined(CONFIG_WIND_SENSOR_ENABLE) && !defined(CONFIG_WIND_SENSOR_ADC_DMA)) || \
+    defined(CONFIG_SUNSHADE_CURRENT_SENSE)
 #include <esp_adc/adc_oneshot.h>
+#define SUNSHADE_USE_ADC1_ONESHOT 1
+#endif
+
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+#include <esp_rom_sys.h>
 #endif
 
 // rain sensor uses only GPIO — no extra include needed
@@ -66,6 +90,28 @@
 #define SUNSHADE_USE_I2C 1
 #endif
 
+#if defined(CONFIG_WIND_SENSOR_ENABLE) || defined(CONFIG_RAIN_SENSOR_ENABLE) || \
+    defined(SUNSHADE_USE_I2C)
+#define SUNSHADE_USE_SENSORS 1
+#endif
+
+#ifdef CONFIG_SUNSHADE_SUN_SCHEDULE
+#include <time.h>
+#include <esp_sntp.h>
+#endif
+
+#ifdef CONFIG_SUNSHADE_OTA_BACKGROUND
+#include <esp_https_ota.h>
+#include <esp_crt_bundle.h>
+#include <esp_ota_ops.h>
+#endif
+
+#ifdef CONFIG_SUNSHADE_TELEMETRY
+#include <errno.h>
+#include <lwip/sockets.h>
+#include <mdns.h>
+#endif
+
 #include <homekit/homekit.h>
 #include <homekit/characteristics.h>
 
@@ -80,6 +126,7 @@
 #define RELAY_CLOSE_GPIO    CONFIG_ESP_RELAY_CLOSE_GPIO
 #define RELAY_ACTIVE_LEVEL  CONFIG_ESP_RELAY_ACTIVE_LEVEL
 #define RELAY_REVERSE_DELAY_MS CONFIG_ESP_RELAY_REVERSE_DELAY_MS
+#define TARGET_SETTLE_MS    CONFIG_ESP_TARGET_SETTLE_MS
 
 #define TTP_UP_GPIO         CONFIG_ESP_TTP_UP_GPIO
 #define TTP_STOP_GPIO       CONFIG_ESP_TTP_STOP_GPIO
@@ -89,20 +136,33 @@
 
 // ── Timing ────────────────────────────────────────────────────────────────────
 #define DEFAULT_TRAVEL_MS       CONFIG_SUNSHADE_FULL_TRAVEL_TIME_MS
+#define CLOSE_TRAVEL_PCT        CONFIG_SUNSHADE_CLOSE_TRAVEL_PCT
+#define MOTOR_LAG_MS            CONFIG_SUNSHADE_MOTOR_LAG_MS
 #define POS_UPDATE_INTERVAL_MS  500
+#define PROGRESS_NOTIFY_MS      CONFIG_SUNSHADE_PROGRESS_NOTIFY_MS
 
 #define ENDSTOP_BUFFER_FACTOR   1.5f
 #define CAL_OPEN_MAX_MS         120000u
 
+#define LATENCY_REPORT_S        CONFIG_SUNSHADE_LATENCY_REPORT_S
+#define TASK_REPORT_S           CONFIG_SUNSHADE_TASK_REPORT_S
+
 #define TTP_POLL_MS             CONFIG_ESP_TTP_POLL_MS
 #define TTP_DEBOUNCE_MS         CONFIG_ESP_TTP_DEBOUNCE_MS
 #define CAL_HOLD_TRIGGER_MS     3000u
 
 // ── NVS ───────────────────────────────────────────────────────────────────────
 #define NVS_NS          "shade"
-#define NVS_CAL_DONE    "cal_done"
-#define NVS_CAL_MS      "cal_ms"
-#define NVS_LAST_POS    "last_pos"
+#define NVS_CONFIG      "cfg"           // shade_config_t blob
+#define NVS_JOURNAL_PREFIX "jr"         // position journal slots: jr0..jrN
+#define NVS_CAL_DONE    "cal_done"      // legacy, migrated into NVS_CONFIG
+#define NVS_CAL_MS      "cal_ms"        // legacy, migrated into NVS_CONFIG
+#define NVS_FAST_BOOTS  "fast_boots"    // legacy, migrated into NVS_CONFIG
+#define NVS_LAST_POS    "last_pos"      // legacy, read once for migration
+
+#define JOURNAL_SLOTS       8
+#define JOURNAL_IDLE_MS     CONFIG_SUNSHADE_JOURNAL_IDLE_MS
+#define JOURNAL_ARM_MS      100     // after the relay closes: motor running, timer armed
 
 // ── Wind sensor (optional) ────────────────────────────────────────────────────
 #ifdef CONFIG_WIND_SENSOR_ENABLE
@@ -112,6 +172,7 @@
 #define WIND_CLOSE_THRESHOLD_DS  CONFIG_WIND_SENSOR_CLOSE_THRESHOLD_DS
 #define WIND_REOPEN_THRESHOLD_DS CONFIG_WIND_SENSOR_REOPEN_THRESHOLD_DS
 #define WIND_POLL_MS             CONFIG_WIND_SENSOR_POLL_MS
+#define WIND_GUST_WINDOW_MS      CONFIG_WIND_SENSOR_GUST_WINDOW_MS
 #endif
 
 // ── Rain sensor (optional) ────────────────────────────────────────────────────
@@ -126,6 +187,7 @@
 #ifdef SUNSHADE_USE_I2C
 #define I2C_SDA_GPIO        CONFIG_I2C_MASTER_SDA_GPIO
 #define I2C_SCL_GPIO        CONFIG_I2C_MASTER_SCL_GPIO
+#define I2C_BUS_SPEED_HZ    CONFIG_I2C_MASTER_FREQ_HZ
 #endif
 
 // ── Light sensor (optional) ───────────────────────────────────────────────────
@@ -134,6 +196,14 @@
 #define LUX_CLOSE_LUX       CONFIG_LUX_SENSOR_CLOSE_THRESHOLD_LUX
 #define LUX_REOPEN_LUX      CONFIG_LUX_SENSOR_REOPEN_THRESHOLD_LUX
 #define LUX_POLL_MS         CONFIG_LUX_SENSOR_POLL_MS
+#define LUX_FAST_POLL_MS    CONFIG_LUX_SENSOR_FAST_POLL_MS
+#ifdef CONFIG_SUNSHADE_SUN_SCHEDULE
+#define SUN_LEAD_S          (CONFIG_SUNSHADE_SUN_LEAD_MIN * 60u)
+#define SUN_IDLE_POLL_MS    (CONFIG_SUNSHADE_SUN_IDLE_POLL_S * 1000u)
+#define SUN_PLAN_S          86400u          // plan the next 24 h...
+#define SUN_REPLAN_S        21600u          // ...again every 6 h
+#define SUN_TIME_VALID      1704067200u     // 2024-01-01: SNTP has set the clock
+#endif
 #endif
 
 // ── Temperature & humidity sensor (optional) ──────────────────────────────────
@@ -149,6 +219,11 @@ static const char *TAG_BUTTON = "BUTTON";
 static const char *TAG_RELAY  = "RELAY";
 static const char *TAG_CAL    = "CAL";
 static const char *TAG_NVS    = "NVS";
+static const char *TAG_LAT    = "LATENCY";
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+static const char *TAG_CUR    = "CURRENT";
+#endif
+static const char *TAG_TASKS  = "TASKS";
 #ifdef CONFIG_WIND_SENSOR_ENABLE
 static const char *TAG_WIND   = "WIND";
 #endif
@@ -164,495 +239,2550 @@ static const char *TAG_TEMP   = "SHT3X";
 #ifdef SUNSHADE_USE_I2C
 static const char *TAG_I2C    = "I2C";
 #endif
+#ifdef CONFIG_SUNSHADE_TELEMETRY
+static const char *TAG_TELE   = "TELEMETRY";
+#endif
+#ifdef CONFIG_SUNSHADE_OTA_BACKGROUND
+static const char *TAG_OTA    = "OTA";
+#endif
 
 // ── Motion state ──────────────────────────────────────────────────────────────
+// Who asked for a move; carried with each motion command for logging.
 typedef enum {
-    MOTION_CLOSING = 0,
-    MOTION_OPENING = 1,
-    MOTION_STOPPED = 2,
-} motion_dir_t;
-
-static volatile int          s_cur_pos      = 0;
-static volatile int          s_tgt_pos      = 0;
-static volatile motion_dir_t s_motion       = MOTION_STOPPED;
-static volatile TaskHandle_t s_move_task    = NULL;
-static volatile bool         s_task_creating = false;
-static portMUX_TYPE          s_task_mux     = portMUX_INITIALIZER_UNLOCKED;
+    MOTION_SRC_HOMEKIT = 0,
+    MOTION_SRC_TOUCH,
+    MOTION_SRC_HOMING,
+    MOTION_SRC_WIND,
+    MOTION_SRC_RAIN,
+    MOTION_SRC_LUX,
+} motion_source_t;
 
 // ── Calibration state ─────────────────────────────────────────────────────────
 typedef enum {
     CAL_IDLE    = 0,
     CAL_CLOSING,
     CAL_OPENING,
+    CAL_CONFIRMED,      // STOP confirmed one shade; the task moves to the next
 } cal_state_t;
 
+// Calibration and boot homing run over all shades at once, so their state is
+// board-wide; s_cal_shade is the shade whose open end stop is being timed.
 static volatile cal_state_t s_cal_state   = CAL_IDLE;
-static volatile bool        s_cal_done    = false;
-static volatile uint32_t    s_cal_ms      = DEFAULT_TRAVEL_MS;
+static volatile int         s_cal_shade   = 0;
 static volatile uint32_t    s_cal_t0_ms   = 0;
 static volatile bool        s_is_homing   = false;
 static volatile bool        s_cal_success = false;
 
-// ── Wind protection state ─────────────────────────────────────────────────────
-#ifdef CONFIG_WIND_SENSOR_ENABLE
-static volatile bool s_wind_closed    = false;
-static volatile int  s_wind_saved_pos = 0;
+// ── Shade channels ────────────────────────────────────────────────────────────
+// Everything that belongs to one relay pair lives in a shade_t; the motion
+// engine, the persist task and the protection layer walk s_shades[]. Shade 0
+// keeps the NVS namespace of single-shade firmware, so an upgrade keeps its
+// calibration and journal.
+#define SHADE_CHANNELS      CONFIG_SUNSHADE_CHANNELS
+#define TOUCH_CHANNEL       CONFIG_SUNSHADE_TOUCH_CHANNEL   // 0 = all shades
+
+#define SHADE_MASK_ALL      ((1u << SHADE_CHANNELS) - 1)
+
+#if TOUCH_CHANNEL > SHADE_CHANNELS
+#error "CONFIG_SUNSHADE_TOUCH_CHANNEL must not exceed CONFIG_SUNSHADE_CHANNELS"
 #endif
 
-// ── Rain protection state ─────────────────────────────────────────────────────
-#ifdef CONFIG_RAIN_SENSOR_ENABLE
-static volatile bool s_rain_closed    = false;
-static volatile int  s_rain_saved_pos = 0;
+#if defined(CONFIG_WIND_SENSOR_ENABLE) || defined(CONFIG_RAIN_SENSOR_ENABLE) || \
+    defined(CONFIG_LUX_SENSOR_ENABLE)
+#define SUNSHADE_USE_PROTECTION 1
 #endif
 
-// ── Light protection state ────────────────────────────────────────────────────
-#ifdef CONFIG_LUX_SENSOR_ENABLE
-static volatile bool s_lux_closed    = false;
-static volatile int  s_lux_saved_pos = 0;
+typedef struct {
+    uint8_t     idx;
+    gpio_num_t  relay_open_gpio;
+    gpio_num_t  relay_close_gpio;
+    const char *nvs_ns;
+
+    // Position (ppm of full travel), its percent, target and direction as
+    // one seqlocked snapshot (see sunshade_logic.h). Written through
+    // shade_update() only, read with shade_state().
+    motion_seqlock_t      state;
+
+    volatile bool         cal_done;
+    travel_model_t        travel;           // guarded by s_cfg_mux
+    uint8_t               boot_target;      // restored after boot homing
+
+    // Relay driver (see sunshade_logic.h), guarded by s_relay_mux; the timer
+    // ends its reversal dead time.
+    relay_fsm_t           relay;
+    esp_timer_handle_t    relay_timer;
+
+    // Current travel segment, written only by motion_task. The segment starts
+    // when the relay closes (esp_timer time base).
+    int64_t               seg_t0_us;
+    int32_t               seg_start_ppm;
+    uint32_t              last_tick_ms;
+    // Stop deadline (0 = none) and segment generation, guarded by s_seg_mux.
+    volatile int64_t      seg_deadline_us;
+    volatile uint32_t     seg_gen;
+    esp_timer_handle_t    stop_timer;
+
+#ifdef SUNSHADE_USE_PROTECTION
+    // Owns this shade's saved user position. Zero-initialised == prot_init().
+    prot_arbiter_t        prot;             // guarded by s_prot_mux
+    // A HomeKit target still settling in motion_task is the latest user
+    // intent, so it seeds the saved position instead of the published one.
+    settle_window_t       settle;           // guarded by s_prot_mux
+#endif
+
+    shade_config_t        cfg;              // guarded by s_cfg_mux
+    bool                  cfg_dirty;
+    bool                  cfg_migrate;      // erase legacy keys on next write
+
+    journal_record_t      journal_ram;      // guarded by s_journal_mux
+    bool                  journal_dirty;
+    uint32_t              journal_changed;  // now_ms() of the last change
+    bool                  journal_urgent;   // flush without waiting
+    bool                  journal_leaving;  // "moving" record not yet in flash
+    uint32_t              journal_due;      // now_ms() at which it is written
+    bool                  journal_clean;    // newest record in flash is clean
+    uint32_t              journal_seq;      // written only under s_journal_lock
+    int                   journal_slot;
+
+    homekit_characteristic_t current_pos_ch;
+    homekit_characteristic_t target_pos_ch;
+    homekit_characteristic_t pos_state_ch;
+    homekit_characteristic_t hold_pos_ch;
+    int                      notify_sent[3];   // last value sent per slot, -1 = never
+} shade_t;
+
+static void target_position_setter(homekit_characteristic_t *ch, const homekit_value_t value);
+static void hold_position_setter(homekit_characteristic_t *ch, const homekit_value_t value);
+
+#define SHADE_INIT(i, open_gpio, close_gpio, ns) {                                  \
+    .idx              = (i),                                                        \
+    .relay_open_gpio  = (gpio_num_t)(open_gpio),                                    \
+    .relay_close_gpio = (gpio_num_t)(close_gpio),                                   \
+    .nvs_ns           = (ns),                                                       \
+    .state            = MSTATE_INIT(0, 0, 0, MOTION_STOPPED),                       \
+    .travel           = { DEFAULT_TRAVEL_MS,                                        \
+                          DEFAULT_TRAVEL_MS * CLOSE_TRAVEL_PCT / 100, MOTOR_LAG_MS }, \
+    .relay            = RELAY_FSM_INIT,                                             \
+    .journal_slot     = -1,                                                         \
+    .current_pos_ch   = HOMEKIT_CHARACTERISTIC_(CURRENT_POSITION, 0),               \
+    .target_pos_ch    = HOMEKIT_CHARACTERISTIC_(TARGET_POSITION, 0,                 \
+                            .setter_ex = target_position_setter),                   \
+    .pos_state_ch     = HOMEKIT_CHARACTERISTIC_(POSITION_STATE, 2),                 \
+    .hold_pos_ch      = HOMEKIT_CHARACTERISTIC_(HOLD_POSITION, false,               \
+                            .setter_ex = hold_position_setter),                     \
+    .notify_sent      = { -1, -1, -1 },                                             \
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+static shade_t s_shades[SHADE_CHANNELS] = {
+    SHADE_INIT(0, RELAY_OPEN_GPIO, RELAY_CLOSE_GPIO, NVS_NS),
+#if SHADE_CHANNELS >= 2
+    SHADE_INIT(1, CONFIG_ESP_RELAY2_OPEN_GPIO, CONFIG_ESP_RELAY2_CLOSE_GPIO, NVS_NS "1"),
+#endif
+#if SHADE_CHANNELS >= 3
+    SHADE_INIT(2, CONFIG_ESP_RELAY3_OPEN_GPIO, CONFIG_ESP_RELAY3_CLOSE_GPIO, NVS_NS "2"),
+#endif
+#if SHADE_CHANNELS >= 4
+    SHADE_INIT(3, CONFIG_ESP_RELAY4_OPEN_GPIO, CONFIG_ESP_RELAY4_CLOSE_GPIO, NVS_NS "3"),
 #endif
+};
+#pragma GCC diagnostic pop
+
+// Readers on any task or core take a consistent snapshot without a lock.
+static inline motion_state_t shade_state(shade_t *sh) {
+    return mstate_read(&sh->state);
+}
+
+// The motion task, the job task and calibration_confirm_open() all write, so
+// writers take s_state_mux; readers never do. SHADE_KEEP leaves a field as it
+// is; the percent always follows the ppm position.
+#define SHADE_KEEP      (-1)
+#define SHADE_KEEP_PPM  INT32_MIN
+
+static portMUX_TYPE s_state_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void shade_update(shade_t *sh, int32_t ppm, int target, int dir) {
+    taskENTER_CRITICAL(&s_state_mux);
+    motion_state_t st = shade_state(sh);
+    if (ppm != SHADE_KEEP_PPM) {
+        st.pos_ppm = pos_clamp_ppm(ppm);
+        st.pos     = (uint8_t)pos_ppm_to_pct(st.pos_ppm);
+    }
+    if (target != SHADE_KEEP) {
+        st.target = (uint8_t)clamp_position(target);
+    }
+    if (dir != SHADE_KEEP) {
+        st.dir = (uint8_t)dir;
+    }
+    mstate_write(&sh->state, &st);
+    taskEXIT_CRITICAL(&s_state_mux);
+}
+
+static void position_set(shade_t *sh, int32_t ppm) {
+    shade_update(sh, ppm, SHADE_KEEP, SHADE_KEEP);
+}
 
-// Last direction the relays were energised in, for reversal dead-time tracking.
-static volatile motion_dir_t s_relay_dir = MOTION_STOPPED;
+// ── Protection state ──────────────────────────────────────────────────────────
+// Wind, rain and lux protection go through one arbiter per shade (see
+// sunshade_logic.h); the sensors engage and release a source on all of them.
+#ifdef SUNSHADE_USE_PROTECTION
+static portMUX_TYPE s_prot_mux = portMUX_INITIALIZER_UNLOCKED;
+#endif
 
 // ── Forward declarations ───────────────────────────────────────────────────────
-static void sunshade_stop(void);
-static void sunshade_move_to(int target);
+static void sunshade_stop(shade_t *sh, motion_source_t source);
+static void sunshade_move_to(shade_t *sh, int target, motion_source_t source);
 static void relays_all_off(void);
-static void homekit_notify_position(void);
+static void homekit_notify_position(shade_t *sh);
 static void calibration_confirm_open(void);
-static void hold_position_setter(homekit_value_t value);
+static void persist_kick(void);
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+static void travel_learn_kick(shade_t *sh, int32_t start_ppm, int target);
+#endif
 
 // ── Timing helper ─────────────────────────────────────────────────────────────
 static inline uint32_t now_ms(void) {
     return (uint32_t)(esp_timer_get_time() / 1000ULL);
 }
 
-// ── NVS helpers ───────────────────────────────────────────────────────────────
-static void nvs_load_calibration(void) {
-    nvs_handle_t h;
+// ── Task arena ────────────────────────────────────────────────────────────────
+// Every firmware task is created once at boot from a stack and TCB reserved
+// here, so no task ever takes its stack from the heap the HAP and TLS sessions
+// need. Tasks that only run now and then (calibration, homing, LED patterns)
+// block on a notification instead of being created and deleted. Stack sizes
+// are in bytes; task_stats_format() reports each task's high-water mark so the
+// sizes can be trimmed from field data.
+//
+// The tasks that switch relays or decide to (motion, touch, calibration and
+// homing, the protection sensors) run on CONTROL_CORE in a priority band of
+// their own, with the motion engine on top. By default that is core 1, and
+// everything else shares core 0 with Wi-Fi, lwIP and esp_timer. The stop
+// timers that cut the relays run in the esp_timer task (priority 22), above
+// all of these; LAT_STOP_RELAY traces how late they fire.
+#ifdef CONFIG_SUNSHADE_PIN_TASKS
+#define CONTROL_CORE        CONFIG_SUNSHADE_CONTROL_CORE
+#define HOUSEKEEPING_CORE   (1 - CONFIG_SUNSHADE_CONTROL_CORE)
+#else
+#define CONTROL_CORE        tskNO_AFFINITY
+#define HOUSEKEEPING_CORE   tskNO_AFFINITY
+#endif
+#define CONTROL_PRIO        CONFIG_SUNSHADE_CONTROL_PRIO
+
+#define PERSIST_TASK_STACK  3072
+#define PERSIST_TASK_PRIO   2
+#define MOTION_TASK_STACK   4096
+#define MOTION_TASK_PRIO    CONTROL_PRIO
+#define TTP_TASK_STACK      4096
+#define TTP_TASK_PRIO       (CONTROL_PRIO - 1)
+#define JOB_TASK_STACK      4096    // calibration and boot homing
+#define JOB_TASK_PRIO       (CONTROL_PRIO - 2)
+#define LED_TASK_STACK      1024    // calibration blink and identify
+#define LED_TASK_PRIO       2
+#define SENSOR_TASK_STACK   4096
+#define SENSOR_TASK_PRIO    (CONTROL_PRIO - 3)
+#define EVLOG_TASK_STACK    3072    // formats the event log for the console
+#define EVLOG_TASK_PRIO     1
+#define TELE_TASK_STACK     4096    // serves the telemetry history
+#define TELE_TASK_PRIO      1
+#define OTA_TASK_STACK      8192    // TLS handshake and image download
+#define OTA_TASK_PRIO       1
+
+// Notification bits of the job and LED tasks.
+#define JOB_HOMING_MASK     SHADE_MASK_ALL
+#define JOB_CALIBRATE       (1u << 31)
+#define JOB_LEARN           (1u << 30)
+#define LED_CALIBRATION     (1u << 0)
+#define LED_IDENTIFY        (1u << 1)
 
-    if (nvs_open(NVS_NS, NVS_READONLY, &h) != ESP_OK) {
-        ESP_LOGI(TAG_NVS, "No calibration found; using default %lu ms",
-                 (unsigned long)DEFAULT_TRAVEL_MS);
-        return;
+typedef enum {
+    TASK_PERSIST = 0,
+    TASK_MOTION,
+    TASK_TTP,
+    TASK_JOB,
+    TASK_LED,
+    TASK_EVLOG,
+#ifdef SUNSHADE_USE_SENSORS
+    TASK_SENSORS,
+#endif
+#ifdef CONFIG_SUNSHADE_TELEMETRY
+    TASK_TELE,
+#endif
+#ifdef CONFIG_SUNSHADE_OTA_BACKGROUND
+    TASK_OTA,
+#endif
+    TASK_COUNT,
+} task_id_t;
+
+typedef struct {
+    const char  *name;
+    uint32_t     stack;
+    UBaseType_t  prio;
+    BaseType_t   core;
+    StackType_t *buf;
+} task_def_t;
+
+static StackType_t s_persist_stack[PERSIST_TASK_STACK];
+static StackType_t s_motion_stack[MOTION_TASK_STACK];
+static StackType_t s_ttp_stack[TTP_TASK_STACK];
+static StackType_t s_job_stack[JOB_TASK_STACK];
+static StackType_t s_led_stack[LED_TASK_STACK];
+static StackType_t s_evlog_stack[EVLOG_TASK_STACK];
+#ifdef SUNSHADE_USE_SENSORS
+static StackType_t s_sensor_stack[SENSOR_TASK_STACK];
+#endif
+#ifdef CONFIG_SUNSHADE_TELEMETRY
+static StackType_t s_tele_stack[TELE_TASK_STACK];
+#endif
+#ifdef CONFIG_SUNSHADE_OTA_BACKGROUND
+static StackType_t s_ota_stack[OTA_TASK_STACK];
+#endif
+
+static const task_def_t s_task_defs[TASK_COUNT] = {
+    [TASK_PERSIST] = { "persist",       PERSIST_TASK_STACK, PERSIST_TASK_PRIO, HOUSEKEEPING_CORE, s_persist_stack },
+    [TASK_MOTION]  = { "sunshade_move", MOTION_TASK_STACK,  MOTION_TASK_PRIO,  CONTROL_CORE,      s_motion_stack  },
+    [TASK_TTP]     = { "ttp_task",      TTP_TASK_STACK,     TTP_TASK_PRIO,     CONTROL_CORE,      s_ttp_stack     },
+    [TASK_JOB]     = { "shade_job",     JOB_TASK_STACK,     JOB_TASK_PRIO,     CONTROL_CORE,      s_job_stack     },
+    [TASK_LED]     = { "led",           LED_TASK_STACK,     LED_TASK_PRIO,     HOUSEKEEPING_CORE, s_led_stack     },
+    [TASK_EVLOG]   = { "evlog",         EVLOG_TASK_STACK,   EVLOG_TASK_PRIO,   HOUSEKEEPING_CORE, s_evlog_stack   },
+#ifdef SUNSHADE_USE_SENSORS
+    [TASK_SENSORS] = { "sensors",       SENSOR_TASK_STACK,  SENSOR_TASK_PRIO,  CONTROL_CORE,      s_sensor_stack  },
+#endif
+#ifdef CONFIG_SUNSHADE_TELEMETRY
+    [TASK_TELE]    = { "telemetry",     TELE_TASK_STACK,    TELE_TASK_PRIO,    HOUSEKEEPING_CORE, s_tele_stack    },
+#endif
+#ifdef CONFIG_SUNSHADE_OTA_BACKGROUND
+    [TASK_OTA]     = { "ota",           OTA_TASK_STACK,     OTA_TASK_PRIO,     HOUSEKEEPING_CORE, s_ota_stack     },
+#endif
+};
+
+static StaticTask_t       s_task_tcb[TASK_COUNT];
+static TaskHandle_t       s_task_handle[TASK_COUNT];
+static char               s_task_text[256];             // TaskStats value
+static esp_timer_handle_t s_task_timer = NULL;
+
+static TaskHandle_t task_start(task_id_t id, TaskFunction_t fn) {
+    const task_def_t *d = &s_task_defs[id];
+
+    s_task_handle[id] = xTaskCreateStaticPinnedToCore(fn, d->name, d->stack, NULL, d->prio,
+                                                      d->buf, &s_task_tcb[id], d->core);
+    return s_task_handle[id];
+}
+
+// The HomeKit library starts its server task with xTaskCreate(), unpinned,
+// and has no option for its core. With SUNSHADE_PIN_TASKS the link wraps the
+// FreeRTOS create calls (main/CMakeLists.txt) so that this one task lands on
+// HOUSEKEEPING_CORE; every other call passes through unchanged.
+// homekit_task_check() reports where it actually runs.
+#define HOMEKIT_TASK_NAME   "HomeKit Server"
+
+#ifdef CONFIG_SUNSHADE_PIN_TASKS
+BaseType_t __real_xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack,
+                                          void *arg, UBaseType_t prio, TaskHandle_t *out,
+                                          BaseType_t core);
+BaseType_t __wrap_xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack,
+                                          void *arg, UBaseType_t prio, TaskHandle_t *out,
+                                          BaseType_t core);
+BaseType_t __wrap_xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                              UBaseType_t prio, TaskHandle_t *out);
+
+static BaseType_t task_core_for(const char *name, BaseType_t core) {
+    if (core == tskNO_AFFINITY && name != NULL && strcmp(name, HOMEKIT_TASK_NAME) == 0) {
+        return HOUSEKEEPING_CORE;
     }
+    return core;
+}
+
+BaseType_t __wrap_xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack,
+                                          void *arg, UBaseType_t prio, TaskHandle_t *out,
+                                          BaseType_t core) {
+    return __real_xTaskCreatePinnedToCore(fn, name, stack, arg, prio, out,
+                                          task_core_for(name, core));
+}
+
+// Only reached where xTaskCreate() is a function of its own (ESP-IDF 5.2+);
+// it is an inline wrapper of xTaskCreatePinnedToCore() on older releases.
+BaseType_t __wrap_xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                              UBaseType_t prio, TaskHandle_t *out) {
+    return __real_xTaskCreatePinnedToCore(fn, name, stack, arg, prio, out,
+                                          task_core_for(name, tskNO_AFFINITY));
+}
+#endif
 
-    uint8_t done = 0;
-    if (nvs_get_u8(h, NVS_CAL_DONE, &done) != ESP_OK) {
-        done = 0;
+static void homekit_task_check(void) {
+#ifdef CONFIG_SUNSHADE_PIN_TASKS
+    TaskHandle_t hk = xTaskGetHandle(HOMEKIT_TASK_NAME);
+    if (hk == NULL) {
+        ESP_LOGW(TAG_TASKS, "HomeKit server task \"%s\" not found; it may run on core %d",
+                 HOMEKIT_TASK_NAME, CONTROL_CORE);
+    } else if (xTaskGetCoreID(hk) != HOUSEKEEPING_CORE) {
+        ESP_LOGW(TAG_TASKS, "HomeKit server task is not pinned; it may run on core %d",
+                 CONTROL_CORE);
+    } else {
+        ESP_LOGI(TAG_TASKS, "HomeKit server task pinned to core %d", HOUSEKEEPING_CORE);
     }
+#endif
+}
 
-    if (done) {
-        uint32_t ms = DEFAULT_TRAVEL_MS;
-        if (nvs_get_u32(h, NVS_CAL_MS, &ms) == ESP_OK && ms > 0) {
-            s_cal_ms   = ms;
-            s_cal_done = true;
-            ESP_LOGI(TAG_NVS, "Calibration loaded: %lu ms", (unsigned long)ms);
-        } else {
-            ESP_LOGW(TAG_NVS, "Calibration flag set but value invalid; using default");
+// "heap=<free> min=<lowest free> blk=<largest block>; <task>=<min free>/<size> ..."
+// in bytes. The stack figure is the high-water mark: the least free stack the
+// task has ever had.
+static void task_stats_format(char *buf, size_t len) {
+    int off = snprintf(buf, len, "heap=%u min=%u blk=%u;",
+                       (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+                       (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+                       (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+    for (int id = 0; id < TASK_COUNT && off > 0 && (size_t)off < len; id++) {
+        if (s_task_handle[id] == NULL) {
+            continue;
         }
-    } else {
-        ESP_LOGI(TAG_NVS, "Device not calibrated; using default %lu ms",
-                 (unsigned long)DEFAULT_TRAVEL_MS);
+        int n = snprintf(buf + off, len - (size_t)off, " %s=%u/%lu", s_task_defs[id].name,
+                         (unsigned)uxTaskGetStackHighWaterMark(s_task_handle[id]),
+                         (unsigned long)s_task_defs[id].stack);
+        if (n < 0) break;
+        off += n;
     }
+}
 
-    nvs_close(h);
+// Runs in the HAP server task on every read of the characteristic.
+static homekit_value_t task_stats_getter(const homekit_characteristic_t *ch) {
+    task_stats_format(s_task_text, sizeof(s_task_text));
+    return HOMEKIT_STRING(s_task_text, .is_static = true);
 }
 
-static void nvs_save_calibration(uint32_t travel_ms) {
-    nvs_handle_t h;
+static void task_report_cb(void *arg) {
+    char line[256];
+
+    task_stats_format(line, sizeof(line));
+    ESP_LOGI(TAG_TASKS, "%s", line);
+}
 
-    if (nvs_open(NVS_NS, NVS_READWRITE, &h) != ESP_OK) {
-        ESP_LOGE(TAG_NVS, "Cannot open NVS for calibration save");
+static void task_report_init(void) {
+    if (TASK_REPORT_S == 0) {
         return;
     }
+    const esp_timer_create_args_t report_args = {
+        .callback = task_report_cb,
+        .name     = "task_report",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&report_args, &s_task_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(s_task_timer,
+                                             (uint64_t)TASK_REPORT_S * 1000000ULL));
+}
 
-    esp_err_t err = nvs_set_u8(h, NVS_CAL_DONE, 1);
-    if (err == ESP_OK) err = nvs_set_u32(h, NVS_CAL_MS, travel_ms);
-    if (err == ESP_OK) err = nvs_commit(h);
-    nvs_close(h);
+// ── Latency trace ─────────────────────────────────────────────────────────────
+// Trace points on the hot paths feed fixed-bucket histograms (see
+// sunshade_logic.h). A sample costs one spinlocked increment and never touches
+// the heap, so it is safe from esp_timer callbacks. The summary is formatted on
+// demand for the LatencyStats characteristic and, every LATENCY_REPORT_S, for
+// the serial console.
+typedef enum {
+    LAT_HK_RELAY = 0,   // HomeKit target write -> relay switched (incl. settling)
+    LAT_TOUCH_RELAY,    // debounced touch edge -> relay switched
+    LAT_HK_NOTIFY,      // homekit_notify_flush() run time
+    LAT_NVS_COMMIT,     // NVS open/set/commit of a journal or config write
+    LAT_WIFI_CONNECT,   // STA start/disconnect -> IP (see wifi_last_connect_us())
+    LAT_STOP_RELAY,     // stop deadline -> relay cut by the stop timer
+    LAT_COUNT,
+} lat_id_t;
+
+static const char *const s_lat_names[LAT_COUNT] = {
+    "hk>relay", "touch>relay", "notify", "nvs", "wifi", "stop>relay",
+};
 
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG_NVS, "Calibration save failed: %s", esp_err_to_name(err));
-    } else {
-        ESP_LOGI(TAG_NVS, "Calibration saved: %lu ms", (unsigned long)travel_ms);
-    }
-}
+static lat_hist_t         s_lat[LAT_COUNT];             // guarded by s_lat_mux
+static portMUX_TYPE       s_lat_mux            = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t           s_lat_logged[LAT_COUNT];      // count at last console report
+static char               s_lat_text[384];              // LatencyStats value
+static esp_timer_handle_t s_lat_timer          = NULL;
 
-static uint8_t nvs_load_last_position(void) {
-    nvs_handle_t h;
-    uint8_t pos = 0;
+static void latency_record(lat_id_t id, int64_t t0_us, int64_t t1_us) {
+    int64_t d = t1_us - t0_us;
+    if (d < 0) d = 0;
+    if (d > UINT32_MAX) d = UINT32_MAX;
 
-    if (nvs_open(NVS_NS, NVS_READONLY, &h) != ESP_OK) {
-        return 0;
-    }
+    taskENTER_CRITICAL(&s_lat_mux);
+    lat_record(&s_lat[id], (uint32_t)d);
+    taskEXIT_CRITICAL(&s_lat_mux);
+}
 
-    if (nvs_get_u8(h, NVS_LAST_POS, &pos) != ESP_OK || pos > 100) {
-        pos = 0;
-    }
-    nvs_close(h);
+static void latency_snapshot(lat_id_t id, lat_hist_t *out) {
+    taskENTER_CRITICAL(&s_lat_mux);
+    *out = s_lat[id];
+    taskEXIT_CRITICAL(&s_lat_mux);
+}
 
-    ESP_LOGI(TAG_NVS, "Last saved position: %d%%", pos);
-    return pos;
+// "<name> n=<count> p50=<ms> p99=<ms> max=<ms>" with 0.1 ms resolution.
+static int latency_format_one(char *buf, size_t len, lat_id_t id, const lat_hist_t *h) {
+    uint32_t p50 = lat_percentile_us(h, 50);
+    uint32_t p99 = lat_percentile_us(h, 99);
+    return snprintf(buf, len, "%s n=%lu p50=%lu.%lu p99=%lu.%lu max=%lu.%lu",
+                    s_lat_names[id], (unsigned long)h->count,
+                    (unsigned long)(p50 / 1000), (unsigned long)(p50 % 1000 / 100),
+                    (unsigned long)(p99 / 1000), (unsigned long)(p99 % 1000 / 100),
+                    (unsigned long)(h->max_us / 1000),
+                    (unsigned long)(h->max_us % 1000 / 100));
 }
 
-static void nvs_save_last_position(uint8_t pos) {
-    if (pos > 100) {
-        pos = 100;
+// Runs in the HAP server task on every read of the characteristic.
+static homekit_value_t latency_stats_getter(const homekit_characteristic_t *ch) {
+    size_t off = 0;
+
+    s_lat_text[0] = '\0';
+    for (int id = 0; id < LAT_COUNT && off < sizeof(s_lat_text); id++) {
+        lat_hist_t h;
+        latency_snapshot((lat_id_t)id, &h);
+        int n = latency_format_one(s_lat_text + off, sizeof(s_lat_text) - off,
+                                   (lat_id_t)id, &h);
+        if (n < 0) break;
+        off += (size_t)n;
+        if (id < LAT_COUNT - 1 && off + 2 < sizeof(s_lat_text)) {
+            s_lat_text[off++] = ';';
+            s_lat_text[off++] = ' ';
+            s_lat_text[off]   = '\0';
+        }
     }
+    return HOMEKIT_STRING(s_lat_text, .is_static = true);
+}
 
-    nvs_handle_t h;
+static void latency_report_cb(void *arg) {
+    for (int id = 0; id < LAT_COUNT; id++) {
+        lat_hist_t h;
+        latency_snapshot((lat_id_t)id, &h);
+        if (h.count == s_lat_logged[id]) {
+            continue;       // nothing new since the last report
+        }
+        s_lat_logged[id] = h.count;
+
+        char line[96];
+        latency_format_one(line, sizeof(line), (lat_id_t)id, &h);
+        ESP_LOGI(TAG_LAT, "%s ms", line);
+    }
+}
 
-    if (nvs_open(NVS_NS, NVS_READWRITE, &h) != ESP_OK) {
+static void latency_init(void) {
+    if (LATENCY_REPORT_S == 0) {
         return;
     }
+    const esp_timer_create_args_t report_args = {
+        .callback = latency_report_cb,
+        .name     = "lat_report",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&report_args, &s_lat_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(s_lat_timer,
+                                             (uint64_t)LATENCY_REPORT_S * 1000000ULL));
+}
 
-    esp_err_t err = nvs_set_u8(h, NVS_LAST_POS, pos);
-    if (err == ESP_OK) err = nvs_commit(h);
-    nvs_close(h);
+// ── Event log ─────────────────────────────────────────────────────────────────
+// Per-sample readings and calibration progress are recorded as fixed binary
+// records in a RAM ring (see sunshade_logic.h) rather than formatted and
+// written to the UART as they happen. Recording one is a handful of stores and
+// never blocks, so the sensor and job tasks keep their timing. Records are
+// formatted only when a reader drains them: the EventLog characteristic on
+// every read, and the low-priority evlog task while console output is on.
+// SampleLog switches the console output at run time.
+#define EVLOG_DRAIN_MS  1000
 
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG_NVS, "Failed to save last position: %s", esp_err_to_name(err));
-    } else {
-        ESP_LOGD(TAG_NVS, "Saved target position: %d%%", pos);
-    }
+typedef enum {
+    EV_WIND = 0,        // speed dm/s, mV, gust dm/s, mean dm/s
+    EV_LUX,             // lux, raw count, MTreg
+    EV_TEMP,            // 0.1 °C, 0.1 %RH
+    EV_CAL_PROGRESS,    // shade, %, elapsed s
+} ev_id_t;
+
+static evlog_ring_t     s_evlog;
+static evlog_reader_t   s_evlog_remote;                 // HAP server task only
+static char             s_evlog_text[256];              // EventLog value
+static volatile uint8_t s_sample_log =
+#ifdef CONFIG_SUNSHADE_SAMPLE_LOG_CONSOLE
+    1;
+#else
+    0;
+#endif
+
+static void evlog_put(ev_id_t id, int32_t a, int32_t b, int32_t c, int32_t d) {
+    evlog_event_t ev = { .t_ms = now_ms(), .id = (uint16_t)id, .v = { a, b, c, d } };
+    evlog_write(&s_evlog, &ev);
 }
 
-// ── LED ───────────────────────────────────────────────────────────────────────
-static void led_write(bool on) {
-    gpio_set_level(LED_GPIO, on ? 1 : 0);
+static const char *evlog_tag(const evlog_event_t *ev) {
+    switch (ev->id) {
+#ifdef CONFIG_WIND_SENSOR_ENABLE
+    case EV_WIND:         return TAG_WIND;
+#endif
+#ifdef CONFIG_LUX_SENSOR_ENABLE
+    case EV_LUX:          return TAG_LUX;
+#endif
+#ifdef CONFIG_TEMP_SENSOR_ENABLE
+    case EV_TEMP:         return TAG_TEMP;
+#endif
+    case EV_CAL_PROGRESS: return TAG_CAL;
+    default:              return TAG;
+    }
 }
 
-// ── Relay control ─────────────────────────────────────────────────────────────
-// Honour the board's active level (CONFIG_ESP_RELAY_ACTIVE_LEVEL) and enforce a
-// dead time when reversing direction so an AC tubular motor is never switched
-// straight from one direction to the other.
-static void relays_all_off(void) {
-    gpio_set_level(RELAY_OPEN_GPIO,  relay_output_level(RELAY_ACTIVE_LEVEL, false));
-    gpio_set_level(RELAY_CLOSE_GPIO, relay_output_level(RELAY_ACTIVE_LEVEL, false));
-    s_relay_dir = MOTION_STOPPED;
-    ESP_LOGD(TAG_RELAY, "Both relays OFF");
+// The event as the console line it used to be, without tag or timestamp.
+static int evlog_format(char *buf, size_t len, const evlog_event_t *ev) {
+    const int32_t *v = ev->v;
+
+    switch (ev->id) {
+    case EV_WIND:
+        return snprintf(buf, len, "%d.%d m/s (%d mV) | gust %d.%d, mean %d.%d m/s",
+                        (int)(v[0] / 10), (int)(v[0] % 10), (int)v[1],
+                        (int)(v[2] / 10), (int)(v[2] % 10), (int)(v[3] / 10), (int)(v[3] % 10));
+    case EV_LUX:
+        return snprintf(buf, len, "%d lux (raw=%d, MTreg %d)", (int)v[0], (int)v[1], (int)v[2]);
+    case EV_TEMP: {
+        int32_t t = (v[0] < 0) ? -v[0] : v[0];
+        return snprintf(buf, len, "%s%d.%d C, %d.%d %%RH", (v[0] < 0) ? "-" : "",
+                        (int)(t / 10), (int)(t % 10), (int)(v[1] / 10), (int)(v[1] % 10));
+    }
+    case EV_CAL_PROGRESS:
+        return snprintf(buf, len, "Shade %d opening... ~%d%% (%d s) - press STOP when fully open",
+                        (int)v[0], (int)v[1], (int)v[2]);
+    default:
+        return snprintf(buf, len, "event %u: %ld %ld %ld %ld", (unsigned)ev->id,
+                        (long)v[0], (long)v[1], (long)v[2], (long)v[3]);
+    }
 }
 
-static void relay_reverse_guard(motion_dir_t new_dir) {
-    if (RELAY_REVERSE_DELAY_MS > 0 &&
-        s_relay_dir != MOTION_STOPPED && s_relay_dir != new_dir) {
-        gpio_set_level(RELAY_OPEN_GPIO,  relay_output_level(RELAY_ACTIVE_LEVEL, false));
-        gpio_set_level(RELAY_CLOSE_GPIO, relay_output_level(RELAY_ACTIVE_LEVEL, false));
-        ESP_LOGD(TAG_RELAY, "Reversal dead time %d ms", RELAY_REVERSE_DELAY_MS);
-        vTaskDelay(pdMS_TO_TICKS(RELAY_REVERSE_DELAY_MS));
+// Runs in the HAP server task on every read: "<s>.<ms> <TAG> <event>; ..."
+// for the events since the previous read, oldest first, as many as fit. The
+// rest stay queued for the next read.
+static homekit_value_t evlog_getter(const homekit_characteristic_t *ch) {
+    size_t        off = 0;
+    evlog_event_t ev;
+
+    s_evlog_text[0] = '\0';
+    for (;;) {
+        evlog_reader_t before = s_evlog_remote;
+        if (!evlog_read(&s_evlog, &s_evlog_remote, &ev)) {
+            break;
+        }
+
+        char line[128];
+        int  n = snprintf(line, sizeof(line), "%s%lu.%03lu %s ", off ? "; " : "",
+                          (unsigned long)(ev.t_ms / 1000), (unsigned long)(ev.t_ms % 1000),
+                          evlog_tag(&ev));
+        if (n > 0 && (size_t)n < sizeof(line)) {
+            evlog_format(line + n, sizeof(line) - (size_t)n, &ev);
+        }
+        size_t line_len = strlen(line);
+        if (off + line_len >= sizeof(s_evlog_text)) {
+            s_evlog_remote = before;
+            break;
+        }
+        memcpy(s_evlog_text + off, line, line_len + 1);
+        off += line_len;
     }
+    return HOMEKIT_STRING(s_evlog_text, .is_static = true);
 }
 
-static void relay_activate_open(void) {
-    relay_reverse_guard(MOTION_OPENING);
-    gpio_set_level(RELAY_CLOSE_GPIO, relay_output_level(RELAY_ACTIVE_LEVEL, false));
-    gpio_set_level(RELAY_OPEN_GPIO,  relay_output_level(RELAY_ACTIVE_LEVEL, true));
-    s_relay_dir = MOTION_OPENING;
-    ESP_LOGD(TAG_RELAY, "OPEN relay ON");
+static homekit_value_t sample_log_getter(const homekit_characteristic_t *ch) {
+    return HOMEKIT_UINT8(s_sample_log);
 }
 
-static void relay_activate_close(void) {
-    relay_reverse_guard(MOTION_CLOSING);
-    gpio_set_level(RELAY_OPEN_GPIO,  relay_output_level(RELAY_ACTIVE_LEVEL, false));
-    gpio_set_level(RELAY_CLOSE_GPIO, relay_output_level(RELAY_ACTIVE_LEVEL, true));
-    s_relay_dir = MOTION_CLOSING;
-    ESP_LOGD(TAG_RELAY, "CLOSE relay ON");
+static void sample_log_setter(homekit_characteristic_t *ch, const homekit_value_t value) {
+    if (value.format != homekit_format_uint8) {
+        ESP_LOGE(TAG, "sample_log: unexpected format %d", value.format);
+        return;
+    }
+    s_sample_log = value.uint8_value ? 1 : 0;
+    ESP_LOGI(TAG, "HomeKit -> sample log %s", s_sample_log ? "on the console" : "recorded only");
+    xTaskNotify(s_task_handle[TASK_EVLOG], 1, eSetBits);
 }
 
-// ── HomeKit characteristics ───────────────────────────────────────────────────
-static void target_position_setter(homekit_value_t value);
+// Drains the ring to the console every EVLOG_DRAIN_MS while SampleLog is on,
+// and sleeps until it is switched on otherwise.
+static void evlog_task(void *arg) {
+    evlog_reader_t rd          = {0};
+    uint32_t       lost_logged = 0;
 
-static homekit_characteristic_t current_pos_ch =
-    HOMEKIT_CHARACTERISTIC_(CURRENT_POSITION, 0);
+    for (;;) {
+        if (!s_sample_log) {
+            xTaskNotifyWait(0, UINT32_MAX, NULL, portMAX_DELAY);
+            evlog_reader_sync(&s_evlog, &rd);   // no backlog from while it was off
+            lost_logged = 0;
+            continue;
+        }
+
+        evlog_event_t ev;
+        while (evlog_read(&s_evlog, &rd, &ev)) {
+            char line[128];
+            evlog_format(line, sizeof(line), &ev);
+            ESP_LOGI(evlog_tag(&ev), "[%lu.%03lu] %s", (unsigned long)(ev.t_ms / 1000),
+                     (unsigned long)(ev.t_ms % 1000), line);
+        }
+        if (rd.lost != lost_logged) {
+            ESP_LOGW(TAG, "Event log: %lu events overwritten before printing",
+                     (unsigned long)(rd.lost - lost_logged));
+            lost_logged = rd.lost;
+        }
+        vTaskDelay(pdMS_TO_TICKS(EVLOG_DRAIN_MS));
+    }
+}
 
-static homekit_characteristic_t target_pos_ch =
-    HOMEKIT_CHARACTERISTIC_(TARGET_POSITION, 0,
-        .setter = target_position_setter);
+// ── Telemetry history ─────────────────────────────────────────────────────────
+// Every sensor reading is also kept in a fixed-size history (see
+// sunshade_logic.h): the raw samples of about the last minute, one-minute
+// buckets for the last hour and 15-minute buckets for the last day, each with
+// min, max and mean. Values are the integers the sensors already work in.
+// All storage is static and sized at build time from the poll periods; the
+// raw ring of a fast-polled sensor is capped at TELE_RAW_MAX samples.
+#define TELE_RAW_MS         60000u
+#define TELE_RAW_MAX        120
+#define TELE_RAW_SLOTS(poll_ms) \
+    ((TELE_RAW_MS / (poll_ms)) > TELE_RAW_MAX ? TELE_RAW_MAX : (TELE_RAW_MS / (poll_ms)))
 
-static homekit_characteristic_t pos_state_ch =
-    HOMEKIT_CHARACTERISTIC_(POSITION_STATE, 2);
+typedef enum {
+#ifdef CONFIG_WIND_SENSOR_ENABLE
+    TELE_WIND,          // dm/s
+#endif
+#ifdef CONFIG_LUX_SENSOR_ENABLE
+    TELE_LUX,           // lux
+#endif
+#ifdef CONFIG_TEMP_SENSOR_ENABLE
+    TELE_TEMP,          // 0.1 °C
+    TELE_HUMID,         // 0.1 %RH
+#endif
+    TELE_COUNT,
+} tele_id_t;
 
-static homekit_characteristic_t hold_pos_ch =
-    HOMEKIT_CHARACTERISTIC_(HOLD_POSITION, false,
-        .setter = hold_position_setter);
+#ifdef CONFIG_SUNSHADE_TELEMETRY
+typedef struct {
+    const char    *name;
+    const char    *unit;
+    tele_sample_t *raw;
+    uint16_t       raw_cap;
+} tele_def_t;
 
-// ── Environmental sensor characteristics (display-only) ───────────────────────
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Woverride-init"
+#ifdef CONFIG_WIND_SENSOR_ENABLE
+static tele_sample_t s_tele_wind_raw[TELE_RAW_SLOTS(WIND_POLL_MS)];
+#endif
+#ifdef CONFIG_LUX_SENSOR_ENABLE
+static tele_sample_t s_tele_lux_raw[TELE_RAW_SLOTS(LUX_FAST_POLL_MS)];
+#endif
 #ifdef CONFIG_TEMP_SENSOR_ENABLE
-// Widen the default 0–100 °C range to the SHT3x range so outdoor sub-zero
-// temperatures are reported instead of being clamped at 0 °C.
-static homekit_characteristic_t cur_temp_ch =
-    HOMEKIT_CHARACTERISTIC_(CURRENT_TEMPERATURE, 0,
-        .min_value = (float[]) {-40},
-        .max_value = (float[]) {125});
-static homekit_characteristic_t cur_humid_ch =
-    HOMEKIT_CHARACTERISTIC_(CURRENT_RELATIVE_HUMIDITY, 0);
+static tele_sample_t s_tele_temp_raw[TELE_RAW_SLOTS(TEMP_POLL_MS)];
+static tele_sample_t s_tele_humid_raw[TELE_RAW_SLOTS(TEMP_POLL_MS)];
+#endif
+
+#define TELE_DEF(name, unit, raw) { name, unit, raw, sizeof(raw) / sizeof((raw)[0]) }
+
+static const tele_def_t s_tele_defs[TELE_COUNT] = {
+#ifdef CONFIG_WIND_SENSOR_ENABLE
+    [TELE_WIND]  = TELE_DEF("wind",        "dm/s",   s_tele_wind_raw),
 #endif
 #ifdef CONFIG_LUX_SENSOR_ENABLE
-// HAP CURRENT_AMBIENT_LIGHT_LEVEL valid range is 0.0001–100000 lux.
-static homekit_characteristic_t cur_lux_ch =
-    HOMEKIT_CHARACTERISTIC_(CURRENT_AMBIENT_LIGHT_LEVEL, 0.0001f);
+    [TELE_LUX]   = TELE_DEF("lux",         "lux",    s_tele_lux_raw),
 #endif
-#pragma GCC diagnostic pop
+#ifdef CONFIG_TEMP_SENSOR_ENABLE
+    [TELE_TEMP]  = TELE_DEF("temperature", "0.1 C",  s_tele_temp_raw),
+    [TELE_HUMID] = TELE_DEF("humidity",    "0.1 %RH", s_tele_humid_raw),
+#endif
+};
 
-static void homekit_notify_position(void) {
-    current_pos_ch.value = HOMEKIT_UINT8((uint8_t)s_cur_pos);
-    target_pos_ch.value  = HOMEKIT_UINT8((uint8_t)s_tgt_pos);
-    pos_state_ch.value   = HOMEKIT_UINT8((uint8_t)s_motion);
+static const char *const s_tele_level_name[TELE_LEVELS] = { "1m", "15m" };
 
-    homekit_characteristic_notify(&current_pos_ch, current_pos_ch.value);
-    homekit_characteristic_notify(&target_pos_ch, target_pos_ch.value);
-    homekit_characteristic_notify(&pos_state_ch, pos_state_ch.value);
+static tele_bucket_t s_tele_l1[TELE_COUNT][TELE_L1_SLOTS];
+static tele_bucket_t s_tele_l2[TELE_COUNT][TELE_L2_SLOTS];
+static tele_series_t s_tele[TELE_COUNT];
+static portMUX_TYPE  s_tele_mux = portMUX_INITIALIZER_UNLOCKED;
 
-    ESP_LOGD(TAG, "HomeKit notify: current=%d target=%d state=%d",
-             s_cur_pos, s_tgt_pos, s_motion);
+static void tele_history_init(void) {
+    for (int id = 0; id < TELE_COUNT; id++) {
+        tele_init(&s_tele[id], s_tele_defs[id].raw, s_tele_defs[id].raw_cap,
+                  s_tele_l1[id], s_tele_l2[id]);
+    }
 }
 
-// ── Movement task ─────────────────────────────────────────────────────────────
-static void movement_task(void *arg) {
-    const uint32_t travel_ms = (s_cal_ms > 0) ? s_cal_ms : DEFAULT_TRAVEL_MS;
-    const float    delta     = position_delta_per_tick(travel_ms, POS_UPDATE_INTERVAL_MS);
-
-    motion_dir_t last_dir         = s_motion;
-    float        pos_f            = (float)s_cur_pos;
-    int          last_notified    = s_cur_pos;
+static void tele_put(tele_id_t id, int32_t v) {
+    uint32_t t = now_ms();
 
-    for (;;) {
-        vTaskDelay(pdMS_TO_TICKS(POS_UPDATE_INTERVAL_MS));
+    portENTER_CRITICAL(&s_tele_mux);
+    tele_push(&s_tele[id], t, v);
+    portEXIT_CRITICAL(&s_tele_mux);
+}
+#else
+static inline void tele_put(tele_id_t id, int32_t v) {
+    (void)id;
+    (void)v;
+}
+#endif
 
-        motion_dir_t dir = s_motion;
+#ifdef CONFIG_SUNSHADE_TELEMETRY
+// ── Telemetry export ──────────────────────────────────────────────────────────
+// "GET /telemetry" (or "/telemetry/<series>" for one series) on plain HTTP/1.0
+// returns the whole history as CSV. The response is generated record by record
+// into a small buffer and sent as it fills, so its size costs no RAM; each
+// record is copied out under the spinlock on its own, so sampling is never
+// held up for more than one copy. Records overwritten while the response is
+// being sent are simply left out. One client is served at a time from a task
+// in the arena rather than from an HTTP server task on the heap. The endpoint
+// is advertised over mDNS as "_http._tcp" with "path=/telemetry".
+#define TELE_PORT           CONFIG_SUNSHADE_TELEMETRY_PORT
+#define TELE_REQ_MAX        128
+#define TELE_IO_TIMEOUT_S   5
+#define TELE_RETRY_MS       5000
+#define TELE_MDNS_TRIES     30
 
-        if (dir != last_dir) {
-            pos_f    = (float)s_cur_pos;
-            last_dir = dir;
+typedef struct {
+    int    sock;
+    bool   failed;
+    size_t len;
+    char   buf[256];
+} tele_out_t;
+
+static void tele_flush(tele_out_t *o) {
+    size_t off = 0;
+
+    while (!o->failed && off < o->len) {
+        int n = send(o->sock, o->buf + off, o->len - off, 0);
+        if (n <= 0) {
+            o->failed = true;               // client gone or send timed out
+            break;
         }
+        off += (size_t)n;
+    }
+    o->len = 0;
+}
 
-        if (dir == MOTION_STOPPED) {
-            relays_all_off();
-            homekit_notify_position();
-            break;
+static void tele_printf(tele_out_t *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void tele_printf(tele_out_t *o, const char *fmt, ...) {
+    for (int attempt = 0; attempt < 2 && !o->failed; attempt++) {
+        size_t  room = sizeof(o->buf) - o->len;
+        va_list ap;
+
+        va_start(ap, fmt);
+        int n = vsnprintf(o->buf + o->len, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return;
+        }
+        if ((size_t)n < room) {
+            o->len += (size_t)n;
+            return;
         }
+        tele_flush(o);                      // did not fit: send what is queued, retry
+    }
+}
 
-        int tgt = s_tgt_pos;
+static void tele_stream_series(tele_out_t *o, tele_id_t id) {
+    const tele_series_t *s    = &s_tele[id];
+    const char          *name = s_tele_defs[id].name;
+    tele_sample_t        r;
+    tele_bucket_t        b;
+    uint32_t             total;
+    bool                 ok;
+
+    portENTER_CRITICAL(&s_tele_mux);
+    total = s->raw_total;
+    portEXIT_CRITICAL(&s_tele_mux);
+    for (uint32_t k = tele_first(total, s->raw_cap); k < total && !o->failed; k++) {
+        portENTER_CRITICAL(&s_tele_mux);
+        ok = tele_raw_get(s, k, &r);
+        portEXIT_CRITICAL(&s_tele_mux);
+        if (ok) {
+            tele_printf(o, "%s,raw,%lu,%ld\n", name, (unsigned long)r.t_ms, (long)r.v);
+        }
+    }
 
-        if (dir == MOTION_OPENING) {
-            pos_f += delta;
-            if (pos_f >= (float)tgt) {
-                s_cur_pos = tgt;
-                s_motion  = MOTION_STOPPED;
-                relays_all_off();
-                homekit_notify_position();
-                ESP_LOGI(TAG, "Reached %d%% (open)", tgt);
-                break;
-            }
-        } else {
-            pos_f -= delta;
-            if (pos_f <= (float)tgt) {
-                s_cur_pos = tgt;
-                s_motion  = MOTION_STOPPED;
-                relays_all_off();
-                homekit_notify_position();
-                ESP_LOGI(TAG, "Reached %d%% (close)", tgt);
-                break;
+    for (int i = 0; i < TELE_LEVELS; i++) {
+        const tele_level_t *l = &s->level[i];
+
+        portENTER_CRITICAL(&s_tele_mux);
+        total = l->total;
+        portEXIT_CRITICAL(&s_tele_mux);
+        for (uint32_t k = tele_first(total, l->cap); k <= total && !o->failed; k++) {
+            portENTER_CRITICAL(&s_tele_mux);
+            ok = (k < total) ? tele_bucket_get(l, k, &b) : tele_level_open(l, &b);
+            portEXIT_CRITICAL(&s_tele_mux);
+            if (ok) {
+                tele_printf(o, "%s,%s,%lu,%ld,%ld,%ld\n", name, s_tele_level_name[i],
+                            (unsigned long)b.t_ms, (long)b.min, (long)b.max, (long)b.mean);
             }
         }
+    }
+}
 
-        if (pos_f < 0.0f) {
-            pos_f = 0.0f;
-        } else if (pos_f > 100.0f) {
-            pos_f = 100.0f;
-        }
+// Reads the request line and returns the series to send: TELE_COUNT for all
+// of them, -1 for an unknown path, -2 for anything but a GET.
+static int tele_parse_request(int sock) {
+    char   req[TELE_REQ_MAX];
+    size_t len = 0;
 
-        int new_pos = clamp_position((int)pos_f);
-        s_cur_pos = new_pos;
-        if (new_pos != last_notified) {
-            last_notified = new_pos;
-            homekit_notify_position();
+    while (len < sizeof(req) - 1 && memchr(req, '\n', len) == NULL) {
+        int n = recv(sock, req + len, sizeof(req) - 1 - len, 0);
+        if (n <= 0) {
+            break;
         }
+        len += (size_t)n;
     }
+    req[len] = '\0';
 
-    // Dual-core: critical section ensures the other core sees NULL immediately.
-    taskENTER_CRITICAL(&s_task_mux);
-    s_move_task = NULL;
-    taskEXIT_CRITICAL(&s_task_mux);
+    if (strncmp(req, "GET ", 4) != 0) {
+        return -2;
+    }
+    char *path = req + 4;
+    path[strcspn(path, " ?\r\n")] = '\0';
 
-    vTaskDelete(NULL);
+    if (strcmp(path, "/telemetry") == 0 || strcmp(path, "/telemetry/") == 0) {
+        return TELE_COUNT;
+    }
+    if (strncmp(path, "/telemetry/", 11) == 0) {
+        for (int id = 0; id < TELE_COUNT; id++) {
+            if (strcmp(path + 11, s_tele_defs[id].name) == 0) {
+                return id;
+            }
+        }
+    }
+    return -1;
 }
 
-static void movement_task_start(void) {
-    // Two-phase flag prevents dual-core TOCTOU: both cores seeing NULL simultaneously
-    // and each spawning a duplicate movement task.
-    bool create = false;
+static void tele_serve(int sock) {
+    static tele_out_t o;                    // one client at a time
+    int               which = tele_parse_request(sock);
 
-    taskENTER_CRITICAL(&s_task_mux);
-    if (s_move_task == NULL && !s_task_creating) {
-        s_task_creating = true;
-        create = true;
-    }
-    taskEXIT_CRITICAL(&s_task_mux);
+    o.sock   = sock;
+    o.failed = false;
+    o.len    = 0;
 
-    if (!create) {
+    if (which < 0) {
+        tele_printf(&o, "HTTP/1.0 %s\r\nConnection: close\r\n\r\n",
+                    (which == -2) ? "405 Method Not Allowed" : "404 Not Found");
+        tele_flush(&o);
         return;
     }
 
-    if (xTaskCreate(movement_task, "sunshade_move", 4096, NULL, 5,
-                    (TaskHandle_t *)&s_move_task) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create movement task");
-        relays_all_off();
-        s_motion = MOTION_STOPPED;
-        homekit_notify_position();
+    tele_printf(&o, "HTTP/1.0 200 OK\r\nContent-Type: text/csv\r\n"
+                    "Cache-Control: no-store\r\nConnection: close\r\n\r\n");
+    tele_printf(&o, "# sunshade telemetry; t_ms = ms since boot; now=%lu\n",
+                (unsigned long)now_ms());
+    tele_printf(&o, "# series,raw,t_ms,value\n"
+                    "# series,1m|15m,start_ms,min,max,mean (the newest bucket may be filling)\n");
+    for (int id = 0; id < TELE_COUNT; id++) {
+        if (which == TELE_COUNT || which == id) {
+            tele_printf(&o, "# %s in %s\n", s_tele_defs[id].name, s_tele_defs[id].unit);
+        }
+    }
+    for (int id = 0; id < TELE_COUNT && !o.failed; id++) {
+        if (which == TELE_COUNT || which == id) {
+            tele_stream_series(&o, (tele_id_t)id);
+        }
     }
+    tele_flush(&o);
+}
+
+static int tele_listen(void) {
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(TELE_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int one = 1;
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 
-    taskENTER_CRITICAL(&s_task_mux);
-    s_task_creating = false;
-    taskEXIT_CRITICAL(&s_task_mux);
+    if (sock < 0) {
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, 2) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
 }
 
-// ── Sunshade control ──────────────────────────────────────────────────────────
-static bool is_locked(void) {
-    if (s_cal_state != CAL_IDLE) {
-        ESP_LOGW(TAG, "Command ignored: calibration in progress");
-        return true;
+// mDNS is brought up by the HomeKit server, which may still be starting.
+static void tele_advertise(void) {
+    mdns_txt_item_t txt[] = { { "path", "/telemetry" } };
+    esp_err_t       err   = ESP_FAIL;
+
+    for (int i = 0; i < TELE_MDNS_TRIES; i++) {
+        err = mdns_service_add(NULL, "_http", "_tcp", TELE_PORT, txt, 1);
+        if (err != ESP_ERR_INVALID_STATE) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(1000));
     }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG_TELE, "Advertised as _http._tcp on port %d", TELE_PORT);
+    } else {
+        ESP_LOGW(TAG_TELE, "mDNS advert failed: %s", esp_err_to_name(err));
+    }
+}
 
-    if (s_is_homing) {
-        ESP_LOGW(TAG, "Command ignored: homing in progress");
-        return true;
+static void tele_task(void *arg) {
+    int listener;
+
+    while ((listener = tele_listen()) < 0) {
+        ESP_LOGE(TAG_TELE, "Cannot listen on port %d (errno %d); retrying", TELE_PORT, errno);
+        vTaskDelay(pdMS_TO_TICKS(TELE_RETRY_MS));
+    }
+    ESP_LOGI(TAG_TELE, "Serving http://<device>:%d/telemetry", TELE_PORT);
+    tele_advertise();
+
+    for (;;) {
+        int sock = accept(listener, NULL, NULL);
+        if (sock < 0) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        struct timeval tv = { .tv_sec = TELE_IO_TIMEOUT_S };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        tele_serve(sock);
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
     }
+}
+#endif
+
+// ── NVS helpers ───────────────────────────────────────────────────────────────
+// Calibration and the fast-boot counter live in one shade_config_t blob
+// (NVS_CONFIG, see sunshade_logic.h) per shade, in the shade's own namespace.
+// It is read once at boot, together with the position journal, into sh->cfg;
+// changes are made in RAM and the persist task writes the whole blob behind,
+// so related fields always change together.
+// A device that still has the separate keys of older firmware is migrated on
+// first boot: the keys are read once, then erased when the blob is written.
+static portMUX_TYPE s_cfg_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Seed sh->cfg (and sh->travel/cal_done from it) from the open namespace h.
+static void config_load(shade_t *sh, nvs_handle_t h) {
+    shade_config_t cfg = {0};
+    size_t         len = sizeof(cfg);
+    esp_err_t      err = nvs_get_blob(h, NVS_CONFIG, &cfg, &len);
+    bool           v1  = false;
+
+    if (err == ESP_OK && len == sizeof(shade_config_v1_t)) {
+        shade_config_v1_t old;
+        memcpy(&old, &cfg, sizeof(old));
+        v1 = shade_config_from_v1(&old, &cfg);
+    }
+
+    if (v1) {
+        sh->cfg       = cfg;
+        sh->cfg_dirty = true;
+        ESP_LOGI(TAG_NVS, "Shade %d: converting config blob to version %d",
+                 sh->idx + 1, SHADE_CONFIG_VERSION);
+    } else if (err == ESP_OK && len == sizeof(cfg) && shade_config_valid(&cfg)) {
+        sh->cfg = cfg;
+    } else {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG_NVS, "Shade %d: config blob unreadable (%s); using defaults",
+                     sh->idx + 1,
+                     err == ESP_OK ? "bad size, CRC or version" : esp_err_to_name(err));
+        }
+        memset(&cfg, 0, sizeof(cfg));
+
+        uint8_t  done   = 0;
+        uint32_t ms     = 0;
+        uint8_t  boots  = 0;
+        bool     legacy = false;
+        legacy |= (nvs_get_u8(h, NVS_CAL_DONE, &done) == ESP_OK);
+        legacy |= (nvs_get_u32(h, NVS_CAL_MS, &ms) == ESP_OK);
+        legacy |= (nvs_get_u8(h, NVS_FAST_BOOTS, &boots) == ESP_OK);
+
+        if (done && ms > 0) {
+            cfg.cal_ms = ms;
+            cfg.flags  = SHADE_CFG_F_CALIBRATED;
+        } else if (done) {
+            ESP_LOGW(TAG_NVS, "Calibration flag set but value invalid; using default");
+        }
+        cfg.fast_boots = boots;
+        sh->cfg        = cfg;
+
+        if (legacy) {
+            sh->cfg_dirty   = true;
+            sh->cfg_migrate = true;
+            ESP_LOGI(TAG_NVS, "Migrating calibration keys into the config blob");
+        }
+    }
+
+    sh->travel = shade_config_model(&sh->cfg, DEFAULT_TRAVEL_MS, CLOSE_TRAVEL_PCT,
+                                    MOTOR_LAG_MS);
+
+    uint32_t ms = shade_config_cal_ms(&sh->cfg);
+    if (ms > 0) {
+        sh->cal_done = true;
+        ESP_LOGI(TAG_NVS, "Shade %d: calibration loaded: open %lu ms, close %lu ms, lag %lu ms%s",
+                 sh->idx + 1, (unsigned long)sh->travel.open_ms,
+                 (unsigned long)sh->travel.close_ms, (unsigned long)sh->travel.lag_ms,
+                 (sh->cfg.flags & SHADE_CFG_F_LEARNED) ? " (learned)" : "");
+    } else {
+        ESP_LOGI(TAG_NVS, "Shade %d: not calibrated; using default %lu ms",
+                 sh->idx + 1, (unsigned long)DEFAULT_TRAVEL_MS);
+    }
+}
+
+static travel_model_t shade_travel(shade_t *sh) {
+    taskENTER_CRITICAL(&s_cfg_mux);
+    travel_model_t m = sh->travel;
+    taskEXIT_CRITICAL(&s_cfg_mux);
+    return m;
+}
+
+// A new calibration starts the travel model afresh from the measured opening
+// time; anything learned for the old motor is dropped.
+static void config_set_calibration(shade_t *sh, uint32_t travel_ms) {
+    taskENTER_CRITICAL(&s_cfg_mux);
+    sh->cfg.cal_ms   = travel_ms;
+    sh->cfg.close_ms = 0;
+    sh->cfg.lag_ms   = 0;
+    sh->cfg.flags    = (sh->cfg.flags | SHADE_CFG_F_CALIBRATED) & ~SHADE_CFG_F_LEARNED;
+    sh->travel       = shade_config_model(&sh->cfg, DEFAULT_TRAVEL_MS, CLOSE_TRAVEL_PCT,
+                                          MOTOR_LAG_MS);
+    sh->cfg_dirty    = true;
+    taskEXIT_CRITICAL(&s_cfg_mux);
+    persist_kick();
+}
+
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+static void config_set_travel(shade_t *sh, const travel_model_t *m) {
+    taskENTER_CRITICAL(&s_cfg_mux);
+    sh->travel        = *m;
+    sh->cfg.cal_ms    = m->open_ms;
+    sh->cfg.close_ms  = m->close_ms;
+    sh->cfg.lag_ms    = (uint16_t)m->lag_ms;
+    sh->cfg.flags    |= SHADE_CFG_F_LEARNED;
+    sh->cfg_dirty     = true;
+    taskEXIT_CRITICAL(&s_cfg_mux);
+    persist_kick();
+}
+#endif
+
+#ifdef CONFIG_SUNSHADE_FAST_BOOT
+static uint8_t config_fast_boots(shade_t *sh) {
+    taskENTER_CRITICAL(&s_cfg_mux);
+    uint8_t count = sh->cfg.fast_boots;
+    taskEXIT_CRITICAL(&s_cfg_mux);
+    return count;
+}
+
+static void config_set_fast_boots(shade_t *sh, uint8_t count) {
+    taskENTER_CRITICAL(&s_cfg_mux);
+    bool changed = (sh->cfg.fast_boots != count);
+    if (changed) {
+        sh->cfg.fast_boots = count;
+        sh->cfg_dirty      = true;
+    }
+    taskEXIT_CRITICAL(&s_cfg_mux);
+
+    if (changed) {
+        persist_kick();
+    }
+}
+#endif
+
+// Write sh->cfg if it changed. Returns false if the write failed; the change
+// then stays pending for a retry.
+static bool config_flush(shade_t *sh) {
+    taskENTER_CRITICAL(&s_cfg_mux);
+    bool           dirty   = sh->cfg_dirty;
+    bool           migrate = sh->cfg_migrate;
+    shade_config_t cfg     = sh->cfg;
+    sh->cfg_dirty          = false;
+    taskEXIT_CRITICAL(&s_cfg_mux);
+
+    if (!dirty) {
+        return true;
+    }
+
+    shade_config_seal(&cfg);
+
+    nvs_handle_t h;
+    int64_t      t0  = esp_timer_get_time();
+    esp_err_t    err = nvs_open(sh->nvs_ns, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(h, NVS_CONFIG, &cfg, sizeof(cfg));
+        if (err == ESP_OK && migrate) {
+            // Missing keys are fine; the commit covers the blob and erases.
+            nvs_erase_key(h, NVS_CAL_DONE);
+            nvs_erase_key(h, NVS_CAL_MS);
+            nvs_erase_key(h, NVS_FAST_BOOTS);
+        }
+        if (err == ESP_OK) err = nvs_commit(h);
+        nvs_close(h);
+    }
+    latency_record(LAT_NVS_COMMIT, t0, esp_timer_get_time());
+
+    taskENTER_CRITICAL(&s_cfg_mux);
+    if (err != ESP_OK) {
+        sh->cfg_dirty = true;
+    } else if (migrate) {
+        sh->cfg_migrate = false;
+    }
+    taskEXIT_CRITICAL(&s_cfg_mux);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_NVS, "Shade %d: config save failed: %s",
+                 sh->idx + 1, esp_err_to_name(err));
+        return false;
+    }
+    ESP_LOGI(TAG_NVS, "Shade %d: config saved: cal=%lu ms%s, close=%lu ms, lag=%u ms, fast_boots=%u",
+             sh->idx + 1, (unsigned long)cfg.cal_ms,
+             (cfg.flags & SHADE_CFG_F_CALIBRATED) ? "" : " (uncalibrated)",
+             (unsigned long)cfg.close_ms, cfg.lag_ms, cfg.fast_boots);
+    return true;
+}
+
+// ── Position journal ──────────────────────────────────────────────────────────
+// Position changes are captured in RAM and written behind by a low-priority
+// task once the shade has been quiet for JOURNAL_IDLE_MS, so a burst of slider
+// writes or touch presses costs one flash write instead of one per command.
+// Records go round-robin into JOURNAL_SLOTS NVS blobs ("jr0".."jrN") in the
+// shade's namespace; each carries a sequence number and a CRC, and the newest
+// intact one wins at boot. The journal fields of shade_t are guarded by
+// s_journal_mux, the sequence and slot by s_journal_lock.
+static portMUX_TYPE      s_journal_mux     = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t s_journal_lock    = NULL;
+static StaticSemaphore_t s_journal_lock_buf;
+
+static TaskHandle_t      s_persist_task    = NULL;
+
+static void journal_slot_key(int slot, char *key, size_t len) {
+    snprintf(key, len, NVS_JOURNAL_PREFIX "%d", slot);
+}
+
+// Capture the shade's current motion state for the next flush. Cheap enough
+// to call from every state change; never touches flash.
+static void journal_note(shade_t *sh) {
+    motion_state_t st = shade_state(sh);
+
+    taskENTER_CRITICAL(&s_journal_mux);
+    journal_record_t *rec = &sh->journal_ram;
+    rec->uptime_ms = now_ms();
+    rec->pos_pm    = pos_ppm_to_pm(st.pos_ppm);
+    rec->target    = st.target;
+    if (st.dir != MOTION_STOPPED) {
+        rec->dir = st.dir;
+    }
+    rec->flags          = (st.dir == MOTION_STOPPED) ? JOURNAL_F_STOPPED : 0;
+    sh->journal_dirty   = true;
+    sh->journal_changed = rec->uptime_ms;
+#ifdef CONFIG_SUNSHADE_FAST_BOOT
+    // Leaving a clean rest position: the "moving" record has to reach flash
+    // before the shade stops, or a power cut during the move would be trusted
+    // at the next boot. It is written behind, JOURNAL_ARM_MS after the relay
+    // closes, so the flash write does not stall the caches while the relays
+    // and the stop timer are being armed. A stop that comes first is written
+    // at once instead.
+    if (sh->journal_clean && !(rec->flags & JOURNAL_F_STOPPED)) {
+        if (!sh->journal_leaving) {
+            int64_t relay_in_us = sh->seg_t0_us - esp_timer_get_time();
+            sh->journal_leaving = true;
+            sh->journal_due     = rec->uptime_ms + JOURNAL_ARM_MS +
+                                  (relay_in_us > 0 ? (uint32_t)(relay_in_us / 1000) : 0);
+        }
+    } else if (sh->journal_leaving) {
+        sh->journal_urgent = true;
+    }
+#endif
+    taskEXIT_CRITICAL(&s_journal_mux);
+
+    persist_kick();
+}
+
+// Write the shade's pending record, if any, to its next ring slot.
+static void journal_flush(shade_t *sh) {
+    if (s_journal_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_journal_lock, portMAX_DELAY);
+
+    taskENTER_CRITICAL(&s_journal_mux);
+    bool             dirty = sh->journal_dirty;
+    journal_record_t rec   = sh->journal_ram;
+    sh->journal_dirty      = false;
+    sh->journal_urgent     = false;
+    sh->journal_leaving    = false;
+    taskEXIT_CRITICAL(&s_journal_mux);
+
+    if (!dirty) {
+        xSemaphoreGive(s_journal_lock);
+        return;
+    }
+
+    int  slot = (sh->journal_slot + 1) % JOURNAL_SLOTS;
+    char key[8];
+    journal_slot_key(slot, key, sizeof(key));
+
+    rec.seq = sh->journal_seq + 1;
+    journal_seal(&rec);
+
+    nvs_handle_t h;
+    int64_t      t0  = esp_timer_get_time();
+    esp_err_t    err = nvs_open(sh->nvs_ns, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(h, key, &rec, sizeof(rec));
+        if (err == ESP_OK) err = nvs_commit(h);
+        nvs_close(h);
+    }
+    latency_record(LAT_NVS_COMMIT, t0, esp_timer_get_time());
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_NVS, "Shade %d: journal write failed: %s",
+                 sh->idx + 1, esp_err_to_name(err));
+        // Keep the record pending unless a newer change already replaced it;
+        // the persist task retries after the next idle window.
+        taskENTER_CRITICAL(&s_journal_mux);
+        if (!sh->journal_dirty) {
+            sh->journal_dirty   = true;
+            sh->journal_changed = now_ms();
+        }
+        taskEXIT_CRITICAL(&s_journal_mux);
+    } else {
+        sh->journal_seq  = rec.seq;
+        sh->journal_slot = slot;
+        taskENTER_CRITICAL(&s_journal_mux);
+        sh->journal_clean = journal_clean(&rec);
+        taskEXIT_CRITICAL(&s_journal_mux);
+        ESP_LOGD(TAG_NVS, "Shade %d: journal #%lu -> %s: pos=%u.%u%% target=%u%% flags=0x%02x",
+                 sh->idx + 1, (unsigned long)rec.seq, key, rec.pos_pm / 10, rec.pos_pm % 10,
+                 rec.target, rec.flags);
+    }
+
+    xSemaphoreGive(s_journal_lock);
+}
+
+// Write everything still pending, e.g. right before a deliberate reboot.
+static void persist_flush(void) {
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        config_flush(&s_shades[i]);
+        journal_flush(&s_shades[i]);
+    }
+}
+
+static void persist_kick(void) {
+    if (s_persist_task != NULL) {
+        xTaskNotifyGive(s_persist_task);
+    }
+}
+
+// Config changes are rare and written straight away; each journal waits for
+// its shade's idle window. A failed config write is retried after that window.
+static void persist_task(void *arg) {
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        bool       busy = false;
+
+        for (int i = 0; i < SHADE_CHANNELS; i++) {
+            shade_t *sh = &s_shades[i];
+
+            if (!config_flush(sh)) {
+                wait = pdMS_TO_TICKS(JOURNAL_IDLE_MS);
+            }
+
+            taskENTER_CRITICAL(&s_journal_mux);
+            bool     dirty  = sh->journal_dirty;
+            bool     urgent = sh->journal_urgent;
+            uint32_t since  = now_ms() - sh->journal_changed;
+            int32_t  due_in = sh->journal_leaving
+                            ? (int32_t)(sh->journal_due - now_ms()) : INT32_MAX;
+            taskEXIT_CRITICAL(&s_journal_mux);
+
+            if (dirty) {
+                if (urgent || due_in <= 0 || since >= JOURNAL_IDLE_MS) {
+                    journal_flush(sh);
+                    busy = true;
+                    continue;
+                }
+                uint32_t   left = JOURNAL_IDLE_MS - since;
+                TickType_t idle = pdMS_TO_TICKS((uint32_t)due_in < left ? (uint32_t)due_in : left) + 1;
+                if (idle < wait) {
+                    wait = idle;
+                }
+            }
+        }
+
+        if (busy) {
+            continue;       // re-evaluate: a change may have landed meanwhile
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+// Read the shade's ring back from its open namespace (ns is NULL when it does
+// not exist yet) and seed the sequence counter. Must run on every boot, before
+// the first flush, so new records continue the existing sequence.
+// Falls back to the legacy single-byte "last_pos" key on a device that has no
+// journal yet; such a record carries only the target and is never clean.
+// Returns false if nothing was saved at all.
+static bool journal_load(shade_t *sh, const nvs_handle_t *ns, journal_record_t *out) {
+    journal_record_t slots[JOURNAL_SLOTS] = {0};
+    uint8_t          legacy      = 0;
+    bool             have_legacy = false;
+
+    if (ns != NULL) {
+        nvs_handle_t h = *ns;
+        for (int i = 0; i < JOURNAL_SLOTS; i++) {
+            char   key[8];
+            size_t len = sizeof(slots[i]);
+            journal_slot_key(i, key, sizeof(key));
+            if (nvs_get_blob(h, key, &slots[i], &len) != ESP_OK || len != sizeof(slots[i])) {
+                memset(&slots[i], 0, sizeof(slots[i]));
+            }
+        }
+        have_legacy = (nvs_get_u8(h, NVS_LAST_POS, &legacy) == ESP_OK && legacy <= 100);
+    }
+
+    int newest = journal_newest(slots, JOURNAL_SLOTS);
+    if (newest >= 0) {
+        const journal_record_t *rec = &slots[newest];
+        sh->journal_seq   = rec->seq;
+        sh->journal_slot  = newest;
+        sh->journal_ram   = *rec;
+        sh->journal_clean = journal_clean(rec);
+        *out              = *rec;
+        ESP_LOGI(TAG_NVS, "Shade %d: journal #%lu: pos=%u.%u%% target=%u%% %s",
+                 sh->idx + 1, (unsigned long)rec->seq, rec->pos_pm / 10, rec->pos_pm % 10,
+                 rec->target,
+                 (rec->flags & JOURNAL_F_STOPPED) ? "stopped" : "moving at power loss");
+        return true;
+    }
+
+    memset(out, 0, sizeof(*out));
+    if (have_legacy) {
+        out->target = legacy;
+        ESP_LOGI(TAG_NVS, "Last saved position (legacy key): %d%%", legacy);
+        return true;
+    }
+
+    ESP_LOGI(TAG_NVS, "Shade %d: no saved position", sh->idx + 1);
+    return false;
+}
+
+// The one boot-time read of a shade's namespace: the config blob and the
+// journal ring share a single handle. Returns journal_load()'s result.
+static bool shade_nvs_load(shade_t *sh, journal_record_t *last) {
+    nvs_handle_t h;
+    esp_err_t    err = nvs_open(sh->nvs_ns, NVS_READONLY, &h);
+
+    if (err != ESP_OK) {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG_NVS, "Cannot open NVS namespace %s: %s",
+                     sh->nvs_ns, esp_err_to_name(err));
+        }
+        ESP_LOGI(TAG_NVS, "Shade %d: no calibration found; using default %lu ms",
+                 sh->idx + 1, (unsigned long)DEFAULT_TRAVEL_MS);
+        return journal_load(sh, NULL, last);
+    }
+
+    config_load(sh, h);
+    bool have_last = journal_load(sh, &h, last);
+    nvs_close(h);
+    return have_last;
+}
+
+static void journal_start(void) {
+    s_journal_lock = xSemaphoreCreateMutexStatic(&s_journal_lock_buf);
+    s_persist_task = task_start(TASK_PERSIST, persist_task);
+}
+
+// ── Power management ──────────────────────────────────────────────────────────
+// With CONFIG_PM_ENABLE (see sdkconfig.lowpower) the CPU scales between
+// SUNSHADE_PM_MIN_FREQ_MHZ and the default frequency, and with tickless idle
+// the chip enters automatic light sleep whenever every task is blocked. Locks
+// keep it awake only while timing matters: s_pm_motion_lock is held whenever a
+// relay is on or a reversal dead time is running, s_pm_adc_lock around the
+// (oneshot) wind ADC burst. The continuous ADC driver takes its own lock.
+// esp_pm_lock_acquire()/release() are IRAM-safe and may be called with a
+// spinlock held.
+#ifdef CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t s_pm_motion_lock = NULL;
+static bool                 s_pm_motion_held = false;    // guarded by s_relay_mux
+#if defined(CONFIG_WIND_SENSOR_ENABLE) && !defined(CONFIG_WIND_SENSOR_ADC_DMA)
+static esp_pm_lock_handle_t s_pm_adc_lock    = NULL;
+#endif
+#endif
+
+#ifdef CONFIG_SUNSHADE_WIFI_MAX_MODEM_SLEEP
+#define WIFI_PS_MODE  WIFI_PS_MAX_MODEM
+#else
+#define WIFI_PS_MODE  WIFI_PS_MIN_MODEM
+#endif
+
+static void power_init(void) {
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_config_t pm_cfg = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_SUNSHADE_PM_MIN_FREQ_MHZ,
+#ifdef SUNSHADE_LIGHT_SLEEP
+        .light_sleep_enable = true,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&pm_cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Power management not configured: %s", esp_err_to_name(err));
+    } else {
+        ESP_LOGI(TAG, "Power management: DFS %d-%d MHz, light sleep %s",
+                 CONFIG_SUNSHADE_PM_MIN_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+                 pm_cfg.light_sleep_enable ? "on" : "off");
+    }
+
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "motion", &s_pm_motion_lock));
+#if defined(CONFIG_WIND_SENSOR_ENABLE) && !defined(CONFIG_WIND_SENSOR_ADC_DMA)
+    // APB_FREQ_MAX also blocks light sleep, which would power the ADC down.
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "wind_adc", &s_pm_adc_lock));
+#endif
+#endif
+}
+
+// Called once the station is up (modem sleep can only be set after start).
+static void power_wifi_init(void) {
+    esp_err_t err = esp_wifi_set_ps(WIFI_PS_MODE);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Wi-Fi power save not set: %s", esp_err_to_name(err));
+    } else {
+        ESP_LOGI(TAG, "Wi-Fi %s modem sleep",
+                 WIFI_PS_MODE == WIFI_PS_MAX_MODEM ? "maximum" : "minimum");
+    }
+}
+
+// ── ADC1 one-shot unit ────────────────────────────────────────────────────────
+// The one-shot driver hands out one handle per ADC unit, so the wind sensor and
+// the motor current sensor share s_adc1. Channels are configured from the boot
+// sequence and sensor task init only, never concurrently.
+#ifdef SUNSHADE_USE_ADC1_ONESHOT
+static adc_oneshot_unit_handle_t s_adc1 = NULL;
+
+// Returns ESP_ERR_INVALID_ARG if gpio is not an ADC1 pin.
+static esp_err_t adc1_channel_init(int gpio, adc_channel_t *chan) {
+    adc_unit_t unit;
+    if (adc_oneshot_io_to_channel(gpio, &unit, chan) != ESP_OK || unit != ADC_UNIT_1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (s_adc1 == NULL) {
+        adc_oneshot_unit_init_cfg_t unit_cfg = {
+            .unit_id  = ADC_UNIT_1,
+            .ulp_mode = ADC_ULP_MODE_DISABLE,
+        };
+        esp_err_t err = adc_oneshot_new_unit(&unit_cfg, &s_adc1);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    // ADC_ATTEN_DB_11: accurate range 150–2450 mV; both sensors are divided
+    // down into it.
+    adc_oneshot_chan_cfg_t chan_cfg = {
+        .atten    = ADC_ATTEN_DB_11,
+        .bitwidth = ADC_BITWIDTH_12,
+    };
+    return adc_oneshot_config_channel(s_adc1, *chan, &chan_cfg);
+}
+#endif
+
+// ── LED ───────────────────────────────────────────────────────────────────────
+static void led_write(bool on) {
+    gpio_set_level(LED_GPIO, on ? 1 : 0);
+}
+
+// ── Relay control ─────────────────────────────────────────────────────────────
+// Honour the board's active level (CONFIG_ESP_RELAY_ACTIVE_LEVEL) and enforce a
+// dead time when reversing direction so an AC tubular motor is never switched
+// straight from one direction to the other.
+//
+// Each shade's driver is the relay_fsm_t state machine of sunshade_logic.h.
+// relay_request() never blocks: a reversal inside the dead time leaves both
+// relays off and arms the shade's relay_timer, which energises the pending
+// direction once the dead time has run out. A newer request during the dead
+// time simply replaces the pending direction (or cancels it, for a stop). One
+// spinlock covers the drivers of all shades.
+static portMUX_TYPE s_relay_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Caller holds s_relay_mux. Keeps the motion PM lock in step with the drivers:
+// it is held while any shade's relay is on or in a dead time.
+static inline void relay_pm_sync_locked(void) {
+#ifdef CONFIG_PM_ENABLE
+    bool want = false;
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        want |= (s_shades[i].relay.state != RELAY_OFF);
+    }
+    if (want != s_pm_motion_held && s_pm_motion_lock != NULL) {
+        if (want) {
+            esp_pm_lock_acquire(s_pm_motion_lock);
+        } else {
+            esp_pm_lock_release(s_pm_motion_lock);
+        }
+        s_pm_motion_held = want;
+    }
+#endif
+}
+
+// Caller holds s_relay_mux. Drives the outputs from the driver state; the
+// side going off is always written first, so both are never on together.
+static void relay_outputs_locked(const shade_t *sh) {
+    bool open  = relay_fsm_open(&sh->relay);
+    bool close = relay_fsm_close(&sh->relay);
+
+    gpio_set_level(open ? sh->relay_close_gpio : sh->relay_open_gpio,
+                   relay_output_level(RELAY_ACTIVE_LEVEL, false));
+    gpio_set_level(open ? sh->relay_open_gpio : sh->relay_close_gpio,
+                   relay_output_level(RELAY_ACTIVE_LEVEL, open || close));
+}
+
+// Cut the shade's relays without logging or touching a timer; safe from timer
+// callbacks and with other spinlocks held.
+static void relay_cut(shade_t *sh) {
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&s_relay_mux);
+    relay_fsm_cut(&sh->relay, now);
+    relay_outputs_locked(sh);
+    relay_pm_sync_locked();
+    taskEXIT_CRITICAL(&s_relay_mux);
+}
+
+static void relay_dead_time_cb(void *arg) {
+    shade_t *sh = (shade_t *)arg;
+
+    taskENTER_CRITICAL(&s_relay_mux);
+    if (relay_fsm_expire(&sh->relay, esp_timer_get_time())) {
+        relay_outputs_locked(sh);
+    }
+    taskEXIT_CRITICAL(&s_relay_mux);
+}
+
+// Drive the shade's motor in dir, or stop it with MOTION_STOPPED. Returns the
+// dead time in ms before the relay actually closes (0 = energised now).
+static uint32_t relay_request(shade_t *sh, motion_dir_t dir) {
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&s_relay_mux);
+    int64_t wait_us = relay_fsm_request(&sh->relay, dir, now,
+                                        (int64_t)RELAY_REVERSE_DELAY_MS * 1000);
+    relay_outputs_locked(sh);
+    relay_pm_sync_locked();
+    taskEXIT_CRITICAL(&s_relay_mux);
+
+    if (wait_us > 0) {
+        // A stale callback from an earlier arming sees the new due time and
+        // does nothing, so stop/start need not be atomic with the state.
+        esp_timer_stop(sh->relay_timer);
+        if (esp_timer_start_once(sh->relay_timer, (uint64_t)wait_us) != ESP_OK) {
+            ESP_LOGE(TAG_RELAY, "Shade %d: dead-time timer unavailable; relay stays off",
+                     sh->idx + 1);
+        }
+        ESP_LOGD(TAG_RELAY, "Shade %d: reversal dead time %lld ms before %s relay ON",
+                 sh->idx + 1, (long long)(wait_us / 1000),
+                 dir == MOTION_OPENING ? "OPEN" : "CLOSE");
+    } else {
+        ESP_LOGD(TAG_RELAY, "Shade %d: %s", sh->idx + 1,
+                 dir == MOTION_STOPPED ? "both relays OFF"
+                 : dir == MOTION_OPENING ? "OPEN relay ON" : "CLOSE relay ON");
+    }
+
+    return (uint32_t)((wait_us + 999) / 1000);
+}
+
+static void relays_all_off(void) {
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        relay_request(&s_shades[i], MOTION_STOPPED);
+    }
+}
+
+// ── Environmental sensor characteristics (display-only) ───────────────────────
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+#ifdef CONFIG_TEMP_SENSOR_ENABLE
+// Widen the default 0–100 °C range to the SHT3x range so outdoor sub-zero
+// temperatures are reported instead of being clamped at 0 °C.
+static homekit_characteristic_t cur_temp_ch =
+    HOMEKIT_CHARACTERISTIC_(CURRENT_TEMPERATURE, 0,
+        .min_value = (float[]) {-40},
+        .max_value = (float[]) {125});
+static homekit_characteristic_t cur_humid_ch =
+    HOMEKIT_CHARACTERISTIC_(CURRENT_RELATIVE_HUMIDITY, 0);
+#endif
+#ifdef CONFIG_LUX_SENSOR_ENABLE
+// HAP CURRENT_AMBIENT_LIGHT_LEVEL valid range is 0.0001–100000 lux.
+static homekit_characteristic_t cur_lux_ch =
+    HOMEKIT_CHARACTERISTIC_(CURRENT_AMBIENT_LIGHT_LEVEL, 0.0001f);
+#endif
+#pragma GCC diagnostic pop
+
+// ── HomeKit notifications ─────────────────────────────────────────────────────
+// homekit_notify_position() is called from the motion engine, calibration and
+// homing, often several times in a row. It only updates the characteristic
+// values and arms a short one-shot timer; the timer then notifies just the
+// characteristics whose value differs from what was last sent. Everything
+// that changed inside the window, on any shade, is queued with the HAP server
+// together, so each subscribed controller gets one event frame instead of one
+// per characteristic.
+#define NOTIFY_COALESCE_MS  50
+
+static esp_timer_handle_t s_notify_timer = NULL;
+
+// Characteristic values from one consistent state snapshot.
+static void homekit_notify_values(shade_t *sh) {
+    motion_state_t st = shade_state(sh);
+
+    sh->current_pos_ch.value = HOMEKIT_UINT8(st.pos);
+    sh->target_pos_ch.value  = HOMEKIT_UINT8(st.target);
+    sh->pos_state_ch.value   = HOMEKIT_UINT8(st.dir);
+}
+
+static void homekit_notify_flush(void *arg) {
+    int64_t t0   = esp_timer_get_time();
+    int     sent = 0;
+
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        shade_t                  *sh      = &s_shades[i];
+        homekit_characteristic_t *slots[] = {
+            &sh->current_pos_ch, &sh->target_pos_ch, &sh->pos_state_ch,
+        };
+
+        // Re-read here: the values set by the last homekit_notify_position()
+        // calls may come from different snapshots if two tasks raced.
+        homekit_notify_values(sh);
+
+        for (size_t j = 0; j < sizeof(slots) / sizeof(slots[0]); j++) {
+            int value = slots[j]->value.uint8_value;
+
+            if (value != sh->notify_sent[j]) {
+                sh->notify_sent[j] = value;
+                homekit_characteristic_notify(slots[j], slots[j]->value);
+                sent++;
+            }
+        }
+        ESP_LOGD(TAG, "HomeKit notify shade %d: current=%d target=%d state=%d",
+                 i + 1, sh->current_pos_ch.value.uint8_value,
+                 sh->target_pos_ch.value.uint8_value, sh->pos_state_ch.value.uint8_value);
+    }
+    if (sent > 0) {
+        latency_record(LAT_HK_NOTIFY, t0, esp_timer_get_time());
+    }
+}
+
+static void homekit_notify_position(shade_t *sh) {
+    homekit_notify_values(sh);
+
+    if (s_notify_timer == NULL) {
+        homekit_notify_flush(NULL);
+        return;
+    }
+
+    // Not re-armed while pending, so a change is never delayed by more than
+    // one window. A concurrent start loses the race with INVALID_STATE, which
+    // is harmless: the pending flush reads the latest values.
+    if (!esp_timer_is_active(s_notify_timer)) {
+        esp_timer_start_once(s_notify_timer, NOTIFY_COALESCE_MS * 1000ULL);
+    }
+}
+
+static void homekit_notify_init(void) {
+    const esp_timer_create_args_t notify_args = {
+        .callback = homekit_notify_flush,
+        .name     = "hk_notify",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&notify_args, &s_notify_timer));
+}
+
+// ── Motion engine ─────────────────────────────────────────────────────────────
+// One long-lived, statically allocated task owns the relays of every shade
+// during normal operation. Open/close/move/stop requests are posted to its
+// queue tagged with the shade, so a burst of HomeKit target writes costs a
+// queue slot each instead of a task creation and a 4 KB heap allocation.
+//
+// Arrival is not polled: when a segment starts, the exact relay-off moment is
+// computed from the shade's calibrated travel time and its one-shot stop timer
+// is armed for it. The timer cuts the relays itself and then posts
+// MOTION_CMD_ARRIVED so the task can settle the state. Progress notifications
+// run on their own, slower PROGRESS_NOTIFY_MS cadence and no longer affect stop
+// accuracy.
+typedef enum {
+    MOTION_CMD_MOVE = 0,
+    MOTION_CMD_STOP,
+    MOTION_CMD_ARRIVED,     // posted by the stop timer; target = segment generation
+} motion_cmd_type_t;
+
+typedef struct {
+    motion_cmd_type_t type;
+    motion_source_t   source;
+    uint8_t           shade;    // index into s_shades
+    int               target;
+    int64_t           t_us;     // when the command was posted (latency trace)
+} motion_cmd_t;
+
+#define MOTION_QUEUE_LEN    (8 * SHADE_CHANNELS)
+
+static QueueHandle_t s_motion_queue = NULL;
+static StaticQueue_t s_motion_queue_buf;
+static uint8_t       s_motion_queue_storage[MOTION_QUEUE_LEN * sizeof(motion_cmd_t)];
+
+// Guards seg_deadline_us and seg_gen of every shade: the stop timer only cuts
+// the relays once the deadline it was armed for has passed, so a late callback
+// can never cut a newer segment short.
+static portMUX_TYPE  s_seg_mux      = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *motion_source_name(motion_source_t source) {
+    switch (source) {
+    case MOTION_SRC_HOMEKIT: return "homekit";
+    case MOTION_SRC_TOUCH:   return "touch";
+    case MOTION_SRC_HOMING:  return "homing";
+    case MOTION_SRC_WIND:    return "wind";
+    case MOTION_SRC_RAIN:    return "rain";
+    case MOTION_SRC_LUX:     return "lux";
+    default:                 return "unknown";
+    }
+}
+
+// Calibration and boot homing drive the relays themselves; the engine must not
+// touch them while either is running.
+static bool motion_preempted(void) {
+    return s_cal_state != CAL_IDLE || s_is_homing;
+}
+
+// Time-based position estimate (ppm) for the running segment, derived from the
+// elapsed time since the relay closed. That moment may lie in the future
+// during a reversal dead time. The relays are cut exactly at the target, so
+// the estimate is capped.
+static int32_t motion_estimate(shade_t *sh) {
+    travel_model_t m = shade_travel(sh);
+    return travel_estimate(&m, sh->seg_start_ppm, pos_pct_to_ppm(shade_state(sh).target),
+                           esp_timer_get_time() - sh->seg_t0_us);
+}
+
+// True while the stop deadline of the running segment is still ahead; a move
+// to an end stop runs on after its estimate has reached the target.
+static bool motion_deadline_ahead(shade_t *sh) {
+    taskENTER_CRITICAL(&s_seg_mux);
+    int64_t deadline = sh->seg_deadline_us;
+    taskEXIT_CRITICAL(&s_seg_mux);
+    return deadline != 0 && esp_timer_get_time() < deadline;
+}
+
+// Disarm the stop deadline. Called before the engine changes the relays.
+static void motion_segment_end(shade_t *sh) {
+    esp_timer_stop(sh->stop_timer);
+    taskENTER_CRITICAL(&s_seg_mux);
+    sh->seg_deadline_us = 0;
+    sh->seg_gen++;
+    taskEXIT_CRITICAL(&s_seg_mux);
+}
+
+static void motion_stop_timer_cb(void *arg) {
+    shade_t *sh  = (shade_t *)arg;
+    int64_t  now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&s_seg_mux);
+    int64_t  deadline = sh->seg_deadline_us;
+    bool     due      = (deadline != 0 && now >= deadline && !motion_preempted());
+    uint32_t gen      = sh->seg_gen;
+    if (due) {
+        relay_cut(sh);
+        sh->seg_deadline_us = 0;
+    }
+    taskEXIT_CRITICAL(&s_seg_mux);
+
+    if (due) {
+        latency_record(LAT_STOP_RELAY, deadline, now);
+        motion_cmd_t cmd = {
+            .type   = MOTION_CMD_ARRIVED,
+            .source = MOTION_SRC_HOMEKIT,
+            .shade  = sh->idx,
+            .target = (int)gen,
+        };
+        xQueueSendToFront(s_motion_queue, &cmd, 0);
+    }
+}
+
+// Arm the stop timer for the exact relay-off moment of the segment from
+// seg_start_ppm towards tgt_pos, whose relay closes after delay_ms; see
+// motion_run_us() for the end-stop overrun.
+static void motion_arm_stop_timer(shade_t *sh, uint32_t delay_ms) {
+    travel_model_t m      = shade_travel(sh);
+    uint64_t       run_us = (uint64_t)motion_run_us(&m, sh->seg_start_ppm,
+                                                    shade_state(sh).target) +
+                            (uint64_t)delay_ms * 1000ULL;
+
+    taskENTER_CRITICAL(&s_seg_mux);
+    sh->seg_deadline_us = esp_timer_get_time() + (int64_t)run_us;
+    taskEXIT_CRITICAL(&s_seg_mux);
+
+    if (esp_timer_start_once(sh->stop_timer, run_us) != ESP_OK) {
+        ESP_LOGE(TAG, "Shade %d: stop timer unavailable; falling back to progress ticks",
+                 sh->idx + 1);
+        return;
+    }
+    ESP_LOGD(TAG, "Shade %d: stop deadline armed: %llu us",
+             sh->idx + 1, (unsigned long long)run_us);
+}
+
+static void motion_stop_here(shade_t *sh, motion_source_t source) {
+    int pos = shade_state(sh).pos;
+
+    ESP_LOGI(TAG, "Shade %d: stop at %d%% (%s)", sh->idx + 1, pos,
+             motion_source_name(source));
+
+    motion_segment_end(sh);
+    shade_update(sh, SHADE_KEEP_PPM, pos, MOTION_STOPPED);
+
+    relay_request(sh, MOTION_STOPPED);
+    homekit_notify_position(sh);
+    journal_note(sh);
+}
+
+// Target reached, either on the stop deadline or on the progress-tick backstop.
+static void motion_finish(shade_t *sh) {
+    int tgt = shade_state(sh).target;
+
+    motion_segment_end(sh);
+
+    shade_update(sh, pos_pct_to_ppm(tgt), SHADE_KEEP, MOTION_STOPPED);
+    relay_request(sh, MOTION_STOPPED);
+    homekit_notify_position(sh);
+    journal_note(sh);
+    ESP_LOGI(TAG, "Shade %d: reached %d%% (%s)", sh->idx + 1, tgt,
+             (sh->seg_start_ppm < pos_pct_to_ppm(tgt)) ? "open" : "close");
+}
+
+// Command-to-relay latency for user commands. relay_at_us is when the relay
+// switched, or will switch once a reversal dead time has run out.
+static void motion_trace(const motion_cmd_t *cmd, int64_t relay_at_us) {
+    if (cmd->source == MOTION_SRC_HOMEKIT) {
+        latency_record(LAT_HK_RELAY, cmd->t_us, relay_at_us);
+    } else if (cmd->source == MOTION_SRC_TOUCH) {
+        latency_record(LAT_TOUCH_RELAY, cmd->t_us, relay_at_us);
+    }
+}
+
+// Apply one queued command to its shade. Returns true while a segment is
+// running on that shade.
+static bool motion_apply(shade_t *sh, const motion_cmd_t *cmd, bool active) {
+    if (cmd->type == MOTION_CMD_ARRIVED) {
+        // Stale if the segment it was armed for has since been replaced.
+        if (active && (uint32_t)cmd->target == sh->seg_gen && !motion_preempted()) {
+            motion_finish(sh);
+            return false;
+        }
+        return active;
+    }
+
+    if (motion_preempted()) {
+        ESP_LOGW(TAG, "Command from %s dropped: calibration/homing took over",
+                 motion_source_name(cmd->source));
+        return false;
+    }
+
+    if (active) {
+        position_set(sh, motion_estimate(sh));
+    }
+
+    motion_state_t st     = shade_state(sh);
+    int            target = clamp_position(cmd->target);
+    motion_dir_t   dir    = motion_decide(cmd->type == MOTION_CMD_STOP, st.pos, target);
+    if (dir == MOTION_STOPPED) {
+        motion_stop_here(sh, cmd->source);
+        motion_trace(cmd, esp_timer_get_time());
+        return false;
+    }
+
+    motion_segment_end(sh);
+
+    shade_update(sh, SHADE_KEEP_PPM, target, dir);
+
+    // A reversal returns the remaining dead time; the segment (and with it the
+    // position estimate and the stop deadline) starts when the relay closes.
+    uint32_t delay_ms = relay_request(sh, dir);
+    motion_trace(cmd, esp_timer_get_time() + (int64_t)delay_ms * 1000);
+
+    ESP_LOGI(TAG, "Shade %d: move %d%% -> %d%% (%s, %s)", sh->idx + 1, st.pos, target,
+             (dir == MOTION_OPENING) ? "opening" : "closing",
+             motion_source_name(cmd->source));
+
+    sh->seg_t0_us     = esp_timer_get_time() + (int64_t)delay_ms * 1000;
+    sh->seg_start_ppm = st.pos_ppm;
+    sh->last_tick_ms  = now_ms();
+    motion_arm_stop_timer(sh, delay_ms);
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+    if (target == 0 || target == 100) {
+        travel_learn_kick(sh, st.pos_ppm, target);
+    }
+#endif
+
+    homekit_notify_position(sh);
+    journal_note(sh);
+    return true;
+}
+
+// Progress notification while moving. Returns true while the segment is still
+// running. Stopping is the stop timer's job; reaching the target here is only a
+// backstop in case the timer could not be armed.
+static bool motion_tick(shade_t *sh) {
+    sh->last_tick_ms = now_ms();
+
+    if (motion_preempted()) {
+        return false;
+    }
+
+    motion_state_t st  = shade_state(sh);
+    int32_t        est = motion_estimate(sh);
+    if (est == pos_pct_to_ppm(st.target) && !motion_deadline_ahead(sh)) {
+        motion_finish(sh);
+        return false;
+    }
+
+    position_set(sh, est);
+    if (pos_ppm_to_pct(est) != st.pos) {
+        homekit_notify_position(sh);
+    }
+    return true;
+}
+
+// Ticks to wait until period_ms has passed since elapsed_ms, rounded up so
+// the loop never wakes just short of the deadline and spins.
+static TickType_t motion_wait_ticks(uint32_t elapsed_ms, uint32_t period_ms) {
+    return (elapsed_ms >= period_ms) ? 0 : pdMS_TO_TICKS(period_ms - elapsed_ms) + 1;
+}
+
+// Tell the arbiter which HomeKit target, if any, sh has settling.
+static void motion_settle_note(shade_t *sh, const settle_window_t *w) {
+#ifdef SUNSHADE_USE_PROTECTION
+    taskENTER_CRITICAL(&s_prot_mux);
+    sh->settle = *w;
+    taskEXIT_CRITICAL(&s_prot_mux);
+#else
+    (void)sh;
+    (void)w;
+#endif
+}
+
+// HomeKit target writes settle for TARGET_SETTLE_MS before the relays are
+// touched (see settle_window_t). Stops, touch pads and the protection sensors
+// bypass the window and drop any target still settling. Each shade settles
+// and ticks on its own; the task sleeps until the nearest deadline of any of
+// them.
+static void motion_task(void *arg) {
+    motion_cmd_t    cmd;
+    bool            active[SHADE_CHANNELS] = {0};
+    settle_window_t settle[SHADE_CHANNELS] = {0};
+
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        for (int i = 0; i < SHADE_CHANNELS; i++) {
+            if (active[i]) {
+                TickType_t tick_wait = motion_wait_ticks(now_ms() - s_shades[i].last_tick_ms,
+                                                         PROGRESS_NOTIFY_MS);
+                if (tick_wait < wait) {
+                    wait = tick_wait;
+                }
+            }
+            uint32_t settle_ms = settle_wait_ms(&settle[i], now_ms(), TARGET_SETTLE_MS);
+            if (settle_ms != UINT32_MAX) {
+                TickType_t settle_wait = motion_wait_ticks(0, settle_ms);
+                if (settle_wait < wait) {
+                    wait = settle_wait;
+                }
+            }
+        }
+
+        if (xQueueReceive(s_motion_queue, &cmd, wait) == pdTRUE) {
+            int      i  = cmd.shade;
+            shade_t *sh = &s_shades[i];
+
+            if (TARGET_SETTLE_MS > 0 && cmd.type == MOTION_CMD_MOVE &&
+                cmd.source == MOTION_SRC_HOMEKIT) {
+                if (settle[i].pending) {
+                    ESP_LOGD(TAG, "Shade %d: target %d%% replaces settling %d%%",
+                             i + 1, cmd.target, settle[i].target);
+                }
+                settle_offer(&settle[i], cmd.target, cmd.t_us, now_ms());
+                motion_settle_note(sh, &settle[i]);
+                continue;
+            }
+            if (cmd.type != MOTION_CMD_ARRIVED && settle_cancel(&settle[i])) {
+                motion_settle_note(sh, &settle[i]);
+            }
+            active[i] = motion_apply(sh, &cmd, active[i]);
+            continue;
+        }
+
+        for (int i = 0; i < SHADE_CHANNELS; i++) {
+            shade_t *sh = &s_shades[i];
+
+            if (settle_take(&settle[i], now_ms(), TARGET_SETTLE_MS)) {
+                motion_cmd_t settled = {
+                    .type   = MOTION_CMD_MOVE,
+                    .source = MOTION_SRC_HOMEKIT,
+                    .shade  = (uint8_t)i,
+                    .target = settle[i].target,
+                    .t_us   = settle[i].cmd_us,
+                };
+                motion_settle_note(sh, &settle[i]);
+                active[i] = motion_apply(sh, &settled, active[i]);
+            }
+            if (active[i] && (now_ms() - sh->last_tick_ms) >= PROGRESS_NOTIFY_MS) {
+                active[i] = motion_tick(sh);
+            }
+        }
+    }
+}
+
+static void motion_engine_start(void) {
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        const esp_timer_create_args_t stop_args = {
+            .callback = motion_stop_timer_cb,
+            .arg      = &s_shades[i],
+            .name     = "motion_stop",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&stop_args, &s_shades[i].stop_timer));
+    }
+
+    s_motion_queue = xQueueCreateStatic(MOTION_QUEUE_LEN, sizeof(motion_cmd_t),
+                                        s_motion_queue_storage, &s_motion_queue_buf);
+    task_start(TASK_MOTION, motion_task);
+}
+
+static void motion_post(shade_t *sh, motion_cmd_type_t type, int target,
+                        motion_source_t source) {
+    motion_cmd_t cmd = {
+        .type   = type,
+        .source = source,
+        .shade  = sh->idx,
+        .target = target,
+        .t_us   = esp_timer_get_time(),
+    };
+
+    // STOP jumps the queue so it is never stuck behind pending moves.
+    BaseType_t ok = (type == MOTION_CMD_STOP)
+                  ? xQueueSendToFront(s_motion_queue, &cmd, 0)
+                  : xQueueSend(s_motion_queue, &cmd, 0);
+    if (ok != pdTRUE) {
+        ESP_LOGW(TAG, "Motion queue full; command from %s dropped",
+                 motion_source_name(source));
+    }
+}
+
+// ── Sunshade control ──────────────────────────────────────────────────────────
+// The job that holds every shade, or NULL when commands may be driven.
+static const char *lock_reason(void) {
+    if (s_cal_state != CAL_IDLE) {
+        return "calibration";
+    }
+    if (s_is_homing) {
+        return "homing";
+    }
+    return NULL;
+}
+
+static bool is_locked(void) {
+    const char *why = lock_reason();
+    if (why != NULL) {
+        ESP_LOGW(TAG, "Command ignored: %s in progress", why);
+        return true;
+    }
+    return false;
+}
+
+#ifdef SUNSHADE_USE_PROTECTION
+static const motion_source_t s_prot_motion_src[PROT_COUNT] = {
+    [PROT_WIND] = MOTION_SRC_WIND,
+    [PROT_RAIN] = MOTION_SRC_RAIN,
+    [PROT_LUX]  = MOTION_SRC_LUX,
+};
+
+#if defined(CONFIG_WIND_SENSOR_ENABLE) || defined(CONFIG_LUX_SENSOR_ENABLE)
+// Rain tracks its own edge and never asks. Every shade's arbiter sees the same
+// engage/release sequence, so the first one answers for all.
+static bool protection_active(prot_source_t src) {
+    taskENTER_CRITICAL(&s_prot_mux);
+    bool active = prot_is_active(&s_shades[0].prot, src);
+    taskEXIT_CRITICAL(&s_prot_mux);
+    return active;
+}
+#endif
+#endif
+
+// User moves (HomeKit, touch) while a protection holds the shade are not
+// driven; they become the position restored once every protection clears.
+static bool protection_defers(shade_t *sh, int target, motion_source_t source) {
+#ifdef SUNSHADE_USE_PROTECTION
+    if (source != MOTION_SRC_HOMEKIT && source != MOTION_SRC_TOUCH) {
+        return false;
+    }
+
+    taskENTER_CRITICAL(&s_prot_mux);
+    bool now   = prot_user_move(&sh->prot, target);
+    int  owner = prot_owner(&sh->prot);
+    taskEXIT_CRITICAL(&s_prot_mux);
+
+    if (!now) {
+        ESP_LOGW(TAG, "Shade %d: move to %d%% from %s deferred: %s protection active",
+                 sh->idx + 1, target, motion_source_name(source),
+                 motion_source_name(s_prot_motion_src[owner]));
+        homekit_notify_position(sh);   // snap the Home app back to the real target
+        return true;
+    }
+#else
+    (void)sh;
+#endif
+    return false;
+}
+
+static void sunshade_open(shade_t *sh, motion_source_t source) {
+    if (is_locked() || protection_defers(sh, 100, source)) {
+        return;
+    }
+
+    motion_post(sh, MOTION_CMD_MOVE, 100, source);
+}
+
+static void sunshade_close(shade_t *sh, motion_source_t source) {
+    if (is_locked() || protection_defers(sh, 0, source)) {
+        return;
+    }
+
+    motion_post(sh, MOTION_CMD_MOVE, 0, source);
+}
+
+static void sunshade_stop(shade_t *sh, motion_source_t source) {
+    if (s_cal_state == CAL_OPENING) {
+        calibration_confirm_open();
+        return;
+    }
+
+    if (is_locked()) {
+        return;
+    }
+
+    motion_post(sh, MOTION_CMD_STOP, 0, source);
+}
+
+static void sunshade_move_to(shade_t *sh, int target, motion_source_t source) {
+    target = clamp_position(target);
+    if (is_locked() || protection_defers(sh, target, source)) {
+        return;
+    }
+
+    motion_post(sh, MOTION_CMD_MOVE, target, source);
+}
+
+#ifdef SUNSHADE_USE_PROTECTION
+// Engage or release one protection on every shade and drive each arbiter's
+// effective target, unless it is where that shade is already going.
+static void protection_set(prot_source_t src, bool engage) {
+    const char *name = motion_source_name(s_prot_motion_src[src]);
+
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        shade_t *sh = &s_shades[i];
+
+        int target = shade_state(sh).target;
+
+        taskENTER_CRITICAL(&s_prot_mux);
+        target    = settle_intent(&sh->settle, target);
+        int move  = prot_update(&sh->prot, src, engage, target);
+        int owner = prot_owner(&sh->prot);
+        taskEXIT_CRITICAL(&s_prot_mux);
+
+        if (move == PROT_NO_MOVE) {
+            ESP_LOGI(TAG, "Shade %d: protection %s %s: target %d%% unchanged%s%s",
+                     i + 1, name, engage ? "engaged" : "released", target,
+                     owner >= 0 ? ", held by " : "",
+                     owner >= 0 ? motion_source_name(s_prot_motion_src[owner]) : "");
+            continue;
+        }
+
+        const char *why = lock_reason();
+        if (why != NULL) {
+            // shades_resume() drives the arbiter once the lockout ends.
+            ESP_LOGI(TAG, "Shade %d: protection %s %s during %s; applied when it ends",
+                     i + 1, name, engage ? "engaged" : "released", why);
+            continue;
+        }
+
+        ESP_LOGI(TAG, "Shade %d: protection %s %s: %s to %d%%", i + 1, name,
+                 engage ? "engaged" : "released",
+                 owner >= 0 ? "holding" : "restoring", move);
+        sunshade_move_to(sh, move, s_prot_motion_src[src]);
+    }
+}
+#endif
+
+// Called by homing and calibration once their lock is released: drive each
+// shade to want[i], or keep it at a protection engaged in the meantime and
+// restore want[i] when that clears.
+static void shades_resume(const int want[SHADE_CHANNELS], motion_source_t source) {
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        shade_t        *sh     = &s_shades[i];
+        int             target = clamp_position(want[i]);
+        motion_source_t src    = source;
+
+#ifdef SUNSHADE_USE_PROTECTION
+        taskENTER_CRITICAL(&s_prot_mux);
+        int owner = prot_owner(&sh->prot);
+        int eff   = prot_resume(&sh->prot, target);
+        taskEXIT_CRITICAL(&s_prot_mux);
+
+        if (owner >= 0) {
+            ESP_LOGI(TAG, "Shade %d: %s protection active: holding at %d%%, %d%% restored once it clears",
+                     i + 1, motion_source_name(s_prot_motion_src[owner]), eff, target);
+            target = eff;
+            src    = s_prot_motion_src[owner];
+        }
+#endif
+        if (target != shade_state(sh).target) {
+            motion_post(sh, MOTION_CMD_MOVE, target, src);
+        }
+    }
+}
+
+// ── HomeKit setters ───────────────────────────────────────────────────────────
+// The per-shade characteristics share one setter; the shade is found from the
+// characteristic that was written.
+static shade_t *shade_for_ch(const homekit_characteristic_t *ch) {
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        if (ch == &s_shades[i].target_pos_ch || ch == &s_shades[i].hold_pos_ch) {
+            return &s_shades[i];
+        }
+    }
+    return NULL;
+}
+
+static void target_position_setter(homekit_characteristic_t *ch, const homekit_value_t value) {
+    shade_t *sh = shade_for_ch(ch);
+
+    if (sh == NULL || value.format != homekit_format_uint8) {
+        ESP_LOGE(TAG, "target_position: unexpected format %d", value.format);
+        return;
+    }
+
+    ESP_LOGI(TAG, "HomeKit -> shade %d target_position: %d%%", sh->idx + 1, value.uint8_value);
+    sunshade_move_to(sh, (int)value.uint8_value, MOTION_SRC_HOMEKIT);
+}
+
+static void hold_position_setter(homekit_characteristic_t *ch, const homekit_value_t value) {
+    shade_t *sh = shade_for_ch(ch);
+
+    if (sh == NULL || value.format != homekit_format_bool) {
+        ESP_LOGE(TAG, "hold_position: unexpected format %d", value.format);
+        return;
+    }
+
+    if (value.bool_value) {
+        ESP_LOGI(TAG, "HomeKit -> shade %d hold_position: stop", sh->idx + 1);
+        sunshade_stop(sh, MOTION_SRC_HOMEKIT);
+    }
+}
+
+// ── Motor current sense ───────────────────────────────────────────────────────
+// Optional end-stop detection from the motor supply current (see
+// endstop_detector_t). The sensor sits in the supply line shared by all
+// shades, so a run of several shades ends once every one has reached its end
+// stop. Sampling is a 20 ms burst every CURRENT_POLL_MS from the job task; it
+// only runs while homing or calibrating.
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+#define CURRENT_ADC_GPIO    CONFIG_SUNSHADE_CURRENT_ADC_GPIO
+#define CURRENT_RUN_MV      CONFIG_SUNSHADE_CURRENT_RUN_MV
+#define CURRENT_STOP_MV     CONFIG_SUNSHADE_CURRENT_STOP_MV
+#define CURRENT_STOP_MS     CONFIG_SUNSHADE_CURRENT_STOP_MS
+#define CURRENT_BLANK_MS    500     // relay bounce and motor inrush
+#define CURRENT_SAMPLES     40      // 40 × 500 µs: one 50 Hz mains cycle
+#define CURRENT_SAMPLE_US   500
+#define CURRENT_POLL_MS     100
+#define CURRENT_ADC_FS_MV   2450    // ADC_ATTEN_DB_11 full scale
+
+#if defined(CONFIG_WIND_SENSOR_ENABLE) && CURRENT_ADC_GPIO == CONFIG_WIND_SENSOR_ADC_GPIO
+#error "CONFIG_SUNSHADE_CURRENT_ADC_GPIO must differ from CONFIG_WIND_SENSOR_ADC_GPIO"
+#endif
+#if defined(CONFIG_RAIN_SENSOR_ENABLE) && CURRENT_ADC_GPIO == CONFIG_RAIN_SENSOR_GPIO
+#error "CONFIG_SUNSHADE_CURRENT_ADC_GPIO must differ from CONFIG_RAIN_SENSOR_GPIO"
+#endif
+
+static adc_channel_t s_current_channel;
+static bool          s_current_ok     = false;
+static int           s_current_offset = 0;      // resting sensor output, mV
+
+// One burst of CURRENT_SAMPLES readings in mV. Returns how many were read.
+static int current_window(int *mv) {
+    int n = 0;
 
-    return false;
+    for (int i = 0; i < CURRENT_SAMPLES; i++) {
+        int raw = 0;
+        if (adc_oneshot_read(s_adc1, s_current_channel, &raw) == ESP_OK) {
+            mv[n++] = raw * CURRENT_ADC_FS_MV / 4095;
+        }
+        esp_rom_delay_us(CURRENT_SAMPLE_US);
+    }
+    return n;
 }
 
-static void sunshade_open(void) {
-    if (is_locked()) {
+// Take the sensor's resting output. Call with every relay off.
+static void current_sense_zero(void) {
+    if (!s_current_ok) {
         return;
     }
 
-    if (s_cur_pos >= 100) {
-        ESP_LOGI(TAG, "Already fully open");
-        return;
+    int     mv[CURRENT_SAMPLES];
+    int     n   = current_window(mv);
+    int32_t sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += mv[i];
     }
-
-    ESP_LOGI(TAG, "Opening: %d%% -> 100%%", s_cur_pos);
-
-    relays_all_off();
-    s_tgt_pos           = 100;
-    s_motion            = MOTION_OPENING;
-    target_pos_ch.value = HOMEKIT_UINT8(100);
-
-    relay_activate_open();
-    homekit_notify_position();
-    nvs_save_last_position(100);
-    movement_task_start();
+    s_current_offset = (n > 0) ? (int)(sum / n) : 0;
 }
 
-static void sunshade_close(void) {
-    if (is_locked()) {
+static void current_sense_init(void) {
+    esp_err_t err = adc1_channel_init(CURRENT_ADC_GPIO, &s_current_channel);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_CUR, "GPIO%d unusable (%s); end stops stay timed",
+                 CURRENT_ADC_GPIO, esp_err_to_name(err));
         return;
     }
+    s_current_ok = true;
+    current_sense_zero();     // the relays are still off at boot
+    ESP_LOGI(TAG_CUR, "Current sense on GPIO%d: running >= %d mV, stopped < %d mV for %d ms",
+             CURRENT_ADC_GPIO, CURRENT_RUN_MV, CURRENT_STOP_MV, CURRENT_STOP_MS);
+}
 
-    if (s_cur_pos <= 0) {
-        ESP_LOGI(TAG, "Already fully closed");
-        return;
+// Feed one burst to the detector, unless the motor started (run_at_ms, the
+// moment the relay closed) less than CURRENT_BLANK_MS ago.
+static endstop_state_t current_poll(endstop_detector_t *det, uint32_t run_at_ms) {
+    uint32_t now = now_ms();
+
+    if (!s_current_ok || (int32_t)(now - run_at_ms) < CURRENT_BLANK_MS) {
+        return det->state;
     }
 
-    ESP_LOGI(TAG, "Closing: %d%% -> 0%%", s_cur_pos);
+    int mv[CURRENT_SAMPLES];
+    int n = current_window(mv);
+    return endstop_push(det, current_amplitude(mv, n, s_current_offset), now);
+}
 
-    relays_all_off();
-    s_tgt_pos           = 0;
-    s_motion            = MOTION_CLOSING;
-    target_pos_ch.value = HOMEKIT_UINT8(0);
+// Travel learning: a move to 0 % or 100 % that ends on the motor's own end
+// stop shows how long the run really took, from the relay closing to the
+// current dropping. The job task watches one such run at a time and refines
+// the shade's travel model from it (see travel_learn()). The sensor sees the
+// whole supply, so a run only counts while no other shade is moving, and only
+// if the drop came before the stop deadline cut the relay.
+typedef struct {
+    int      shade;      // -1 = no run to watch
+    uint32_t gen;        // seg_gen of the segment
+    uint32_t t0_ms;      // when the relay closed
+    int32_t  span_ppm;
+    bool     opening;
+} learn_run_t;
 
-    relay_activate_close();
-    homekit_notify_position();
-    nvs_save_last_position(0);
-    movement_task_start();
-}
+static learn_run_t s_learn = { .shade = -1 };   // guarded by s_seg_mux
 
-static void sunshade_stop(void) {
-    if (s_cal_state == CAL_OPENING) {
-        calibration_confirm_open();
-        return;
-    }
+// Called by the motion task once the segment's stop timer is armed.
+static void travel_learn_kick(shade_t *sh, int32_t start_ppm, int target) {
+    int32_t span = pos_pct_to_ppm(target) - start_ppm;
 
-    if (is_locked()) {
+    if (!s_current_ok || !sh->cal_done ||
+        (span < 0 ? -span : span) < TRAVEL_LEARN_SPAN_MIN) {
         return;
     }
 
-    ESP_LOGI(TAG, "Stop at %d%%", s_cur_pos);
+    taskENTER_CRITICAL(&s_seg_mux);
+    s_learn.shade    = sh->idx;
+    s_learn.gen      = sh->seg_gen;
+    s_learn.t0_ms    = (uint32_t)(sh->seg_t0_us / 1000);
+    s_learn.span_ppm = span;
+    s_learn.opening  = (span > 0);
+    taskEXIT_CRITICAL(&s_seg_mux);
 
-    s_motion            = MOTION_STOPPED;
-    s_tgt_pos           = s_cur_pos;
-    target_pos_ch.value = HOMEKIT_UINT8((uint8_t)s_cur_pos);
-
-    relays_all_off();
-    homekit_notify_position();
-    nvs_save_last_position((uint8_t)s_cur_pos);
+    xTaskNotify(s_task_handle[TASK_JOB], JOB_LEARN, eSetBits);
 }
 
-static void sunshade_move_to(int target) {
-    if (is_locked()) {
-        return;
+// The watched segment is still running on its own: not replaced, not cut at
+// its deadline, and no other motor on the supply.
+static bool travel_learn_valid(const shade_t *sh, uint32_t gen) {
+    taskENTER_CRITICAL(&s_seg_mux);
+    bool ok = (sh->seg_gen == gen && sh->seg_deadline_us != 0);
+    taskEXIT_CRITICAL(&s_seg_mux);
+
+    if (!ok || motion_preempted()) {
+        return false;
     }
 
-    if (target < 0) {
-        target = 0;
-    } else if (target > 100) {
-        target = 100;
+    taskENTER_CRITICAL(&s_relay_mux);
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        if (i != sh->idx && s_shades[i].relay.state != RELAY_OFF) {
+            ok = false;
+        }
     }
+    taskEXIT_CRITICAL(&s_relay_mux);
+    return ok;
+}
+
+// Runs in the job task.
+static void travel_learn_run(void) {
+    taskENTER_CRITICAL(&s_seg_mux);
+    learn_run_t run = s_learn;
+    s_learn.shade   = -1;
+    taskEXIT_CRITICAL(&s_seg_mux);
 
-    if (target == s_cur_pos) {
-        sunshade_stop();
+    if (run.shade < 0) {
         return;
     }
 
-    relays_all_off();
-
-    s_tgt_pos           = target;
-    target_pos_ch.value = HOMEKIT_UINT8((uint8_t)target);
+    shade_t           *sh = &s_shades[run.shade];
+    endstop_detector_t det;
+    endstop_init(&det, CURRENT_RUN_MV, CURRENT_STOP_MV, CURRENT_STOP_MS);
 
-    if (target > s_cur_pos) {
-        ESP_LOGI(TAG, "Move to %d%% (opening)", target);
-        s_motion = MOTION_OPENING;
-        relay_activate_open();
-    } else {
-        ESP_LOGI(TAG, "Move to %d%% (closing)", target);
-        s_motion = MOTION_CLOSING;
-        relay_activate_close();
+    while (current_poll(&det, run.t0_ms) != ENDSTOP_REACHED) {
+        if (!travel_learn_valid(sh, run.gen)) {
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(CURRENT_POLL_MS));
+    }
+    if (!travel_learn_valid(sh, run.gen)) {
+        return;
     }
 
-    homekit_notify_position();
-    nvs_save_last_position((uint8_t)target);
-    movement_task_start();
-}
-
-// ── HomeKit setters ───────────────────────────────────────────────────────────
-static void target_position_setter(homekit_value_t value) {
-    if (value.format != homekit_format_uint8) {
-        ESP_LOGE(TAG, "target_position: unexpected format %d", value.format);
+    uint32_t       observed = det.below_since_ms - run.t0_ms;
+    travel_model_t m        = shade_travel(sh);
+    if (!travel_learn(&m, run.opening, run.span_ppm, observed)) {
+        ESP_LOGW(TAG_CUR, "Shade %d: %s end stop after %lu ms is implausible; not learned",
+                 sh->idx + 1, run.opening ? "open" : "closed", (unsigned long)observed);
         return;
     }
 
-    ESP_LOGI(TAG, "HomeKit -> target_position: %d%%", value.uint8_value);
-    sunshade_move_to((int)value.uint8_value);
+    config_set_travel(sh, &m);
+    ESP_LOGI(TAG_CUR, "Shade %d: %s end stop after %lu ms; travel open %lu ms, close %lu ms, lag %lu ms",
+             sh->idx + 1, run.opening ? "open" : "closed", (unsigned long)observed,
+             (unsigned long)m.open_ms, (unsigned long)m.close_ms, (unsigned long)m.lag_ms);
 }
+#endif
 
-static void hold_position_setter(homekit_value_t value) {
-    if (value.format != homekit_format_bool) {
-        ESP_LOGE(TAG, "hold_position: unexpected format %d", value.format);
-        return;
+// Let the running motors reach their end stop: their relays close after
+// dead_ms, and max_ms later the run is over regardless. With current sensing
+// the wait ends as soon as the current drops.
+static void endstop_wait(uint32_t dead_ms, uint32_t max_ms) {
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+    uint32_t           run_at = now_ms() + dead_ms;
+    endstop_detector_t det;
+    endstop_init(&det, CURRENT_RUN_MV, CURRENT_STOP_MV, CURRENT_STOP_MS);
+
+    while ((int32_t)(now_ms() - run_at) < (int32_t)max_ms) {
+        if (current_poll(&det, run_at) == ENDSTOP_REACHED) {
+            ESP_LOGI(TAG_CUR, "End stop reached after %lu ms",
+                     (unsigned long)(det.below_since_ms - run_at));
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(CURRENT_POLL_MS));
     }
-
-    if (value.bool_value) {
-        ESP_LOGI(TAG, "HomeKit -> hold_position: stop");
-        sunshade_stop();
+    if (det.state == ENDSTOP_WAIT) {
+        ESP_LOGW(TAG_CUR, "No motor current seen; ran for the full %lu ms",
+                 (unsigned long)max_ms);
     }
+#else
+    vTaskDelay(pdMS_TO_TICKS(max_ms + dead_ms));
+#endif
 }
 
 // ── Calibration ───────────────────────────────────────────────────────────────
-static void calibration_led_task(void *arg) {
+// Holding STOP calibrates every shade: all close to the end stop together,
+// then each opens in turn and STOP confirms its open end stop.
+// Runs in the LED task for as long as the calibration does.
+static void calibration_led_run(void) {
     while (s_cal_state != CAL_IDLE) {
         uint32_t half = (s_cal_state == CAL_CLOSING) ? 100 : 400;
 
@@ -679,140 +2809,216 @@ static void calibration_led_task(void *arg) {
             vTaskDelay(pdMS_TO_TICKS(200));
         }
     }
+}
 
-    vTaskDelete(NULL);
+// Park a shade at the closed end stop after homing or an aborted calibration.
+static void shade_set_closed(shade_t *sh) {
+    shade_update(sh, 0, 0, MOTION_STOPPED);
+    homekit_notify_position(sh);
 }
 
-static void calibration_confirm_open(void) {
-    uint32_t elapsed = now_ms() - s_cal_t0_ms;
+// The open end stop was reached at end_ms: by STOP, or where the motor
+// current dropped.
+static void calibration_confirm_at(uint32_t end_ms) {
+    if (s_cal_state != CAL_OPENING) {
+        return;
+    }
 
-    relays_all_off();
+    shade_t *sh      = &s_shades[s_cal_shade];
+    uint32_t elapsed = end_ms - s_cal_t0_ms;
+
+    relay_request(sh, MOTION_STOPPED);
 
     if (elapsed < 2000) {
         ESP_LOGW(TAG_CAL, "Aborted: STOP pressed too soon (%lu ms)",
                  (unsigned long)elapsed);
-        s_cal_success        = false;
-        s_cal_state          = CAL_IDLE;
-        s_cur_pos            = 0;
-        s_tgt_pos            = 0;
-        s_motion             = MOTION_STOPPED;
-        current_pos_ch.value = HOMEKIT_UINT8(0);
-        target_pos_ch.value  = HOMEKIT_UINT8(0);
-        homekit_notify_position();
+        s_cal_success = false;
+        s_cal_state   = CAL_IDLE;
+        shade_set_closed(sh);
         return;
     }
 
-    s_cal_ms             = elapsed;
-    s_cal_done           = true;
-    s_cal_success        = true;
-    s_cur_pos            = 100;
-    s_tgt_pos            = 100;
-    s_motion             = MOTION_STOPPED;
+    // The measured time includes the motor's start lag.
+    uint32_t travel_ms = (elapsed > 2 * MOTOR_LAG_MS) ? elapsed - MOTOR_LAG_MS : elapsed;
 
-    current_pos_ch.value = HOMEKIT_UINT8(100);
-    target_pos_ch.value  = HOMEKIT_UINT8(100);
-    s_cal_state          = CAL_IDLE;
+    sh->cal_done = true;
+    shade_update(sh, POS_PPM_FULL, 100, MOTION_STOPPED);
+    s_cal_state  = CAL_CONFIRMED;
 
-    nvs_save_calibration(elapsed);
-    nvs_save_last_position(100);
-    homekit_notify_position();
+    config_set_calibration(sh, travel_ms);
+    journal_note(sh);
+    homekit_notify_position(sh);
 
-    ESP_LOGI(TAG_CAL, "Calibration complete: travel time = %lu ms",
-             (unsigned long)elapsed);
+    ESP_LOGI(TAG_CAL, "Shade %d calibrated: travel time = %lu ms",
+             sh->idx + 1, (unsigned long)travel_ms);
 }
 
-static void calibration_task(void *arg) {
-    ESP_LOGI(TAG_CAL, "=== CALIBRATION START ===");
-
-    s_cal_success = false;
-    s_motion      = MOTION_STOPPED;
-    relays_all_off();
-    vTaskDelay(pdMS_TO_TICKS(300));
+static void calibration_confirm_open(void) {
+    calibration_confirm_at(now_ms());
+}
 
-    // ── Phase 1: drive to closed end-stop ─────────────────────────────────────
-    ESP_LOGI(TAG_CAL, "Phase 1: closing fully (LED: fast blink)...");
-    s_cal_state = CAL_CLOSING;
+// Close the shades in mask to their end stop, all at once. Without current
+// sensing they run for ENDSTOP_BUFFER_FACTOR times their travel time (at
+// least 8 s), so this takes as long as the slowest shade needs.
+static void shades_close_to_endstop(uint32_t mask) {
+    uint32_t close_ms = 8000;
+    uint32_t dead_ms  = 0;
 
-    uint32_t close_ms = (uint32_t)(s_cal_ms * ENDSTOP_BUFFER_FACTOR);
-    if (close_ms < 8000) {
-        close_ms = 8000;
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+    current_sense_zero();
+#endif
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        shade_t *sh = &s_shades[i];
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        shade_update(sh, SHADE_KEEP_PPM, 0, MOTION_CLOSING);
+        travel_model_t m  = shade_travel(sh);
+        uint32_t       ms = (uint32_t)(m.close_ms * ENDSTOP_BUFFER_FACTOR) + m.lag_ms;
+        if (ms > close_ms) {
+            close_ms = ms;
+        }
+        uint32_t d = relay_request(sh, MOTION_CLOSING);
+        if (d > dead_ms) {
+            dead_ms = d;
+        }
     }
 
-    relay_activate_close();
-    vTaskDelay(pdMS_TO_TICKS(close_ms));
-    relays_all_off();
+    endstop_wait(dead_ms, close_ms);
+
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        if (mask & (1u << i)) {
+            relay_request(&s_shades[i], MOTION_STOPPED);
+        }
+    }
+}
 
-    s_cur_pos            = 0;
-    s_tgt_pos            = 0;
-    s_motion             = MOTION_STOPPED;
-    current_pos_ch.value = HOMEKIT_UINT8(0);
-    target_pos_ch.value  = HOMEKIT_UINT8(0);
-    homekit_notify_position();
+// Phase 2 for one shade: open until STOP confirms the end stop. Returns false
+// if the calibration was aborted or timed out.
+static bool calibration_open_one(shade_t *sh) {
+    s_cal_shade = sh->idx;
+    ESP_LOGI(TAG_CAL, "Phase 2: opening shade %d (LED: slow blink) - press STOP when fully open",
+             sh->idx + 1);
 
-    vTaskDelay(pdMS_TO_TICKS(500));
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+    current_sense_zero();
+#endif
 
-    // ── Phase 2: open and wait for user to press STOP ─────────────────────────
-    ESP_LOGI(TAG_CAL, "Phase 2: opening (LED: slow blink) - press STOP when fully open");
+    // Travel is timed from the moment the relay closes, after any dead time.
+    uint32_t dead_ms = relay_request(sh, MOTION_OPENING);
+    if (dead_ms > 0) {
+        vTaskDelay(pdMS_TO_TICKS(dead_ms) + 1);
+    }
 
-    s_cal_t0_ms          = now_ms();
-    s_cal_state          = CAL_OPENING;
-    s_motion             = MOTION_OPENING;
-    target_pos_ch.value  = HOMEKIT_UINT8(100);
-    relay_activate_open();
-    homekit_notify_position();
+    s_cal_t0_ms = now_ms();
+    s_cal_state = CAL_OPENING;
+    shade_update(sh, SHADE_KEEP_PPM, 100, MOTION_OPENING);
+    homekit_notify_position(sh);
 
     uint32_t t_start        = now_ms();
     uint32_t last_notify_ms = t_start;
     uint32_t last_log_ms    = t_start;
-    uint32_t ref_ms         = (s_cal_ms > 0) ? s_cal_ms : DEFAULT_TRAVEL_MS;
+    uint32_t ref_ms         = shade_travel(sh).open_ms;
     int      last_notified  = 0;
 
+    // Progress against the previous travel time, held below 100 % until the
+    // user (or the motor current) confirms the open end stop.
+    const int32_t cal_cap_ppm = pos_pct_to_ppm(99);
+
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+    endstop_detector_t det;
+    endstop_init(&det, CURRENT_RUN_MV, CURRENT_STOP_MV, CURRENT_STOP_MS);
+#endif
+
     while (s_cal_state == CAL_OPENING) {
         uint32_t now = now_ms();
 
         if ((now - t_start) > CAL_OPEN_MAX_MS) {
             ESP_LOGW(TAG_CAL, "Timeout: calibration aborted after %lu s",
                      (unsigned long)(CAL_OPEN_MAX_MS / 1000));
-            relays_all_off();
+            relay_request(sh, MOTION_STOPPED);
             s_cal_success = false;
             s_cal_state   = CAL_IDLE;
-            s_cur_pos     = 0;
-            s_tgt_pos     = 0;
-            s_motion      = MOTION_STOPPED;
-            homekit_notify_position();
+            shade_update(sh, 0, 0, MOTION_STOPPED);
+            homekit_notify_position(sh);
             break;
         }
 
         // Live position estimate: only notify HomeKit when integer value changes.
         if ((now - last_notify_ms) >= POS_UPDATE_INTERVAL_MS) {
             uint32_t elapsed = now - s_cal_t0_ms;
-            int estimated    = (int)((float)elapsed / (float)ref_ms * 100.0f);
-            if (estimated > 99) estimated = 99;
-            s_cur_pos = estimated;
-            if (estimated != last_notified) {
-                last_notified = estimated;
-                homekit_notify_position();
+            int32_t  est     = pos_ppm_travelled((int64_t)elapsed * 1000, ref_ms);
+            position_set(sh, est > cal_cap_ppm ? cal_cap_ppm : est);
+            int pos = shade_state(sh).pos;
+            if (pos != last_notified) {
+                last_notified = pos;
+                homekit_notify_position(sh);
             }
             last_notify_ms = now;
         }
 
-        // Serial progress log every second for installer/monitor feedback.
+        // Progress event every second for installer/monitor feedback (on the
+        // console with SampleLog on).
         if ((now - last_log_ms) >= 1000) {
             uint32_t elapsed = now - s_cal_t0_ms;
-            int pct = (int)((float)elapsed / (float)ref_ms * 100.0f);
-            if (pct > 99) pct = 99;
-            ESP_LOGI(TAG_CAL, "Opening... ~%d%% (%lu s) - press STOP when fully open",
-                     pct, (unsigned long)(elapsed / 1000));
+            int32_t  est     = pos_ppm_travelled((int64_t)elapsed * 1000, ref_ms);
+            int      pct     = pos_ppm_to_pct(est > cal_cap_ppm ? cal_cap_ppm : est);
+            evlog_put(EV_CAL_PROGRESS, sh->idx + 1, pct, (int32_t)(elapsed / 1000), 0);
             last_log_ms = now;
         }
 
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+        if (current_poll(&det, s_cal_t0_ms) == ENDSTOP_REACHED) {
+            ESP_LOGI(TAG_CAL, "Open end stop detected from the motor current");
+            calibration_confirm_at(det.below_since_ms);
+            continue;
+        }
+#endif
         vTaskDelay(pdMS_TO_TICKS(100));
     }
 
+    return s_cal_state == CAL_CONFIRMED;
+}
+
+// Runs in the job task; calibration_start() has already set CAL_CLOSING.
+static void calibration_run(void) {
+    ESP_LOGI(TAG_CAL, "=== CALIBRATION START ===");
+
+    s_cal_success = false;
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        shade_update(&s_shades[i], SHADE_KEEP_PPM, SHADE_KEEP, MOTION_STOPPED);
+    }
+    relays_all_off();
+    vTaskDelay(pdMS_TO_TICKS(300));
+
+    // ── Phase 1: drive to closed end-stop ─────────────────────────────────────
+    ESP_LOGI(TAG_CAL, "Phase 1: closing fully (LED: fast blink)...");
+    s_cal_state = CAL_CLOSING;
+
+    shades_close_to_endstop(SHADE_MASK_ALL);
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        shade_set_closed(&s_shades[i]);
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(500));
+
+    // ── Phase 2: open each shade and wait for the user to press STOP ──────────
+    bool ok = true;
+    for (int i = 0; i < SHADE_CHANNELS && ok; i++) {
+        ok = calibration_open_one(&s_shades[i]);
+    }
+
+    s_cal_success = ok;
+    s_cal_state   = CAL_IDLE;
+
     ESP_LOGI(TAG_CAL, "=== CALIBRATION END (state: %s) ===",
              s_cal_success ? "SUCCESS" : "ABORTED");
 
-    vTaskDelete(NULL);
+    int want[SHADE_CHANNELS];
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        want[i] = shade_state(&s_shades[i]).target;
+    }
+    shades_resume(want, MOTION_SRC_HOMING);
 }
 
 static void calibration_start(void) {
@@ -825,61 +3031,123 @@ static void calibration_start(void) {
         return;
     }
 
-    if (xTaskCreate(calibration_task, "cal_task", 4096, NULL, 4, NULL) != pdPASS) {
-        ESP_LOGE(TAG_CAL, "Failed to create calibration task");
-        return;
-    }
-    if (xTaskCreate(calibration_led_task, "cal_led", 1024, NULL, 3, NULL) != pdPASS) {
-        ESP_LOGE(TAG_CAL, "Failed to create calibration LED task");
-    }
+    // Locks out commands at once and keeps the LED blinking from the start.
+    s_cal_state = CAL_CLOSING;
+    xTaskNotify(s_task_handle[TASK_JOB], JOB_CALIBRATE, eSetBits);
+    xTaskNotify(s_task_handle[TASK_LED], LED_CALIBRATION, eSetBits);
 }
 
 // ── Boot homing ───────────────────────────────────────────────────────────────
-static void homing_task(void *arg) {
-    uint8_t last_pos = (uint8_t)(uintptr_t)arg;
-
+// mask selects the shades to home; each is then restored to its boot_target.
+// Shades outside the mask (fast boot, uncalibrated) are not moved.
+static void homing_run(uint32_t mask) {
     ESP_LOGI(TAG, "Homing: closing fully to establish position 0%%...");
 
     s_is_homing = true;
-    s_motion    = MOTION_CLOSING;
+    shades_close_to_endstop(mask);
 
-    uint32_t close_ms = (uint32_t)(s_cal_ms * ENDSTOP_BUFFER_FACTOR);
-    if (close_ms < 8000) {
-        close_ms = 8000;
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        if (mask & (1u << i)) {
+            shade_set_closed(&s_shades[i]);
+        }
     }
 
-    relay_activate_close();
-    vTaskDelay(pdMS_TO_TICKS(close_ms));
-    relays_all_off();
-
-    s_cur_pos = 0;
-    s_tgt_pos = 0;
-    s_motion  = MOTION_STOPPED;
-
-    current_pos_ch.value = HOMEKIT_UINT8(0);
-    target_pos_ch.value  = HOMEKIT_UINT8(0);
-    homekit_notify_position();
-
     ESP_LOGI(TAG, "Homing: position 0%% established");
 
     vTaskDelay(pdMS_TO_TICKS(500));
 
     s_is_homing = false;
 
-    if (last_pos > 0 && last_pos <= 100) {
-        ESP_LOGI(TAG, "Homing: restoring to last target %d%%", last_pos);
-        sunshade_move_to((int)last_pos);
+    // Shades outside the mask stay where they are, but they were locked too.
+    int want[SHADE_CHANNELS];
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        shade_t *sh       = &s_shades[i];
+        uint8_t  last_pos = sh->boot_target;
+        want[i] = shade_state(sh).target;
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        if (last_pos > 0 && last_pos <= 100) {
+            ESP_LOGI(TAG, "Homing: restoring shade %d to last target %d%%", i + 1, last_pos);
+            want[i] = last_pos;
+        } else {
+            ESP_LOGI(TAG, "Homing complete; shade %d at 0%%", i + 1);
+        }
+    }
+    shades_resume(want, MOTION_SRC_HOMING);
+}
+
+// ── Shade jobs ────────────────────────────────────────────────────────────────
+// Boot homing and calibration both drive every shade for tens of seconds and
+// are mutually exclusive, so they share one task that sleeps between jobs.
+// The notification value carries the job: the low bits are a homing mask.
+static void shade_job_task(void *arg) {
+    for (;;) {
+        uint32_t jobs = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &jobs, portMAX_DELAY);
+
+        if (jobs & JOB_HOMING_MASK) {
+            homing_run(jobs & JOB_HOMING_MASK);
+        }
+        if (jobs & JOB_CALIBRATE) {
+            calibration_run();
+        }
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+        if (jobs & JOB_LEARN) {
+            travel_learn_run();
+        }
+#endif
+    }
+}
+
+// ── Fast boot ─────────────────────────────────────────────────────────────────
+// When the journal shows that the last motion finished cleanly (relays off,
+// resting position committed), the position is restored straight away and the
+// shade is controllable within milliseconds of boot. A power cut mid-move, an
+// unflushed change or the legacy single-byte key all fall back to homing, and
+// a full homing run is forced every FAST_BOOT_HOMING_EVERY boots so the
+// time-based estimate is re-anchored at the end stop now and then. Each shade
+// decides on its own journal and counter.
+#ifdef CONFIG_SUNSHADE_FAST_BOOT
+#define FAST_BOOT_HOMING_EVERY  CONFIG_SUNSHADE_FAST_BOOT_HOMING_EVERY
+#endif
+
+// Returns true if the position was restored and homing can be skipped.
+static bool fast_boot_restore(shade_t *sh, const journal_record_t *rec) {
+#ifndef CONFIG_SUNSHADE_FAST_BOOT
+    (void)sh;
+    (void)rec;
+    return false;
+#else
+    uint8_t count = config_fast_boots(sh);
+
+    if (!journal_clean(rec)) {
+        ESP_LOGI(TAG, "Fast boot: shade %d was not shut down cleanly; homing", sh->idx + 1);
+    } else if (count + 1 >= FAST_BOOT_HOMING_EVERY) {
+        ESP_LOGI(TAG, "Fast boot: shade %d: %d boots since last homing; homing",
+                 sh->idx + 1, count + 1);
     } else {
-        ESP_LOGI(TAG, "Homing complete; sunshade at 0%%");
+        config_set_fast_boots(sh, (uint8_t)(count + 1));
+
+        // The journal keeps per-mille, so a partial stop survives the reboot
+        // to 0.1 % rather than being rounded to the reported percent.
+        int32_t ppm = pos_clamp_ppm((int32_t)rec->pos_pm * 1000);
+        int     pos = pos_ppm_to_pct(ppm);
+        shade_update(sh, ppm, pos, MOTION_STOPPED);
+        homekit_notify_position(sh);
+
+        ESP_LOGI(TAG, "Fast boot: shade %d restored to %d%% (homing in %d boots)",
+                 sh->idx + 1, pos, FAST_BOOT_HOMING_EVERY - count - 1);
+        return true;
     }
 
-    vTaskDelete(NULL);
+    config_set_fast_boots(sh, 0);
+    return false;
+#endif
 }
 
 // ── Identify ──────────────────────────────────────────────────────────────────
-static volatile TaskHandle_t s_identify_task = NULL;
-
-static void accessory_identify_task(void *args) {
+static void identify_led_run(void) {
     for (int i = 0; i < 3; i++) {
         for (int j = 0; j < 2; j++) {
             led_write(true);
@@ -891,17 +3159,28 @@ static void accessory_identify_task(void *args) {
     }
 
     led_write(false);
-    s_identify_task = NULL;
-    vTaskDelete(NULL);
+}
+
+// One task plays every LED pattern, so identify and the calibration blink
+// never fight over the LED. Requests arriving while a pattern plays are
+// played once it ends.
+static void led_task(void *arg) {
+    for (;;) {
+        uint32_t req = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &req, portMAX_DELAY);
+
+        if (req & LED_CALIBRATION) {
+            calibration_led_run();
+        }
+        if (req & LED_IDENTIFY) {
+            identify_led_run();
+        }
+    }
 }
 
 static void accessory_identify(homekit_value_t _value) {
     ESP_LOGI("INFORMATION", "Accessory identify");
-    if (s_identify_task != NULL) {
-        return;
-    }
-    xTaskCreate(accessory_identify_task, "identify",
-                1024, NULL, 2, (TaskHandle_t *)&s_identify_task);
+    xTaskNotify(s_task_handle[TASK_LED], LED_IDENTIFY, eSetBits);
 }
 
 // ── HomeKit accessory definition ──────────────────────────────────────────────
@@ -921,6 +3200,10 @@ static homekit_characteristic_t model =
 static homekit_characteristic_t revision =
     HOMEKIT_CHARACTERISTIC_(FIRMWARE_REVISION, LIFECYCLE_DEFAULT_FW_VERSION);
 static homekit_characteristic_t ota_trigger = API_OTA_TRIGGER;
+static homekit_characteristic_t latency_stats = API_LATENCY_STATS(latency_stats_getter);
+static homekit_characteristic_t task_stats = API_TASK_STATS(task_stats_getter);
+static homekit_characteristic_t event_log = API_EVENT_LOG(evlog_getter);
+static homekit_characteristic_t sample_log = API_SAMPLE_LOG(0, sample_log_getter, sample_log_setter);
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Woverride-init"
@@ -939,13 +3222,47 @@ homekit_accessory_t *accessories[] = {
         }),
         HOMEKIT_SERVICE(WINDOW_COVERING, .primary = true, .characteristics = (homekit_characteristic_t*[]) {
             HOMEKIT_CHARACTERISTIC(NAME, "Sun Screen"),
-            &current_pos_ch,
-            &target_pos_ch,
-            &pos_state_ch,
-            &hold_pos_ch,
+            &s_shades[0].current_pos_ch,
+            &s_shades[0].target_pos_ch,
+            &s_shades[0].pos_state_ch,
+            &s_shades[0].hold_pos_ch,
             &ota_trigger,
+            &latency_stats,
+            &task_stats,
+            &event_log,
+            &sample_log,
+            NULL
+        }),
+#if SHADE_CHANNELS >= 2
+        HOMEKIT_SERVICE(WINDOW_COVERING, .characteristics = (homekit_characteristic_t*[]) {
+            HOMEKIT_CHARACTERISTIC(NAME, "Sun Screen 2"),
+            &s_shades[1].current_pos_ch,
+            &s_shades[1].target_pos_ch,
+            &s_shades[1].pos_state_ch,
+            &s_shades[1].hold_pos_ch,
+            NULL
+        }),
+#endif
+#if SHADE_CHANNELS >= 3
+        HOMEKIT_SERVICE(WINDOW_COVERING, .characteristics = (homekit_characteristic_t*[]) {
+            HOMEKIT_CHARACTERISTIC(NAME, "Sun Screen 3"),
+            &s_shades[2].current_pos_ch,
+            &s_shades[2].target_pos_ch,
+            &s_shades[2].pos_state_ch,
+            &s_shades[2].hold_pos_ch,
             NULL
         }),
+#endif
+#if SHADE_CHANNELS >= 4
+        HOMEKIT_SERVICE(WINDOW_COVERING, .characteristics = (homekit_characteristic_t*[]) {
+            HOMEKIT_CHARACTERISTIC(NAME, "Sun Screen 4"),
+            &s_shades[3].current_pos_ch,
+            &s_shades[3].target_pos_ch,
+            &s_shades[3].pos_state_ch,
+            &s_shades[3].hold_pos_ch,
+            NULL
+        }),
+#endif
 #ifdef CONFIG_TEMP_SENSOR_ENABLE
         HOMEKIT_SERVICE(TEMPERATURE_SENSOR, .characteristics = (homekit_characteristic_t*[]) {
             HOMEKIT_CHARACTERISTIC(NAME, "Temperature"),
@@ -1005,13 +3322,86 @@ static bool debounce_update(debounced_input_t *input) {
     return input->stable;
 }
 
+#ifdef CONFIG_ESP_TTP_INTERRUPT
+// Interrupt mode: any edge on a pad wakes ttp_task, which then blocks until the
+// next debounce or STOP-hold deadline, or indefinitely while the panel is idle.
+//
+// With automatic light sleep, edge interrupts are not seen while the chip
+// sleeps, so each pad instead gets a level interrupt (which doubles as its
+// light-sleep wake source) armed for the opposite of its current level. The
+// ISR disarms the pad that fired and the task re-arms all pads after each pass.
+static TaskHandle_t s_ttp_task = NULL;
+
+static void IRAM_ATTR ttp_isr(void *arg) {
+    BaseType_t woken = pdFALSE;
+#ifdef SUNSHADE_LIGHT_SLEEP
+    gpio_intr_disable((gpio_num_t)(uintptr_t)arg);
+#endif
+    vTaskNotifyGiveFromISR(s_ttp_task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+#ifdef SUNSHADE_LIGHT_SLEEP
+// A level that has already changed fires as soon as it is armed, so no edge
+// between the read and the enable is lost.
+static void ttp_irq_arm(gpio_num_t gpio) {
+    gpio_wakeup_enable(gpio, gpio_get_level(gpio) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    gpio_intr_enable(gpio);
+}
+
+static void ttp_irq_arm_all(void) {
+    ttp_irq_arm((gpio_num_t)TTP_UP_GPIO);
+    ttp_irq_arm((gpio_num_t)TTP_STOP_GPIO);
+    ttp_irq_arm((gpio_num_t)TTP_DOWN_GPIO);
+}
+#endif
+
+static void ttp_irq_enable(void) {
+    s_ttp_task = xTaskGetCurrentTaskHandle();
+
+    // The service may already be installed by another driver.
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add((gpio_num_t)TTP_UP_GPIO,   ttp_isr,
+                                         (void *)(uintptr_t)TTP_UP_GPIO));
+    ESP_ERROR_CHECK(gpio_isr_handler_add((gpio_num_t)TTP_STOP_GPIO, ttp_isr,
+                                         (void *)(uintptr_t)TTP_STOP_GPIO));
+    ESP_ERROR_CHECK(gpio_isr_handler_add((gpio_num_t)TTP_DOWN_GPIO, ttp_isr,
+                                         (void *)(uintptr_t)TTP_DOWN_GPIO));
+#ifdef SUNSHADE_LIGHT_SLEEP
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+    ttp_irq_arm_all();
+#endif
+}
+
+// Time left until an input's pending change becomes stable, or UINT32_MAX if
+// nothing is pending.
+static uint32_t debounce_pending_ms(const debounced_input_t *input, uint32_t now) {
+    if (input->last_raw == input->stable) {
+        return UINT32_MAX;
+    }
+    uint32_t since = now - input->changed_at_ms;
+    return (since >= TTP_DEBOUNCE_MS) ? 0 : TTP_DEBOUNCE_MS - since;
+}
+
+static inline uint32_t min_u32(uint32_t a, uint32_t b) {
+    return (a < b) ? a : b;
+}
+#endif
+
 static void ttp_gpio_init_one(gpio_num_t gpio) {
     gpio_config_t io_conf = {
         .pin_bit_mask = (1ULL << gpio),
         .mode         = GPIO_MODE_INPUT,
         .pull_up_en   = GPIO_PULLUP_DISABLE,
         .pull_down_en = GPIO_PULLDOWN_ENABLE,
+#if defined(CONFIG_ESP_TTP_INTERRUPT) && !defined(SUNSHADE_LIGHT_SLEEP)
+        .intr_type    = GPIO_INTR_ANYEDGE,
+#else
         .intr_type    = GPIO_INTR_DISABLE,
+#endif
     };
 
     ESP_ERROR_CHECK(gpio_config(&io_conf));
@@ -1022,13 +3412,36 @@ static void ttp_init(void) {
     ttp_gpio_init_one((gpio_num_t)TTP_STOP_GPIO);
     ttp_gpio_init_one((gpio_num_t)TTP_DOWN_GPIO);
 
+#ifdef CONFIG_ESP_TTP_INTERRUPT
+    ESP_LOGI(TAG_TOUCH,
+             "TTP223 inputs: UP=GPIO%d STOP=GPIO%d DOWN=GPIO%d active_level=%d debounce=%dms edge-triggered",
+             TTP_UP_GPIO, TTP_STOP_GPIO, TTP_DOWN_GPIO,
+             TTP_ACTIVE_LEVEL, TTP_DEBOUNCE_MS);
+#else
     ESP_LOGI(TAG_TOUCH,
              "TTP223 inputs: UP=GPIO%d STOP=GPIO%d DOWN=GPIO%d active_level=%d debounce=%dms poll=%dms",
              TTP_UP_GPIO, TTP_STOP_GPIO, TTP_DOWN_GPIO,
              TTP_ACTIVE_LEVEL, TTP_DEBOUNCE_MS, TTP_POLL_MS);
+#endif
+}
+
+// The pads drive TOUCH_CHANNEL, or every shade together when it is 0.
+static void ttp_drive(void (*action)(shade_t *, motion_source_t)) {
+#if TOUCH_CHANNEL > 0
+    action(&s_shades[TOUCH_CHANNEL - 1], MOTION_SRC_TOUCH);
+#else
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        action(&s_shades[i], MOTION_SRC_TOUCH);
+    }
+#endif
 }
 
 static void ttp_task(void *arg) {
+#ifdef CONFIG_ESP_TTP_INTERRUPT
+    // Enable edges before sampling the seed state so no edge is lost between.
+    ttp_irq_enable();
+#endif
+
     // Seed from actual GPIO state: a sensor already active at boot must not
     // trigger a false rising edge on the first poll.
     uint32_t t0       = now_ms();
@@ -1072,12 +3485,12 @@ static void ttp_task(void *arg) {
 
         if (up_now && !up_prev) {
             ESP_LOGI(TAG_TOUCH, "UP touched -> opening");
-            sunshade_open();
+            ttp_drive(sunshade_open);
         }
 
         if (down_now && !down_prev) {
             ESP_LOGI(TAG_TOUCH, "DOWN touched -> closing");
-            sunshade_close();
+            ttp_drive(sunshade_close);
         }
 
         if (stop_now) {
@@ -1098,18 +3511,234 @@ static void ttp_task(void *arg) {
                     calibration_confirm_open();
                 } else {
                     ESP_LOGI(TAG_TOUCH, "STOP touched -> stopping");
-                    sunshade_stop();
+                    ttp_drive(sunshade_stop);
                 }
             }
 
             cal_armed = false;
         }
 
-        up_prev   = up_now;
-        stop_prev = stop_now;
-        down_prev = down_now;
+        up_prev   = up_now;
+        stop_prev = stop_now;
+        down_prev = down_now;
+
+#ifdef CONFIG_ESP_TTP_INTERRUPT
+        uint32_t now  = now_ms();
+        uint32_t wait = min_u32(debounce_pending_ms(&up, now),
+                        min_u32(debounce_pending_ms(&stop_in, now),
+                                debounce_pending_ms(&down, now)));
+        if (stop_now && !cal_armed) {
+            uint32_t held = now - stop_press_start;
+            wait = min_u32(wait, (held >= CAL_HOLD_TRIGGER_MS) ? 0 : CAL_HOLD_TRIGGER_MS - held);
+        }
+#ifdef SUNSHADE_LIGHT_SLEEP
+        ttp_irq_arm_all();
+#endif
+        ulTaskNotifyTake(pdTRUE, (wait == UINT32_MAX) ? portMAX_DELAY
+                                                      : pdMS_TO_TICKS(wait) + 1);
+#else
+        vTaskDelay(pdMS_TO_TICKS(TTP_POLL_MS));
+#endif
+    }
+}
+
+// ── Firmware update ───────────────────────────────────────────────────────────
+// With SUNSHADE_OTA_BACKGROUND an update no longer reboots into the Lifecycle
+// Manager first. The image is streamed from OTA_URL over HTTPS straight into
+// the inactive ota_0/ota_1 partition while the shades stay in service, in
+// ranged requests of OTA_CHUNK_BYTES. Flash sectors are erased as they are
+// written. Erasing and writing flash stalls both cores' caches, so no chunk
+// is written while a motor runs, or during calibration or homing. A motion
+// that starts mid-download only pauses it. The image is verified (header,
+// project name, SHA-256) before it is made the boot partition. The one reboot
+// waits until every shade is at rest and its journal is flushed, so the new
+// firmware comes up through the fast-boot restore instead of homing. Without
+// the option, both triggers keep the Lifecycle Manager path.
+#ifdef CONFIG_SUNSHADE_OTA_BACKGROUND
+#define OTA_URL             CONFIG_SUNSHADE_OTA_URL
+#define OTA_CHUNK_BYTES     16384
+#define OTA_TIMEOUT_MS      15000
+#define OTA_MIN_HEAP_BLOCK  40000   // TLS session plus the download buffers
+#define OTA_IDLE_POLL_MS    500
+
+static volatile bool s_ota_busy = false;
+
+// True while a relay is on or about to be, or calibration or homing owns them.
+static bool ota_motion_busy(void) {
+    if (motion_preempted()) {
+        return true;
+    }
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        if (shade_state(&s_shades[i]).dir != MOTION_STOPPED) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void ota_wait_motion_idle(void) {
+    bool logged = false;
+
+    while (ota_motion_busy()) {
+        if (!logged) {
+            ESP_LOGI(TAG_OTA, "Shade moving; download paused");
+            logged = true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(OTA_IDLE_POLL_MS));
+    }
+    if (logged) {
+        ESP_LOGI(TAG_OTA, "Shades at rest; download resumed");
+    }
+}
+
+// Download, verify and select the new image. Returns ESP_OK once it is the
+// boot partition.
+static esp_err_t ota_download(void) {
+    const esp_app_desc_t *running = esp_app_get_description();
+    size_t                block   = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    if (block < OTA_MIN_HEAP_BLOCK) {
+        ESP_LOGW(TAG_OTA, "Largest free heap block %u B < %u B; try again later",
+                 (unsigned)block, (unsigned)OTA_MIN_HEAP_BLOCK);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_http_client_config_t http = {
+        .url               = OTA_URL,
+        .timeout_ms        = OTA_TIMEOUT_MS,
+        .keep_alive_enable = true,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+    };
+    esp_https_ota_config_t cfg = {
+        .http_config           = &http,
+        .partial_http_download = true,
+        .max_http_request_size = OTA_CHUNK_BYTES,
+    };
+    esp_https_ota_handle_t h = NULL;
+
+    ESP_LOGI(TAG_OTA, "Checking %s", OTA_URL);
+    esp_err_t err = esp_https_ota_begin(&cfg, &h);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    esp_app_desc_t desc;
+    err = esp_https_ota_get_img_desc(h, &desc);
+    if (err == ESP_OK && strncmp(desc.project_name, running->project_name,
+                                 sizeof(desc.project_name)) != 0) {
+        ESP_LOGE(TAG_OTA, "Image is for \"%.32s\", not \"%.32s\"",
+                 desc.project_name, running->project_name);
+        err = ESP_ERR_INVALID_RESPONSE;
+    } else if (err == ESP_OK && strncmp(desc.version, running->version,
+                                        sizeof(desc.version)) == 0) {
+        ESP_LOGI(TAG_OTA, "Already running %.32s", desc.version);
+        err = ESP_ERR_INVALID_VERSION;
+    }
+    if (err != ESP_OK) {
+        esp_https_ota_abort(h);
+        return err;
+    }
+    ESP_LOGI(TAG_OTA, "Downloading %.32s -> %.32s", running->version, desc.version);
+
+    int size = esp_https_ota_get_image_size(h);
+    int step = -1;
+    for (;;) {
+        ota_wait_motion_idle();
+        err = esp_https_ota_perform(h);
+        if (err != ESP_ERR_HTTPS_OTA_IN_PROGRESS) {
+            break;
+        }
+        if (size > 0) {
+            int pct = (int)((int64_t)esp_https_ota_get_image_len_read(h) * 100 / size);
+            if (pct / 10 != step) {
+                step = pct / 10;
+                ESP_LOGI(TAG_OTA, "%d%% of %d B", pct, size);
+            }
+        }
+    }
+    if (err == ESP_OK && !esp_https_ota_is_complete_data_received(h)) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err != ESP_OK) {
+        esp_https_ota_abort(h);
+        return err;
+    }
+
+    err = esp_https_ota_finish(h);         // verifies the image, sets the boot partition
+    if (err == ESP_OK) {
+        lifecycle_set_installed_version(desc.version);
+    }
+    return err;
+}
+
+// Reboot into the new image once nothing moves. The journal of every shade
+// then holds a clean resting record, which the next boot restores directly.
+static void ota_reboot_when_idle(void) {
+    ESP_LOGI(TAG_OTA, "Update verified; rebooting once the shades are at rest");
+    ota_wait_motion_idle();
+
+    relays_all_off();
+    persist_flush();
+    vTaskDelay(pdMS_TO_TICKS(100));        // let the log drain
+    esp_restart();
+}
+
+static void ota_task(void *arg) {
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_handle_t pm_lock = NULL;
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "ota", &pm_lock));
+#endif
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        s_ota_busy = true;
+#ifdef CONFIG_PM_ENABLE
+        esp_pm_lock_acquire(pm_lock);
+#endif
+        esp_err_t err = ota_download();
+#ifdef CONFIG_PM_ENABLE
+        esp_pm_lock_release(pm_lock);
+#endif
+        if (err == ESP_OK) {
+            ota_reboot_when_idle();
+        }
+        if (err != ESP_ERR_INVALID_VERSION) {
+            ESP_LOGE(TAG_OTA, "Update failed: %s; still running %s",
+                     esp_err_to_name(err), esp_app_get_description()->version);
+        }
+        s_ota_busy = false;
+    }
+}
+#endif
+
+// Single press and the OTA characteristic both land here.
+static void ota_request(void) {
+#ifdef CONFIG_SUNSHADE_OTA_BACKGROUND
+    if (s_ota_busy) {
+        ESP_LOGI(TAG_OTA, "Update already in progress");
+        return;
+    }
+    xTaskNotifyGive(s_task_handle[TASK_OTA]);
+#else
+    relays_all_off();
+    persist_flush();
+    lifecycle_request_update_and_reboot();
+#endif
+}
 
-        vTaskDelay(pdMS_TO_TICKS(TTP_POLL_MS));
+// Runs in the HAP server task. Same contract as lifecycle_handle_ota_trigger():
+// the value snaps back to false and a true write starts an update.
+static void ota_trigger_setter(homekit_characteristic_t *ch, const homekit_value_t value) {
+    if (value.format != homekit_format_bool) {
+        ESP_LOGW(TAG, "ota_trigger: unexpected format %d", value.format);
+        return;
+    }
+    ch->value.bool_value = false;
+    homekit_characteristic_notify(ch, HOMEKIT_BOOL(false));
+
+    if (value.bool_value) {
+        ESP_LOGI(TAG, "HomeKit -> firmware update");
+        ota_request();
     }
 }
 
@@ -1117,14 +3746,14 @@ static void ttp_task(void *arg) {
 static void button_callback(button_event_t event, void *context) {
     switch (event) {
     case button_event_single_press:
-        ESP_LOGI(TAG_BUTTON, "Single press -> update/reboot");
-        relays_all_off();
-        lifecycle_request_update_and_reboot();
+        ESP_LOGI(TAG_BUTTON, "Single press -> firmware update");
+        ota_request();
         break;
 
     case button_event_double_press:
         ESP_LOGI(TAG_BUTTON, "Double press -> HomeKit reset + restart");
         relays_all_off();
+        persist_flush();
         homekit_server_reset();
         esp_restart();
         break;
@@ -1147,32 +3776,64 @@ static void gpio_init_all(void) {
     gpio_set_direction(LED_GPIO, GPIO_MODE_OUTPUT);
     led_write(false);
 
-    gpio_reset_pin(RELAY_OPEN_GPIO);
-    gpio_set_direction(RELAY_OPEN_GPIO, GPIO_MODE_OUTPUT);
-    gpio_set_level(RELAY_OPEN_GPIO, relay_output_level(RELAY_ACTIVE_LEVEL, false));
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        shade_t *sh = &s_shades[i];
+
+        gpio_reset_pin(sh->relay_open_gpio);
+        gpio_set_direction(sh->relay_open_gpio, GPIO_MODE_OUTPUT);
+        gpio_set_level(sh->relay_open_gpio, relay_output_level(RELAY_ACTIVE_LEVEL, false));
 
-    gpio_reset_pin(RELAY_CLOSE_GPIO);
-    gpio_set_direction(RELAY_CLOSE_GPIO, GPIO_MODE_OUTPUT);
-    gpio_set_level(RELAY_CLOSE_GPIO, relay_output_level(RELAY_ACTIVE_LEVEL, false));
-    s_relay_dir = MOTION_STOPPED;
+        gpio_reset_pin(sh->relay_close_gpio);
+        gpio_set_direction(sh->relay_close_gpio, GPIO_MODE_OUTPUT);
+        gpio_set_level(sh->relay_close_gpio, relay_output_level(RELAY_ACTIVE_LEVEL, false));
+        sh->relay = (relay_fsm_t)RELAY_FSM_INIT;
 
-    ESP_LOGI(TAG, "GPIO: LED=%d RELAY_OPEN=%d RELAY_CLOSE=%d active_level=%d reverse_delay=%dms",
-             LED_GPIO, RELAY_OPEN_GPIO, RELAY_CLOSE_GPIO,
-             RELAY_ACTIVE_LEVEL, RELAY_REVERSE_DELAY_MS);
+        const esp_timer_create_args_t dead_args = {
+            .callback = relay_dead_time_cb,
+            .arg      = sh,
+            .name     = "relay_dead",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&dead_args, &sh->relay_timer));
+
+        ESP_LOGI(TAG, "GPIO: shade %d RELAY_OPEN=%d RELAY_CLOSE=%d",
+                 i + 1, sh->relay_open_gpio, sh->relay_close_gpio);
+    }
+
+    ESP_LOGI(TAG, "GPIO: LED=%d active_level=%d reverse_delay=%dms",
+             LED_GPIO, RELAY_ACTIVE_LEVEL, RELAY_REVERSE_DELAY_MS);
 }
 
 // ── WiFi ready ────────────────────────────────────────────────────────────────
 static void on_wifi_ready(void) {
     static volatile bool homekit_started = false;
 
+    // Reapplied on every (re)connect in case the station was restarted.
+    power_wifi_init();
+    latency_record(LAT_WIFI_CONNECT, 0, wifi_last_connect_us());
+
     if (homekit_started) {
         ESP_LOGI("INFORMATION", "HomeKit already running; skipping re-init");
         return;
     }
 
-    ESP_LOGI("INFORMATION", "Starting HomeKit server...");
+    ESP_LOGI("INFORMATION", "Starting HomeKit server %lu ms after boot...",
+             (unsigned long)now_ms());
     homekit_server_init(&hk_config);
     homekit_started = true;
+    homekit_task_check();
+#ifdef CONFIG_SUNSHADE_SUN_SCHEDULE
+    // UTC is all the sun plan needs; lwIP keeps the clock disciplined.
+    esp_sntp_setoperatingmode(ESP_SNTP_OPMODE_POLL);
+    esp_sntp_setservername(0, CONFIG_SUNSHADE_SNTP_SERVER);
+    esp_sntp_init();
+#endif
+#if defined(CONFIG_SUNSHADE_OTA_BACKGROUND) && defined(CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE)
+    // Connected and serving HomeKit: keep this image instead of rolling back.
+    esp_ota_mark_app_valid_cancel_rollback();
+#endif
+#ifdef CONFIG_SUNSHADE_TELEMETRY
+    task_start(TASK_TELE, tele_task);
+#endif
 }
 
 // ── Wind speed sensor ─────────────────────────────────────────────────────────
@@ -1198,7 +3859,8 @@ static void on_wifi_ready(void) {
  * NOISE:     DC commutator generates ripple voltage. Cogging creates step-wise
  *            output near startup threshold. Hardware: place 10 kΩ + 10 µF RC
  *            low-pass filter (τ ≈ 100 ms) on the signal before the ESP32 ADC.
- *            Software: 16-sample average per reading (implemented below).
+ *            Software: 16-sample average per reading (implemented below), or
+ *            a DMA burst average with WIND_SENSOR_ADC_DMA.
  *
  * ADC:       ESP32 internal ADC has ±10% nonlinearity without calibration.
  *            ADC_ATTEN_DB_11 useful range: 150 mV–2450 mV. Above this the
@@ -1207,9 +3869,6 @@ static void on_wifi_ready(void) {
  *            is masked by the WIND_ADC_ZERO_OFFSET_MV threshold below.
  */
 
-// Number of ADC samples averaged per reading to reduce commutator ripple.
-#define WIND_ADC_SAMPLES  16
-
 // ADC_ATTEN_DB_11 full-scale approximation (mV). Actual varies ±5% per chip.
 #define WIND_ADC_ATTEN_FS_MV  2450
 
@@ -1217,38 +3876,149 @@ static void on_wifi_ready(void) {
 // ~33 mV sensor × 22/32 = ~23 mV. Use 30 mV threshold for safety margin.
 #define WIND_ADC_ZERO_OFFSET_MV  30
 
-static void wind_task(void *arg) {
-    adc_unit_t    adc_unit;
-    adc_channel_t adc_channel;
-
-    if (adc_oneshot_io_to_channel(WIND_ADC_GPIO, &adc_unit, &adc_channel) != ESP_OK) {
-        ESP_LOGE(TAG_WIND, "GPIO%d is not a valid ADC pin; wind task disabled", WIND_ADC_GPIO);
-        vTaskDelete(NULL);
-        return;
+#ifdef CONFIG_WIND_SENSOR_ADC_DMA
+/*
+ * DMA burst sampling: once per poll the continuous-mode driver runs for
+ * WIND_DMA_WINDOW_MS at WIND_DMA_SAMPLE_HZ and the samples are summed frame by
+ * frame as the DMA hands them over. The window spans several commutator ripple
+ * periods, so the mean rejects ripple far better than 16 one-shot reads, and
+ * the task only wakes once per frame instead of once per sample. The ESP32
+ * digital controller cannot run slower than SOC_ADC_SAMPLE_FREQ_THRES_LOW
+ * (20 kHz); the window average acts as the decimation to the rate we need.
+ */
+#define WIND_DMA_SAMPLE_HZ    CONFIG_WIND_SENSOR_DMA_SAMPLE_HZ
+#define WIND_DMA_WINDOW_MS    CONFIG_WIND_SENSOR_DMA_WINDOW_MS
+#define WIND_DMA_FRAME_BYTES  (256 * SOC_ADC_DIGI_RESULT_BYTES)
+#define WIND_ADC_SAMPLES      (WIND_DMA_SAMPLE_HZ / 1000 * WIND_DMA_WINDOW_MS)
+
+static adc_continuous_handle_t s_wind_adc;
+static adc_channel_t           s_wind_channel;
+static uint8_t                 s_wind_frame[WIND_DMA_FRAME_BYTES];
+
+static esp_err_t wind_adc_init(void) {
+    adc_unit_t unit;
+    esp_err_t  err = adc_continuous_io_to_channel(WIND_ADC_GPIO, &unit, &s_wind_channel);
+    if (err != ESP_OK || unit != ADC_UNIT_1) {
+        return ESP_ERR_INVALID_ARG;
     }
 
-    // ADC2 conflicts with WiFi on ESP32; only ADC1 (GPIO32-39) is safe.
-    if (adc_unit != ADC_UNIT_1) {
-        ESP_LOGE(TAG_WIND, "GPIO%d maps to ADC2 (conflicts with WiFi); use GPIO32-39",
-                 WIND_ADC_GPIO);
-        vTaskDelete(NULL);
-        return;
+    adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = WIND_DMA_FRAME_BYTES * 2,
+        .conv_frame_size    = WIND_DMA_FRAME_BYTES,
+    };
+    err = adc_continuous_new_handle(&handle_cfg, &s_wind_adc);
+    if (err != ESP_OK) {
+        return err;
     }
 
-    adc_oneshot_unit_handle_t adc_handle;
-    adc_oneshot_unit_init_cfg_t unit_cfg = {
-        .unit_id  = ADC_UNIT_1,
-        .ulp_mode = ADC_ULP_MODE_DISABLE,
+    // ADC_ATTEN_DB_11: accurate range 150–2450 mV (see divider notes above).
+    adc_digi_pattern_config_t pattern = {
+        .atten     = ADC_ATTEN_DB_11,
+        .channel   = (uint8_t)s_wind_channel,
+        .unit      = ADC_UNIT_1,
+        .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
     };
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&unit_cfg, &adc_handle));
-
-    // ADC_ATTEN_DB_11: accurate range 150–2450 mV. Use R1=10k/R2=22k divider
-    // so 3.3 V sensor max maps to 2270 mV, safely within the accurate range.
-    adc_oneshot_chan_cfg_t chan_cfg = {
-        .atten    = ADC_ATTEN_DB_11,
-        .bitwidth = ADC_BITWIDTH_12,
+    adc_continuous_config_t dig_cfg = {
+        .pattern_num    = 1,
+        .adc_pattern    = &pattern,
+        .sample_freq_hz = WIND_DMA_SAMPLE_HZ,
+        .conv_mode      = ADC_CONV_SINGLE_UNIT_1,
+        .format         = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
     };
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc_handle, adc_channel, &chan_cfg));
+    return adc_continuous_config(s_wind_adc, &dig_cfg);
+}
+
+// Mean raw count over one DMA burst, or -1 if no sample arrived.
+static int wind_adc_read_raw(void) {
+    int64_t sum   = 0;
+    int     count = 0;
+
+    if (adc_continuous_start(s_wind_adc) != ESP_OK) {
+        return -1;
+    }
+
+    // Discard frames still pooled from the previous burst; a fresh frame takes
+    // at least 2.5 ms to fill, so a zero-timeout read only returns stale data.
+    uint32_t stale = 0;
+    while (adc_continuous_read(s_wind_adc, s_wind_frame, sizeof(s_wind_frame),
+                               &stale, 0) == ESP_OK) {
+    }
+
+    while (count < WIND_ADC_SAMPLES) {
+        uint32_t len = 0;
+        // Generous timeout: one frame normally arrives within ~13 ms.
+        if (adc_continuous_read(s_wind_adc, s_wind_frame, sizeof(s_wind_frame),
+                                &len, 100) != ESP_OK) {
+            break;
+        }
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len;
+             i += SOC_ADC_DIGI_RESULT_BYTES) {
+            const adc_digi_output_data_t *d = (const adc_digi_output_data_t *)&s_wind_frame[i];
+            if (d->type1.channel == s_wind_channel) {
+                sum += d->type1.data;
+                count++;
+            }
+        }
+    }
+
+    adc_continuous_stop(s_wind_adc);
+    return (count > 0) ? (int)(sum / count) : -1;
+}
+#else
+// Number of ADC samples averaged per reading to reduce commutator ripple.
+#define WIND_ADC_SAMPLES  16
+
+static adc_channel_t s_wind_channel;
+
+// ADC_ATTEN_DB_11 (see adc1_channel_init()). Use R1=10k/R2=22k divider so the
+// 3.3 V sensor max maps to 2270 mV, safely within the accurate range.
+static esp_err_t wind_adc_init(void) {
+    return adc1_channel_init(WIND_ADC_GPIO, &s_wind_channel);
+}
+
+// Average WIND_ADC_SAMPLES readings to suppress commutator ripple and
+// brush-contact noise. Returns the mean raw count, or -1 if every read failed.
+static int wind_adc_read_raw(void) {
+    int32_t raw_sum = 0;
+    int     valid   = 0;
+
+#ifdef CONFIG_PM_ENABLE
+    // The 5 ms gaps would otherwise let the chip light-sleep mid-burst.
+    esp_pm_lock_acquire(s_pm_adc_lock);
+#endif
+    for (int s = 0; s < WIND_ADC_SAMPLES; s++) {
+        int raw = 0;
+        if (adc_oneshot_read(s_adc1, s_wind_channel, &raw) == ESP_OK) {
+            raw_sum += raw;
+            valid++;
+        }
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_release(s_pm_adc_lock);
+#endif
+
+    return (valid > 0) ? (int)(raw_sum / valid) : -1;
+}
+#endif
+
+// Readings per gust window. Protection closes on the window peak and only
+// reopens once the whole window has stayed below the reopen threshold.
+#define WIND_GUST_SAMPLES  ((WIND_GUST_WINDOW_MS + WIND_POLL_MS - 1) / WIND_POLL_MS)
+#define WIND_EMA_ALPHA_Q8  64    // 1/4 weight per new reading
+
+static gust_filter_t s_wind_gust;
+static int           s_wind_gust_ds  = 0;
+
+static esp_err_t wind_sensor_init(void) {
+    // ADC2 conflicts with WiFi on ESP32; only ADC1 (GPIO32-39) is usable.
+    esp_err_t err = wind_adc_init();
+    if (err == ESP_ERR_INVALID_ARG) {
+        ESP_LOGE(TAG_WIND, "GPIO%d is not an ADC1 pin (GPIO32-39); wind sensor disabled",
+                 WIND_ADC_GPIO);
+        return err;
+    }
+    ESP_ERROR_CHECK(err);
 
     ESP_LOGI(TAG_WIND,
              "HWFS-1 ready: GPIO%d | cal factor V×%d.%d m/s | "
@@ -1261,65 +4031,65 @@ static void wind_task(void *arg) {
              (unsigned long)WIND_POLL_MS,
              WIND_ADC_SAMPLES);
 
-    for (;;) {
-        vTaskDelay(pdMS_TO_TICKS(WIND_POLL_MS));
-
-        // Average WIND_ADC_SAMPLES readings to suppress commutator ripple and
-        // brush-contact noise. Spread samples evenly within the poll interval.
-        int32_t raw_sum = 0;
-        int     valid   = 0;
-        for (int s = 0; s < WIND_ADC_SAMPLES; s++) {
-            int raw = 0;
-            if (adc_oneshot_read(adc_handle, adc_channel, &raw) == ESP_OK) {
-                raw_sum += raw;
-                valid++;
-            }
-            vTaskDelay(pdMS_TO_TICKS(5));
-        }
-
-        if (valid == 0) {
-            ESP_LOGW(TAG_WIND, "All ADC reads failed");
-            continue;
-        }
-
-        int raw_avg = (int)(raw_sum / valid);
+    gust_init(&s_wind_gust, WIND_GUST_SAMPLES, WIND_EMA_ALPHA_Q8);
+    if (WIND_GUST_SAMPLES > GUST_WINDOW_MAX) {
+        ESP_LOGW(TAG_WIND, "Gust window %d ms exceeds %d readings at %d ms poll; clamped",
+                 WIND_GUST_WINDOW_MS, GUST_WINDOW_MAX, WIND_POLL_MS);
+    }
+    return ESP_OK;
+}
 
-        // Convert averaged raw counts to mV using the ADC_ATTEN_DB_11 full-scale.
-        int mv = (int)((float)raw_avg * (float)WIND_ADC_ATTEN_FS_MV / 4095.0f);
+static bool wind_sensor_sample(void) {
+    int raw_avg = wind_adc_read_raw();
+    if (raw_avg < 0) {
+        ESP_LOGW(TAG_WIND, "All ADC reads failed");
+        return false;
+    }
 
-        // Mask the resting offset (~33 mV sensor → ~20 mV at ADC after divider).
-        // Also masks the ESP32 ADC's unreliable sub-100 mV region.
-        if (mv <= WIND_ADC_ZERO_OFFSET_MV) {
-            mv = 0;
-        }
+    // Convert averaged raw counts to mV using the ADC_ATTEN_DB_11 full-scale.
+    int mv = (int)((float)raw_avg * (float)WIND_ADC_ATTEN_FS_MV / 4095.0f);
 
-        // Linear conversion: speed_ds = mv × MAX_SPEED_DS / ADC_FULL_SCALE_MV
-        // This implements: speed(m/s) = V_sensor × calibration_factor
-        // where calibration_factor is derived from MAX_SPEED_DS and the divider ratio.
-        int speed_ds = wind_speed_ds(mv, WIND_ADC_FULL_SCALE_MV, WIND_MAX_SPEED_DS);
+    // Mask the resting offset (~33 mV sensor → ~20 mV at ADC after divider).
+    // Also masks the ESP32 ADC's unreliable sub-100 mV region.
+    if (mv <= WIND_ADC_ZERO_OFFSET_MV) {
+        mv = 0;
+    }
 
-        // Log at INFO level so installers can read raw mV for field calibration.
-        ESP_LOGI(TAG_WIND, "%d.%d m/s (avg_raw=%d, %d mV)",
-                 speed_ds / 10, speed_ds % 10, raw_avg, mv);
+    // Linear conversion: speed_ds = mv × MAX_SPEED_DS / ADC_FULL_SCALE_MV
+    // This implements: speed(m/s) = V_sensor × calibration_factor
+    // where calibration_factor is derived from MAX_SPEED_DS and the divider ratio.
+    int speed_ds = wind_speed_ds(mv, WIND_ADC_FULL_SCALE_MV, WIND_MAX_SPEED_DS);
+
+    gust_push(&s_wind_gust, speed_ds);
+    s_wind_gust_ds = (int)gust_max(&s_wind_gust);
+    int mean_ds    = (int)gust_mean(&s_wind_gust);
+    int ema_ds     = (int)gust_ema(&s_wind_gust);
+
+    // Recorded every reading, so installers can follow the mV for field
+    // calibration through EventLog or SampleLog.
+    evlog_put(EV_WIND, speed_ds, mv, s_wind_gust_ds, mean_ds);
+    tele_put(TELE_WIND, speed_ds);
+    ESP_LOGD(TAG_WIND, "avg_raw=%d | ema %d.%d m/s", raw_avg, ema_ds / 10, ema_ds % 10);
+    return true;
+}
 
-        sensor_action_t act = sensor_hysteresis(s_wind_closed, speed_ds,
-                                                WIND_CLOSE_THRESHOLD_DS,
-                                                WIND_REOPEN_THRESHOLD_DS);
-        if (act == SENSOR_TRIGGER_CLOSE) {
-            ESP_LOGW(TAG_WIND, "Wind %d.%d m/s >= %d.%d m/s: closing for protection",
-                     speed_ds / 10, speed_ds % 10,
-                     WIND_CLOSE_THRESHOLD_DS / 10, WIND_CLOSE_THRESHOLD_DS % 10);
-            s_wind_saved_pos = s_tgt_pos;
-            s_wind_closed    = true;
-            sunshade_close();
-        } else if (act == SENSOR_TRIGGER_REOPEN) {
-            ESP_LOGI(TAG_WIND, "Wind %d.%d m/s < %d.%d m/s: restoring to %d%%",
-                     speed_ds / 10, speed_ds % 10,
-                     WIND_REOPEN_THRESHOLD_DS / 10, WIND_REOPEN_THRESHOLD_DS % 10,
-                     s_wind_saved_pos);
-            s_wind_closed = false;
-            sunshade_move_to(s_wind_saved_pos);
-        }
+static void wind_sensor_protect(void) {
+    int gust_ds = s_wind_gust_ds;
+
+    sensor_action_t act = sensor_hysteresis(protection_active(PROT_WIND), gust_ds,
+                                            WIND_CLOSE_THRESHOLD_DS,
+                                            WIND_REOPEN_THRESHOLD_DS);
+    if (act == SENSOR_TRIGGER_CLOSE) {
+        ESP_LOGW(TAG_WIND, "Gust %d.%d m/s >= %d.%d m/s: closing for protection",
+                 gust_ds / 10, gust_ds % 10,
+                 WIND_CLOSE_THRESHOLD_DS / 10, WIND_CLOSE_THRESHOLD_DS % 10);
+        protection_set(PROT_WIND, true);
+    } else if (act == SENSOR_TRIGGER_REOPEN) {
+        ESP_LOGI(TAG_WIND, "Peak %d.%d m/s < %d.%d m/s over %d ms: releasing protection",
+                 gust_ds / 10, gust_ds % 10,
+                 WIND_REOPEN_THRESHOLD_DS / 10, WIND_REOPEN_THRESHOLD_DS % 10,
+                 WIND_GUST_WINDOW_MS);
+        protection_set(PROT_WIND, false);
     }
 }
 #endif
@@ -1340,7 +4110,12 @@ static void wind_task(void *arg) {
  *          sheltered overhang to limit exposure. The 2 s debounce prevents
  *          false triggers from brief condensation or dust.
  */
-static void rain_task(void *arg) {
+static bool     s_rain_last_raw   = false;
+static bool     s_rain_stable     = false;
+static bool     s_rain_prev       = false;   // stable state at the previous protect
+static uint32_t s_rain_changed_at = 0;
+
+static esp_err_t rain_sensor_init(void) {
     gpio_config_t io_conf = {
         .pin_bit_mask = (1ULL << RAIN_GPIO),
         .mode         = GPIO_MODE_INPUT,
@@ -1357,48 +4132,68 @@ static void rain_task(void *arg) {
              (unsigned long)RAIN_POLL_MS,
              (unsigned long)RAIN_DEBOUNCE_MS);
 
-    bool     last_raw   = (gpio_get_level(RAIN_GPIO) == RAIN_ACTIVE_LEVEL);
-    uint32_t changed_at = now_ms();
-    bool     stable     = last_raw;
-
-    for (;;) {
-        vTaskDelay(pdMS_TO_TICKS(RAIN_POLL_MS));
-
-        bool     raw  = (gpio_get_level(RAIN_GPIO) == RAIN_ACTIVE_LEVEL);
-        uint32_t now  = now_ms();
+    s_rain_last_raw   = (gpio_get_level(RAIN_GPIO) == RAIN_ACTIVE_LEVEL);
+    s_rain_stable     = s_rain_last_raw;
+    s_rain_prev       = s_rain_last_raw;
+    s_rain_changed_at = now_ms();
+    return ESP_OK;
+}
 
-        if (raw != last_raw) {
-            last_raw   = raw;
-            changed_at = now;
-        }
+static bool rain_sensor_sample(void) {
+    bool     raw = (gpio_get_level(RAIN_GPIO) == RAIN_ACTIVE_LEVEL);
+    uint32_t now = now_ms();
 
-        if ((now - changed_at) >= RAIN_DEBOUNCE_MS) {
-            bool new_stable = raw;
+    if (raw != s_rain_last_raw) {
+        s_rain_last_raw   = raw;
+        s_rain_changed_at = now;
+    }
 
-            if (new_stable && !stable) {
-                ESP_LOGW(TAG_RAIN, "Rain detected: closing for protection (saved pos=%d%%)",
-                         s_tgt_pos);
-                s_rain_saved_pos = s_tgt_pos;
-                s_rain_closed    = true;
-                sunshade_close();
-            } else if (!new_stable && stable) {
-                ESP_LOGI(TAG_RAIN, "Rain stopped: restoring to %d%%", s_rain_saved_pos);
-                s_rain_closed = false;
-                sunshade_move_to(s_rain_saved_pos);
-            }
+    if ((now - s_rain_changed_at) >= RAIN_DEBOUNCE_MS) {
+        s_rain_stable = raw;
+    }
+    return true;
+}
 
-            stable = new_stable;
-        }
+static void rain_sensor_protect(void) {
+    if (s_rain_stable && !s_rain_prev) {
+        ESP_LOGW(TAG_RAIN, "Rain detected: closing for protection");
+        protection_set(PROT_RAIN, true);
+    } else if (!s_rain_stable && s_rain_prev) {
+        ESP_LOGI(TAG_RAIN, "Rain stopped: releasing protection");
+        protection_set(PROT_RAIN, false);
     }
+
+    s_rain_prev = s_rain_stable;
 }
 #endif
 
 // ── Shared I2C bus ────────────────────────────────────────────────────────────
-// The BH1750 light sensor and the SHT3x climate sensor share one I2C bus. It is
-// created once from app_main before the sensor tasks start, so there is no race
-// and no double initialisation.
+// The BH1750 light sensor and the SHT3x climate sensor share one I2C bus. The
+// bus manager below owns it: every transaction goes through i2c_dev_xfer(),
+// which serialises access with a mutex and uses short timeouts, so a slave
+// that holds the bus can only cost the other device a few tens of ms rather
+// than a full second. After I2C_RECOVER_AFTER consecutive failures on a device
+// the bus is reset (the driver clocks SCL until a stuck slave releases SDA)
+// and the device is re-added and re-initialised through its setup hook.
 #ifdef SUNSHADE_USE_I2C
-static i2c_master_bus_handle_t s_i2c_bus = NULL;
+#define I2C_XFER_TIMEOUT_MS   50
+#define I2C_LOCK_TIMEOUT_MS   200
+#define I2C_RECOVER_AFTER     3
+
+typedef struct i2c_dev i2c_dev_t;
+struct i2c_dev {
+    const char              *name;
+    uint16_t                 addr;
+    // Brings the device into its operating mode after (re-)adding it. Runs
+    // with the bus lock held, so it must use i2c_dev_write_locked().
+    esp_err_t              (*setup)(i2c_dev_t *dev);
+    i2c_master_dev_handle_t  handle;
+    uint8_t                  failures;   // consecutive failed transactions
+};
+
+static i2c_master_bus_handle_t s_i2c_bus      = NULL;
+static SemaphoreHandle_t       s_i2c_lock     = NULL;
+static StaticSemaphore_t       s_i2c_lock_buf;
 
 static esp_err_t i2c_bus_init(void) {
     i2c_master_bus_config_t bus_cfg = {
@@ -1410,13 +4205,103 @@ static esp_err_t i2c_bus_init(void) {
         .flags.enable_internal_pullup = true,
     };
 
+    s_i2c_lock = xSemaphoreCreateMutexStatic(&s_i2c_lock_buf);
+
     esp_err_t err = i2c_new_master_bus(&bus_cfg, &s_i2c_bus);
     if (err != ESP_OK) {
+        s_i2c_bus = NULL;
         ESP_LOGE(TAG_I2C, "I2C bus init failed (SDA=%d SCL=%d): %s",
                  I2C_SDA_GPIO, I2C_SCL_GPIO, esp_err_to_name(err));
     } else {
-        ESP_LOGI(TAG_I2C, "I2C bus ready (SDA=%d SCL=%d)", I2C_SDA_GPIO, I2C_SCL_GPIO);
+        ESP_LOGI(TAG_I2C, "I2C bus ready (SDA=%d SCL=%d, %d kHz)",
+                 I2C_SDA_GPIO, I2C_SCL_GPIO, I2C_BUS_SPEED_HZ / 1000);
+    }
+    return err;
+}
+
+static esp_err_t i2c_dev_write_locked(i2c_dev_t *dev, const uint8_t *tx, size_t tx_len) {
+    return i2c_master_transmit(dev->handle, tx, tx_len, I2C_XFER_TIMEOUT_MS);
+}
+
+static esp_err_t i2c_dev_attach_locked(i2c_dev_t *dev) {
+    i2c_device_config_t dev_cfg = {
+        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+        .device_address  = dev->addr,
+        .scl_speed_hz    = I2C_BUS_SPEED_HZ,
+    };
+
+    esp_err_t err = i2c_master_bus_add_device(s_i2c_bus, &dev_cfg, &dev->handle);
+    if (err != ESP_OK) {
+        dev->handle = NULL;
+        return err;
+    }
+    err = dev->setup ? dev->setup(dev) : ESP_OK;
+    if (err != ESP_OK) {
+        i2c_master_bus_rm_device(dev->handle);
+        dev->handle = NULL;
+    }
+    return err;
+}
+
+static void i2c_bus_recover_locked(i2c_dev_t *dev) {
+    ESP_LOGW(TAG_I2C, "%s at 0x%02X failed %d times; resetting bus",
+             dev->name, dev->addr, dev->failures);
+    if (dev->handle != NULL) {
+        i2c_master_bus_rm_device(dev->handle);
+        dev->handle = NULL;
+    }
+    esp_err_t err = i2c_master_bus_reset(s_i2c_bus);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_I2C, "Bus reset failed: %s", esp_err_to_name(err));
+    }
+    err = i2c_dev_attach_locked(dev);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG_I2C, "%s re-added after bus reset", dev->name);
+    } else {
+        ESP_LOGE(TAG_I2C, "%s still unavailable: %s", dev->name, esp_err_to_name(err));
+    }
+    dev->failures = 0;
+}
+
+// Adds a device to the shared bus and runs its setup hook.
+static esp_err_t i2c_dev_add(i2c_dev_t *dev) {
+    if (s_i2c_bus == NULL) return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(s_i2c_lock, portMAX_DELAY);
+    esp_err_t err = i2c_dev_attach_locked(dev);
+    dev->failures = 0;
+    xSemaphoreGive(s_i2c_lock);
+    return err;
+}
+
+// One write, read, or write-then-read (repeated start) transaction. Either
+// half may be empty. Failures are counted per device and trigger bus recovery.
+static esp_err_t i2c_dev_xfer(i2c_dev_t *dev, const uint8_t *tx, size_t tx_len,
+                              uint8_t *rx, size_t rx_len) {
+    if (s_i2c_bus == NULL) return ESP_ERR_INVALID_STATE;
+    if (xSemaphoreTake(s_i2c_lock, pdMS_TO_TICKS(I2C_LOCK_TIMEOUT_MS)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t err;
+    if (dev->handle == NULL) {
+        err = ESP_ERR_INVALID_STATE;   // lost in an earlier recovery
+    } else if (tx_len && rx_len) {
+        err = i2c_master_transmit_receive(dev->handle, tx, tx_len, rx, rx_len,
+                                          I2C_XFER_TIMEOUT_MS);
+    } else if (tx_len) {
+        err = i2c_master_transmit(dev->handle, tx, tx_len, I2C_XFER_TIMEOUT_MS);
+    } else {
+        err = i2c_master_receive(dev->handle, rx, rx_len, I2C_XFER_TIMEOUT_MS);
+    }
+
+    if (err == ESP_OK) {
+        dev->failures = 0;
+    } else if (++dev->failures >= I2C_RECOVER_AFTER) {
+        i2c_bus_recover_locked(dev);
     }
+
+    xSemaphoreGive(s_i2c_lock);
     return err;
 }
 #endif
@@ -1432,8 +4317,15 @@ static esp_err_t i2c_bus_init(void) {
  *
  * ADDRESS: 0x23 when ADDR is tied LOW (default), 0x5C when ADDR is tied HIGH.
  *
- * MODE:    Continuous high-resolution mode (1 lux resolution, ~120 ms/sample).
- *          Reading returns a big-endian 16-bit count; lux = count / 1.2.
+ * MODE:    Adaptive. Far from the close/reopen thresholds the sensor runs in
+ *          continuous L-resolution mode (~16 ms/sample, 4 count steps) with
+ *          MTreg 31, whose ~121 klux full scale does not saturate in direct
+ *          sun, and is polled every LUX_POLL_MS. Within a quarter of the
+ *          threshold that can fire next it switches to continuous
+ *          H-resolution mode with the finest MTreg that still covers the
+ *          thresholds, and is polled every LUX_FAST_POLL_MS. A saturated
+ *          fine-mode sample drops straight back to the wide range.
+ *          Reading returns a big-endian 16-bit count; lux = count / 1.2 * 69 / MTreg.
  *
  * USE:     Bright sun closes the sunshade for shade; once the light drops below
  *          the reopen threshold the previous position is restored. The same
@@ -1441,70 +4333,186 @@ static esp_err_t i2c_bus_init(void) {
  */
 #define BH1750_CMD_POWER_ON      0x01
 #define BH1750_CMD_CONT_HRES     0x10
+#define BH1750_CMD_CONT_LRES     0x13
+#define BH1750_CMD_MTREG_HI      0x40   // | MTreg[7:5]
+#define BH1750_CMD_MTREG_LO      0x60   // | MTreg[4:0]
 
-static void lux_task(void *arg) {
-    i2c_device_config_t dev_cfg = {
-        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
-        .device_address  = LUX_I2C_ADDR,
-        .scl_speed_hz    = 100000,
-    };
+static bool    s_lux_fast        = false;   // H-res near a threshold
+static uint8_t s_lux_fast_mtreg  = BH1750_MTREG_DEFAULT;
 
-    i2c_master_dev_handle_t dev = NULL;
-    if (i2c_master_bus_add_device(s_i2c_bus, &dev_cfg, &dev) != ESP_OK) {
-        ESP_LOGE(TAG_LUX, "BH1750 not added at 0x%02X; lux task disabled", LUX_I2C_ADDR);
-        vTaskDelete(NULL);
-        return;
+static uint8_t lux_mode_mtreg(bool fast) {
+    return fast ? s_lux_fast_mtreg : BH1750_MTREG_MIN;
+}
+
+// MTreg (two single-byte commands) followed by the measurement mode.
+static void bh1750_mode_cmds(bool fast, uint8_t cmds[3]) {
+    uint8_t mt = lux_mode_mtreg(fast);
+    cmds[0] = (uint8_t)(BH1750_CMD_MTREG_HI | (mt >> 5));
+    cmds[1] = (uint8_t)(BH1750_CMD_MTREG_LO | (mt & 0x1F));
+    cmds[2] = fast ? BH1750_CMD_CONT_HRES : BH1750_CMD_CONT_LRES;
+}
+
+static esp_err_t bh1750_setup(i2c_dev_t *dev) {
+    uint8_t cmds[4] = { BH1750_CMD_POWER_ON };
+    bh1750_mode_cmds(s_lux_fast, &cmds[1]);
+    for (size_t i = 0; i < sizeof(cmds); i++) {
+        esp_err_t err = i2c_dev_write_locked(dev, &cmds[i], 1);
+        if (err != ESP_OK) return err;
+    }
+    return ESP_OK;
+}
+
+static i2c_dev_t s_lux_dev = { .name = "BH1750", .addr = LUX_I2C_ADDR, .setup = bh1750_setup };
+static int       s_lux     = 0;
+
+static bool lux_set_mode(bool fast) {
+    uint8_t cmds[3];
+    bh1750_mode_cmds(fast, cmds);
+    for (size_t i = 0; i < sizeof(cmds); i++) {
+        if (i2c_dev_xfer(&s_lux_dev, &cmds[i], 1, NULL, 0) != ESP_OK) {
+            return false;
+        }
+    }
+    s_lux_fast = fast;
+    ESP_LOGI(TAG_LUX, "%s mode, MTreg %u, poll %d ms",
+             fast ? "H-res" : "L-res", lux_mode_mtreg(fast),
+             fast ? LUX_FAST_POLL_MS : LUX_POLL_MS);
+    return true;
+}
+
+static esp_err_t lux_sensor_init(void) {
+    if (s_i2c_bus == NULL) {
+        ESP_LOGE(TAG_LUX, "I2C bus unavailable; lux sensor disabled");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    uint8_t cmd = BH1750_CMD_POWER_ON;
-    bool ok = (i2c_master_transmit(dev, &cmd, 1, 1000) == ESP_OK);
-    cmd = BH1750_CMD_CONT_HRES;
-    ok = ok && (i2c_master_transmit(dev, &cmd, 1, 1000) == ESP_OK);
-    if (!ok) {
+    // Fine mode only has to resolve the thresholds, with 25 % headroom.
+    int top = LUX_CLOSE_LUX > LUX_REOPEN_LUX ? LUX_CLOSE_LUX : LUX_REOPEN_LUX;
+    s_lux_fast_mtreg = bh1750_mtreg_for_lux(top + top / 4);
+    s_lux_fast       = false;
+
+    if (i2c_dev_add(&s_lux_dev) != ESP_OK) {
         ESP_LOGE(TAG_LUX, "BH1750 not responding at 0x%02X; check wiring/address",
                  LUX_I2C_ADDR);
-        i2c_master_bus_rm_device(dev);
-        vTaskDelete(NULL);
-        return;
+        return ESP_ERR_NOT_FOUND;
     }
 
     ESP_LOGI(TAG_LUX,
-             "BH1750 ready: addr 0x%02X | close >= %d lux | reopen < %d lux | poll %d ms",
-             LUX_I2C_ADDR, LUX_CLOSE_LUX, LUX_REOPEN_LUX, LUX_POLL_MS);
+             "BH1750 ready: addr 0x%02X | close >= %d lux | reopen < %d lux | poll %d/%d ms",
+             LUX_I2C_ADDR, LUX_CLOSE_LUX, LUX_REOPEN_LUX, LUX_POLL_MS, LUX_FAST_POLL_MS);
+    return ESP_OK;
+}
 
-    for (;;) {
-        vTaskDelay(pdMS_TO_TICKS(LUX_POLL_MS));
+static bool lux_sensor_sample(void) {
+    uint8_t raw[2] = {0};
+    if (i2c_dev_xfer(&s_lux_dev, NULL, 0, raw, sizeof(raw)) != ESP_OK) {
+        ESP_LOGW(TAG_LUX, "BH1750 read failed");
+        return false;
+    }
 
-        uint8_t raw[2] = {0};
-        if (i2c_master_receive(dev, raw, sizeof(raw), 1000) != ESP_OK) {
-            ESP_LOGW(TAG_LUX, "BH1750 read failed");
-            continue;
-        }
+    uint16_t count = (uint16_t)((raw[0] << 8) | raw[1]);
+    s_lux = bh1750_raw_to_lux_mt(count, lux_mode_mtreg(s_lux_fast));
+
+    evlog_put(EV_LUX, s_lux, count, lux_mode_mtreg(s_lux_fast), 0);
+    tele_put(TELE_LUX, s_lux);
 
-        uint16_t count = (uint16_t)((raw[0] << 8) | raw[1]);
-        int lux = bh1750_raw_to_lux(count);
+    // A mode change takes effect from the next conversion (<= 180 ms), well
+    // before the next poll. On failure the old mode simply stays in use.
+    bool fast = count < BH1750_RAW_MAX &&
+                lux_near_threshold(protection_active(PROT_LUX), s_lux, LUX_CLOSE_LUX, LUX_REOPEN_LUX);
+    if (fast != s_lux_fast) {
+        lux_set_mode(fast);
+    }
+    return true;
+}
+
+#ifdef CONFIG_SUNSHADE_SUN_SCHEDULE
+// Sun exposure plan (see sunshade_logic.h). The sensor task rebuilds it every
+// SUN_REPLAN_S for the next SUN_PLAN_S; a rebuild is a few hundred sun
+// positions in double precision, on the order of 100 ms, four times a day.
+static const sun_site_t s_sun_site = {
+    .lat_cdeg   = CONFIG_SUNSHADE_SUN_LAT_CDEG,
+    .lon_cdeg   = CONFIG_SUNSHADE_SUN_LON_CDEG,
+    .facade_az  = CONFIG_SUNSHADE_SUN_FACADE_AZ,
+    .half_width = CONFIG_SUNSHADE_SUN_HALF_WIDTH,
+    .min_elev   = CONFIG_SUNSHADE_SUN_MIN_ELEV,
+};
+static sun_schedule_t s_sun_plan;           // sensor task only
 
-        ESP_LOGI(TAG_LUX, "%d lux (raw=%u)", lux, count);
+// Seconds since the epoch, or 0 until SNTP has set the clock.
+static uint32_t sun_clock(void) {
+    time_t t = time(NULL);
+    return (t >= (time_t)SUN_TIME_VALID) ? (uint32_t)t : 0;
+}
 
-        // Publish to HomeKit (clamped to the HAP valid range 0.0001–100000 lux).
-        float hk_lux = (lux < 1) ? 0.0001f : (float)lux;
-        cur_lux_ch.value = HOMEKIT_FLOAT(hk_lux);
-        homekit_characteristic_notify(&cur_lux_ch, cur_lux_ch.value);
+static void sun_plan_update(uint32_t now) {
+    if (s_sun_plan.to != 0 && now >= s_sun_plan.from && now - s_sun_plan.from < SUN_REPLAN_S) {
+        return;
+    }
+    sun_schedule_build(&s_sun_plan, &s_sun_site, now, SUN_PLAN_S);
 
-        sensor_action_t act = sensor_hysteresis(s_lux_closed, lux,
-                                                LUX_CLOSE_LUX, LUX_REOPEN_LUX);
-        if (act == SENSOR_TRIGGER_CLOSE) {
-            ESP_LOGW(TAG_LUX, "Light %d lux >= %d lux: closing for sun protection",
-                     lux, LUX_CLOSE_LUX);
-            s_lux_saved_pos = s_tgt_pos;
-            s_lux_closed    = true;
-            sunshade_close();
-        } else if (act == SENSOR_TRIGGER_REOPEN) {
-            ESP_LOGI(TAG_LUX, "Light %d lux < %d lux: restoring to %d%%",
-                     lux, LUX_REOPEN_LUX, s_lux_saved_pos);
-            s_lux_closed = false;
-            sunshade_move_to(s_lux_saved_pos);
-        }
+    if (s_sun_plan.count == 0) {
+        ESP_LOGI(TAG_LUX, "Sun plan: no sun on the facade in the next 24 h");
+    }
+    for (int i = 0; i < s_sun_plan.count; i++) {
+        time_t    a = s_sun_plan.w[i].start, b = s_sun_plan.w[i].end;
+        struct tm ta, tb;
+        gmtime_r(&a, &ta);
+        gmtime_r(&b, &tb);
+        ESP_LOGI(TAG_LUX, "Sun plan: on the facade %02d:%02d-%02d:%02d UTC",
+                 ta.tm_hour, ta.tm_min, tb.tm_hour, tb.tm_min);
+    }
+}
+#endif
+
+// With the sun plan, the sensor confirms predicted sun rather than looking
+// for it: fast polls from SUN_LEAD_S before a window until its end, rare polls
+// outside, timed to wake for the next window. The readings still decide: near
+// a threshold, with sun protection active or without a clock, the period is
+// the plain adaptive one.
+static uint32_t lux_sensor_period(void) {
+    uint32_t period = s_lux_fast ? LUX_FAST_POLL_MS : LUX_POLL_MS;
+#ifdef CONFIG_SUNSHADE_SUN_SCHEDULE
+    uint32_t now = sun_clock();
+    uint32_t until;
+
+    if (now == 0 || s_lux_fast || protection_active(PROT_LUX)) {
+        return period;
+    }
+    sun_plan_update(now);
+    if (sun_schedule_active(&s_sun_plan, now, SUN_LEAD_S, &until)) {
+        return LUX_FAST_POLL_MS;
+    }
+    uint64_t wait_ms = (uint64_t)until * 1000u;
+    if (wait_ms >= SUN_IDLE_POLL_MS) {
+        return SUN_IDLE_POLL_MS;
+    }
+    return (wait_ms > LUX_FAST_POLL_MS) ? (uint32_t)wait_ms : LUX_FAST_POLL_MS;
+#else
+    return period;
+#endif
+}
+
+static void lux_sensor_publish(void) {
+    // Clamped to the HAP valid range 0.0001–100000 lux.
+    float hk_lux = (s_lux < 1) ? 0.0001f : (float)s_lux;
+    cur_lux_ch.value = HOMEKIT_FLOAT(hk_lux);
+    homekit_characteristic_notify(&cur_lux_ch, cur_lux_ch.value);
+}
+
+static void lux_sensor_protect(void) {
+    int lux = s_lux;
+
+    sensor_action_t act = sensor_hysteresis(protection_active(PROT_LUX), lux,
+                                            LUX_CLOSE_LUX, LUX_REOPEN_LUX);
+    if (act == SENSOR_TRIGGER_CLOSE) {
+        ESP_LOGW(TAG_LUX, "Light %d lux >= %d lux: closing for sun protection",
+                 lux, LUX_CLOSE_LUX);
+        protection_set(PROT_LUX, true);
+    } else if (act == SENSOR_TRIGGER_REOPEN) {
+        ESP_LOGI(TAG_LUX, "Light %d lux < %d lux: releasing sun protection",
+                 lux, LUX_REOPEN_LUX);
+        protection_set(PROT_LUX, false);
     }
 }
 #endif
@@ -1516,73 +4524,188 @@ static void lux_task(void *arg) {
  *
  * BUS:     Shared I2C bus. VCC = 3.3 V, GND = GND.
  * ADDRESS: 0x44 when ADDR is tied LOW (default), 0x45 when tied HIGH.
- * READ:    Single-shot, high repeatability, clock stretching disabled (0x2400).
- *          Wait ~20 ms, then read 6 bytes: temp[MSB,LSB,CRC], hum[MSB,LSB,CRC].
- *          Each 16-bit word is CRC-8 protected (poly 0x31, init 0xFF).
+ * MODE:    Periodic acquisition, high repeatability, 2 measurements/s (0x2236),
+ *          started after a break (0x3093) in case a warm reset left the sensor
+ *          in another periodic mode. At 1 mps a fetch on the shortest poll
+ *          period (1000 ms) would now and then beat the next sample and be
+ *          NACKed, which the bus manager counts towards a bus reset; 2 mps
+ *          keeps a fresh sample ready despite scheduler jitter.
+ * READ:    Fetch data (0xE000), then 6 bytes: temp[MSB,LSB,CRC], hum[MSB,LSB,CRC]
+ *          — the latest result is already latched, so there is no conversion
+ *          wait. Each 16-bit word is CRC-8 protected (poly 0x31, init 0xFF).
+ *          The sensor NACKs a fetch if no new sample is ready yet.
  *
  * USE:     Display only — published as HomeKit Temperature and Humidity sensors.
  *          The readings never move the sunshade.
  */
-#define SHT3X_CMD_MEAS_HIGH_MSB  0x24
-#define SHT3X_CMD_MEAS_HIGH_LSB  0x00
+static const uint8_t SHT3X_CMD_BREAK[2]         = { 0x30, 0x93 };
+static const uint8_t SHT3X_CMD_PERIODIC_2MPS[2] = { 0x22, 0x36 };
+static const uint8_t SHT3X_CMD_FETCH[2]         = { 0xE0, 0x00 };
+
+static esp_err_t sht3x_setup(i2c_dev_t *dev) {
+    // A sensor already idle may NACK the break; only the start must succeed.
+    i2c_dev_write_locked(dev, SHT3X_CMD_BREAK, sizeof(SHT3X_CMD_BREAK));
+    vTaskDelay(pdMS_TO_TICKS(10) + 1);   // break needs >= 1 ms before the next command
+    return i2c_dev_write_locked(dev, SHT3X_CMD_PERIODIC_2MPS, sizeof(SHT3X_CMD_PERIODIC_2MPS));
+}
 
-static void temp_task(void *arg) {
-    i2c_device_config_t dev_cfg = {
-        .dev_addr_length = I2C_ADDR_BIT_LEN_7,
-        .device_address  = TEMP_I2C_ADDR,
-        .scl_speed_hz    = 100000,
-    };
+static i2c_dev_t s_temp_dev  = { .name = "SHT3x", .addr = TEMP_I2C_ADDR, .setup = sht3x_setup };
+static float     s_temp_c    = 0.0f;
+static float     s_humid_pct = 0.0f;
 
-    i2c_master_dev_handle_t dev = NULL;
-    if (i2c_master_bus_add_device(s_i2c_bus, &dev_cfg, &dev) != ESP_OK) {
-        ESP_LOGE(TAG_TEMP, "SHT3x not added at 0x%02X; temp task disabled", TEMP_I2C_ADDR);
-        vTaskDelete(NULL);
-        return;
+static esp_err_t temp_sensor_init(void) {
+    if (s_i2c_bus == NULL) {
+        ESP_LOGE(TAG_TEMP, "I2C bus unavailable; temp/humidity sensor disabled");
+        return ESP_ERR_INVALID_STATE;
     }
 
-    ESP_LOGI(TAG_TEMP, "SHT3x ready: addr 0x%02X | poll %d ms", TEMP_I2C_ADDR, TEMP_POLL_MS);
+    if (i2c_dev_add(&s_temp_dev) != ESP_OK) {
+        ESP_LOGE(TAG_TEMP, "SHT3x not responding at 0x%02X; temp sensor disabled",
+                 TEMP_I2C_ADDR);
+        return ESP_ERR_NOT_FOUND;
+    }
 
-    for (;;) {
-        vTaskDelay(pdMS_TO_TICKS(TEMP_POLL_MS));
+    ESP_LOGI(TAG_TEMP, "SHT3x ready: addr 0x%02X | periodic 2 mps | poll %d ms",
+             TEMP_I2C_ADDR, TEMP_POLL_MS);
+    return ESP_OK;
+}
 
-        uint8_t cmd[2] = { SHT3X_CMD_MEAS_HIGH_MSB, SHT3X_CMD_MEAS_HIGH_LSB };
-        if (i2c_master_transmit(dev, cmd, sizeof(cmd), 1000) != ESP_OK) {
-            ESP_LOGW(TAG_TEMP, "SHT3x measure command failed");
-            continue;
-        }
+static bool temp_sensor_sample(void) {
+    uint8_t raw[6] = {0};
+    if (i2c_dev_xfer(&s_temp_dev, SHT3X_CMD_FETCH, sizeof(SHT3X_CMD_FETCH),
+                     raw, sizeof(raw)) != ESP_OK) {
+        ESP_LOGW(TAG_TEMP, "SHT3x fetch failed");
+        return false;
+    }
 
-        // High-repeatability conversion takes up to 15 ms; allow margin.
-        vTaskDelay(pdMS_TO_TICKS(20));
+    if (sensirion_crc8(raw[0], raw[1]) != raw[2] ||
+        sensirion_crc8(raw[3], raw[4]) != raw[5]) {
+        ESP_LOGW(TAG_TEMP, "SHT3x CRC mismatch; discarding sample");
+        return false;
+    }
 
-        uint8_t raw[6] = {0};
-        if (i2c_master_receive(dev, raw, sizeof(raw), 1000) != ESP_OK) {
-            ESP_LOGW(TAG_TEMP, "SHT3x read failed");
-            continue;
-        }
+    uint16_t t_raw = (uint16_t)((raw[0] << 8) | raw[1]);
+    uint16_t h_raw = (uint16_t)((raw[3] << 8) | raw[4]);
 
-        if (sensirion_crc8(raw[0], raw[1]) != raw[2] ||
-            sensirion_crc8(raw[3], raw[4]) != raw[5]) {
-            ESP_LOGW(TAG_TEMP, "SHT3x CRC mismatch; discarding sample");
-            continue;
+    s_temp_c    = sht3x_raw_to_celsius(t_raw);
+    s_humid_pct = sht3x_raw_to_humidity(h_raw);
+
+    // Recorded in tenths (the console format avoids %f, which newlib
+    // nano-format omits).
+    int32_t t10 = (int32_t)(s_temp_c * 10.0f);
+    int32_t h10 = (int32_t)(s_humid_pct * 10.0f);
+    evlog_put(EV_TEMP, t10, h10, 0, 0);
+    tele_put(TELE_TEMP, t10);
+    tele_put(TELE_HUMID, h10);
+    return true;
+}
+
+static void temp_sensor_publish(void) {
+    cur_temp_ch.value  = HOMEKIT_FLOAT(s_temp_c);
+    cur_humid_ch.value = HOMEKIT_FLOAT(s_humid_pct);
+    homekit_characteristic_notify(&cur_temp_ch, cur_temp_ch.value);
+    homekit_characteristic_notify(&cur_humid_ch, cur_humid_ch.value);
+}
+#endif
+
+// ── Sensor scheduler ──────────────────────────────────────────────────────────
+// One cooperative task services every enabled sensor from a descriptor table
+// instead of one mostly-sleeping FreeRTOS task (and stack) per sensor. Each
+// entry has its own period; entries that fall due within SENSOR_BATCH_MS of
+// each other are serviced in the same wake-up. Deadlines advance from the
+// previous due time rather than from "now", so the periods stay phase-locked
+// and sensors with related periods keep sharing wake-ups.
+#ifdef SUNSHADE_USE_SENSORS
+typedef struct {
+    const char *name;
+    uint32_t    period_ms;
+    esp_err_t (*init)(void);      // NULL = nothing to set up
+    bool      (*sample)(void);    // take a reading; false skips publish/protect
+    void      (*publish)(void);   // HomeKit update, NULL if none
+    void      (*protect)(void);   // protection hysteresis, NULL if display-only
+    uint32_t  (*period)(void);    // adaptive period, NULL = fixed period_ms
+} sensor_desc_t;
+
+static const sensor_desc_t s_sensors[] = {
+#ifdef CONFIG_WIND_SENSOR_ENABLE
+    { "wind", WIND_POLL_MS, wind_sensor_init, wind_sensor_sample, NULL, wind_sensor_protect, NULL },
+#endif
+#ifdef CONFIG_RAIN_SENSOR_ENABLE
+    { "rain", RAIN_POLL_MS, rain_sensor_init, rain_sensor_sample, NULL, rain_sensor_protect, NULL },
+#endif
+#ifdef CONFIG_LUX_SENSOR_ENABLE
+    { "lux",  LUX_POLL_MS,  lux_sensor_init,  lux_sensor_sample,  lux_sensor_publish, lux_sensor_protect,
+      lux_sensor_period },
+#endif
+#ifdef CONFIG_TEMP_SENSOR_ENABLE
+    { "temp", TEMP_POLL_MS, temp_sensor_init, temp_sensor_sample, temp_sensor_publish, NULL, NULL },
+#endif
+};
+
+#define SENSOR_COUNT        (sizeof(s_sensors) / sizeof(s_sensors[0]))
+#define SENSOR_BATCH_MS     50
+
+static void sensor_task(void *arg) {
+    uint32_t due[SENSOR_COUNT];
+    bool     live[SENSOR_COUNT];
+    int      live_count = 0;
+
+#ifdef SUNSHADE_USE_I2C
+    // Bring up the shared I2C bus once before any I2C sensor is initialised.
+    i2c_bus_init();
+#endif
+
+    uint32_t now = now_ms();
+    for (size_t i = 0; i < SENSOR_COUNT; i++) {
+        const sensor_desc_t *d = &s_sensors[i];
+        live[i] = (d->init == NULL || d->init() == ESP_OK);
+        due[i]  = now + d->period_ms;
+        live_count += live[i] ? 1 : 0;
+    }
+
+    if (live_count == 0) {
+        // Park rather than delete: s_task_handle[TASK_SENSORS] stays valid
+        // for the stack report, and the static stack and TCB are never freed.
+        ESP_LOGW(TAG, "Sensor scheduler: no sensor initialised; idle");
+        for (;;) {
+            vTaskSuspend(NULL);
         }
+    }
+    ESP_LOGI(TAG, "Sensor scheduler: %d of %d sensors active", live_count, (int)SENSOR_COUNT);
+
+    for (;;) {
+        now = now_ms();
 
-        uint16_t t_raw = (uint16_t)((raw[0] << 8) | raw[1]);
-        uint16_t h_raw = (uint16_t)((raw[3] << 8) | raw[4]);
+        int32_t soonest = INT32_MAX;
+        for (size_t i = 0; i < SENSOR_COUNT; i++) {
+            if (live[i] && (int32_t)(due[i] - now) < soonest) {
+                soonest = (int32_t)(due[i] - now);
+            }
+        }
+        if (soonest > 0) {
+            vTaskDelay(pdMS_TO_TICKS((uint32_t)soonest));
+            now = now_ms();
+        }
 
-        float temp_c   = sht3x_raw_to_celsius(t_raw);
-        float humid_pct = sht3x_raw_to_humidity(h_raw);
+        for (size_t i = 0; i < SENSOR_COUNT; i++) {
+            const sensor_desc_t *d = &s_sensors[i];
+            if (!live[i] || (int32_t)(due[i] - now) > SENSOR_BATCH_MS) {
+                continue;
+            }
 
-        // Integer-formatted log (avoids %f, which newlib nano-format omits).
-        int t_tenths = (int)(temp_c * 10.0f);
-        int h_tenths = (int)(humid_pct * 10.0f);
-        ESP_LOGI(TAG_TEMP, "%d.%d C, %d.%d %%RH",
-                 t_tenths / 10, (t_tenths < 0 ? -t_tenths : t_tenths) % 10,
-                 h_tenths / 10, h_tenths % 10);
+            if (d->sample()) {
+                if (d->publish) d->publish();
+                if (d->protect) d->protect();
+            }
 
-        cur_temp_ch.value  = HOMEKIT_FLOAT(temp_c);
-        cur_humid_ch.value = HOMEKIT_FLOAT(humid_pct);
-        homekit_characteristic_notify(&cur_temp_ch, cur_temp_ch.value);
-        homekit_characteristic_notify(&cur_humid_ch, cur_humid_ch.value);
+            uint32_t period = d->period ? d->period() : d->period_ms;
+            due[i] += period;
+            if ((int32_t)(due[i] - now) <= 0) {
+                // Fell more than a period behind (slow bus); resynchronise.
+                ESP_LOGD(TAG, "Sensor %s overran its period", d->name);
+                due[i] = now + period;
+            }
+        }
     }
 }
 #endif
@@ -1592,16 +4715,38 @@ void app_main(void) {
     ESP_ERROR_CHECK(lifecycle_nvs_init());
     lifecycle_log_post_reset_state("INFORMATION");
     ESP_ERROR_CHECK(lifecycle_configure_homekit(&revision, &ota_trigger, "INFORMATION"));
+    ota_trigger.setter_ex = ota_trigger_setter;
 
+    power_init();
     gpio_init_all();
+#ifdef CONFIG_SUNSHADE_CURRENT_SENSE
+    current_sense_init();
+#endif
+    homekit_notify_init();
+    latency_init();
+    task_report_init();
+#ifdef CONFIG_SUNSHADE_TELEMETRY
+    tele_history_init();
+#endif
+
+    journal_record_t last[SHADE_CHANNELS];
+    bool             have_last[SHADE_CHANNELS];
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        have_last[i] = shade_nvs_load(&s_shades[i], &last[i]);
+    }
 
-    nvs_load_calibration();
+    journal_start();
+    motion_engine_start();
 
     ttp_init();
 
-    if (xTaskCreate(ttp_task, "ttp_task", 4096, NULL, 5, NULL) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create TTP task");
-    }
+    task_start(TASK_JOB, shade_job_task);
+    task_start(TASK_LED, led_task);
+    task_start(TASK_EVLOG, evlog_task);
+#ifdef CONFIG_SUNSHADE_OTA_BACKGROUND
+    task_start(TASK_OTA, ota_task);
+#endif
+    task_start(TASK_TTP, ttp_task);
 
     // Physical lifecycle button.
     // Wiring: GND -> button -> GPIO25.
@@ -1627,53 +4772,36 @@ void app_main(void) {
         ESP_LOGE(TAG_BUTTON, "Failed to init button on GPIO%d", BUTTON_GPIO);
     }
 
-    if (s_cal_done) {
-        uint8_t last_pos = nvs_load_last_position();
-        ESP_LOGI(TAG, "Calibrated: starting homing sequence (last pos: %d%%)", last_pos);
-        if (xTaskCreate(homing_task, "homing", 4096,
-                        (void *)(uintptr_t)last_pos, 4, NULL) != pdPASS) {
-            ESP_LOGE(TAG, "Failed to create homing task");
+    // Shades that cannot fast boot are homed together by one task.
+    uint32_t homing_mask = 0;
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        shade_t *sh = &s_shades[i];
+
+        if (sh->cal_done && have_last[i] && fast_boot_restore(sh, &last[i])) {
+            ESP_LOGI(TAG, "Shade %d calibrated: homing skipped", i + 1);
+        } else if (sh->cal_done) {
+            sh->boot_target = last[i].target;
+            homing_mask    |= 1u << i;
+            ESP_LOGI(TAG, "Shade %d calibrated: homing (last pos: %d%%)", i + 1, sh->boot_target);
+        } else {
+            ESP_LOGW(TAG, "Shade %d not calibrated: skipping homing.", i + 1);
         }
-    } else {
-        ESP_LOGW(TAG, "Not calibrated: skipping homing.");
-        ESP_LOGW(TAG, "Hold STOP touch pad for 3 s to start calibration.");
-    }
-
-#ifdef CONFIG_WIND_SENSOR_ENABLE
-    if (xTaskCreate(wind_task, "wind_task", 3072, NULL, 3, NULL) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create wind task");
     }
-#endif
 
-#ifdef CONFIG_RAIN_SENSOR_ENABLE
-    if (xTaskCreate(rain_task, "rain_task", 2048, NULL, 3, NULL) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create rain task");
+    if (homing_mask != 0) {
+        s_is_homing = true;     // no command or calibration before the job runs
+        xTaskNotify(s_task_handle[TASK_JOB], homing_mask, eSetBits);
     }
-#endif
-
-#ifdef SUNSHADE_USE_I2C
-    // Bring up the shared I2C bus once before any I2C sensor task starts.
-    bool i2c_ready = (i2c_bus_init() == ESP_OK);
-#endif
 
-#ifdef CONFIG_LUX_SENSOR_ENABLE
-    if (i2c_ready) {
-        if (xTaskCreate(lux_task, "lux_task", 3072, NULL, 3, NULL) != pdPASS) {
-            ESP_LOGE(TAG, "Failed to create lux task");
+    for (int i = 0; i < SHADE_CHANNELS; i++) {
+        if (!s_shades[i].cal_done) {
+            ESP_LOGW(TAG, "Hold STOP touch pad for 3 s to start calibration.");
+            break;
         }
-    } else {
-        ESP_LOGE(TAG, "I2C bus unavailable; lux sensor disabled");
     }
-#endif
 
-#ifdef CONFIG_TEMP_SENSOR_ENABLE
-    if (i2c_ready) {
-        if (xTaskCreate(temp_task, "temp_task", 3072, NULL, 3, NULL) != pdPASS) {
-            ESP_LOGE(TAG, "Failed to create temp task");
-        }
-    } else {
-        ESP_LOGE(TAG, "I2C bus unavailable; temp/humidity sensor disabled");
-    }
+#ifdef SUNSHADE_USE_SENSORS
+    task_start(TASK_SENSORS, sensor_task);
 #endif
 
     esp_err_t wifi_err = wifi_start(on_wifi_ready);
@@ -12,6 +12,9 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <math.h>
 
 // ── Relay level mapping ─────────────────────────────────────────────────────
 // Translate a desired ON/OFF state into the GPIO level to write, honouring the
@@ -30,13 +33,307 @@ static inline int clamp_position(int pos) {
     return pos;
 }
 
-// Percentage of travel covered in one movement tick of tick_ms, given the full
-// travel time travel_ms. Used by the time-based position estimator.
-static inline float position_delta_per_tick(uint32_t travel_ms, uint32_t tick_ms) {
+// ── Fixed-point position model ──────────────────────────────────────────────
+// Position is tracked in parts per million of full travel (0 = closed,
+// POS_PPM_FULL = fully open). Within a segment the position is derived from
+// the microseconds elapsed since the relay closed rather than accumulated from
+// per-tick deltas, and a segment that runs to its target lands exactly on it.
+// The only rounding is one truncation (< 1 ppm) when a move is interrupted, so
+// the drift between homings stays below 1 ppm per interrupted move instead of
+// up to 1 % per move when the start of each segment was an integer percent.
+#define POS_PPM_FULL     1000000
+#define POS_PPM_PER_PCT  10000
+
+static inline int32_t pos_clamp_ppm(int32_t ppm) {
+    if (ppm < 0)            return 0;
+    if (ppm > POS_PPM_FULL) return POS_PPM_FULL;
+    return ppm;
+}
+
+static inline int32_t pos_pct_to_ppm(int pct) {
+    return (int32_t)clamp_position(pct) * POS_PPM_PER_PCT;
+}
+
+// Reported (HomeKit) percent, rounded to nearest.
+static inline int pos_ppm_to_pct(int32_t ppm) {
+    return (int)((pos_clamp_ppm(ppm) + POS_PPM_PER_PCT / 2) / POS_PPM_PER_PCT);
+}
+
+// Per-mille, as stored in the position journal; rounded to nearest.
+static inline uint16_t pos_ppm_to_pm(int32_t ppm) {
+    return (uint16_t)((pos_clamp_ppm(ppm) + 500) / 1000);
+}
+
+// Travel covered after elapsed_us of driving, truncated, capped at full travel.
+static inline int32_t pos_ppm_travelled(int64_t elapsed_us, uint32_t travel_ms) {
+    if (elapsed_us <= 0) {
+        return 0;
+    }
     if (travel_ms == 0) {
         travel_ms = 1;
     }
-    return 100.0f * (float)tick_ms / (float)travel_ms;
+    int64_t ppm = elapsed_us * 1000 / (int64_t)travel_ms;
+    return (ppm > POS_PPM_FULL) ? POS_PPM_FULL : (int32_t)ppm;
+}
+
+// Drive time for a span, rounded up so pos_ppm_travelled(run) >= span.
+static inline int64_t pos_ppm_run_us(int32_t span_ppm, uint32_t travel_ms) {
+    int64_t span = (span_ppm < 0) ? -(int64_t)span_ppm : (int64_t)span_ppm;
+    return (span * (int64_t)travel_ms + 999) / 1000;
+}
+
+// Position elapsed_us into a segment from start towards target; the relays are
+// cut at the target, so the estimate never overshoots it.
+static inline int32_t pos_ppm_estimate(int32_t start_ppm, int32_t target_ppm,
+                                       int64_t elapsed_us, uint32_t travel_ms) {
+    int32_t moved = pos_ppm_travelled(elapsed_us, travel_ms);
+    if (target_ppm >= start_ppm) {
+        int32_t pos = start_ppm + moved;
+        return (pos > target_ppm) ? target_ppm : pos;
+    }
+    int32_t pos = start_ppm - moved;
+    return (pos < target_ppm) ? target_ppm : pos;
+}
+
+// ── Travel model ────────────────────────────────────────────────────────────
+// Shades rarely travel as fast in both directions: an awning closes faster,
+// pulled by gravity and its arm springs. The motor also takes a moment to
+// start turning once its relay has closed. A segment over span ppm therefore
+// takes lag_ms + span × (open_ms or close_ms) / POS_PPM_FULL.
+typedef struct {
+    uint32_t open_ms;    // full travel, closed -> open
+    uint32_t close_ms;   // full travel, open -> closed
+    uint32_t lag_ms;     // relay closed -> motor turning
+} travel_model_t;
+
+#define TRAVEL_LAG_MAX_MS      2000
+#define TRAVEL_LEARN_SPAN_MIN  (20 * POS_PPM_PER_PCT)   // shorter runs are mostly lag
+#define TRAVEL_LEARN_SHIFT     1                        // move half the way per run
+
+static inline uint32_t travel_ms(const travel_model_t *m, bool opening) {
+    return opening ? m->open_ms : m->close_ms;
+}
+
+// Position elapsed_us after the relay closed on a segment from start towards
+// target; the estimate holds at start until the lag has passed.
+static inline int32_t travel_estimate(const travel_model_t *m, int32_t start_ppm,
+                                      int32_t target_ppm, int64_t elapsed_us) {
+    return pos_ppm_estimate(start_ppm, target_ppm, elapsed_us - (int64_t)m->lag_ms * 1000,
+                            travel_ms(m, target_ppm >= start_ppm));
+}
+
+// Relay-on time for the segment from start to target, lag included.
+static inline int64_t travel_run_us(const travel_model_t *m, int32_t start_ppm,
+                                    int32_t target_ppm) {
+    return (int64_t)m->lag_ms * 1000 +
+           pos_ppm_run_us(target_ppm - start_ppm, travel_ms(m, target_ppm >= start_ppm));
+}
+
+// Refine the model from a run over span_ppm that reached the end stop
+// observed_ms after its relay closed. This is one normalised LMS step on the
+// two unknowns of that direction, lag and full travel time, with the covered
+// fraction as feature: full-travel runs alone cannot tell lag from speed, but
+// partial runs ending on an end stop can. Rejects runs shorter than
+// TRAVEL_LEARN_SPAN_MIN and observations more than 50 % off the prediction (a
+// stall, an obstruction, a missed end stop). Returns true if it learned.
+static inline bool travel_learn(travel_model_t *m, bool opening, int32_t span_ppm,
+                                uint32_t observed_ms) {
+    int64_t x = (span_ppm < 0) ? -(int64_t)span_ppm : (int64_t)span_ppm;
+    if (x < TRAVEL_LEARN_SPAN_MIN || x > POS_PPM_FULL) {
+        return false;
+    }
+
+    uint32_t *dir_ms = opening ? &m->open_ms : &m->close_ms;
+    int64_t   pred   = (int64_t)m->lag_ms + x * (int64_t)*dir_ms / POS_PPM_FULL;
+    int64_t   err    = (int64_t)observed_ms - pred;
+    if (pred <= 0 || 2 * (err < 0 ? -err : err) > pred) {
+        return false;
+    }
+
+    // err / (1 + x²), x in ppm: the denominator runs from 1 to 2 (× 10⁶).
+    int64_t den = ((int64_t)POS_PPM_FULL + x * x / POS_PPM_FULL) << TRAVEL_LEARN_SHIFT;
+    int64_t lag = (int64_t)m->lag_ms + err * POS_PPM_FULL / den;
+    int64_t ms  = (int64_t)*dir_ms + err * x / den;
+
+    m->lag_ms = (uint32_t)(lag < 0 ? 0 : lag > TRAVEL_LAG_MAX_MS ? TRAVEL_LAG_MAX_MS : lag);
+    *dir_ms   = (uint32_t)(ms < 1 ? 1 : ms);
+    return true;
+}
+
+// ── Relay driver ────────────────────────────────────────────────────────────
+// One shade's relay pair as a small state machine (OFF -> DEAD_TIME ->
+// ON_OPEN/ON_CLOSE) that enforces a dead time when reversing, so an AC
+// tubular motor is never switched straight from one direction to the other.
+// Pure: the caller owns the clock, the lock, the timer that ends a dead time
+// and the outputs, which follow relay_fsm_open()/relay_fsm_close().
+typedef enum {
+    MOTION_CLOSING = 0,
+    MOTION_OPENING = 1,
+    MOTION_STOPPED = 2,
+} motion_dir_t;
+
+typedef enum {
+    RELAY_OFF = 0,
+    RELAY_DEAD_TIME,    // both off, pending energised at due_us
+    RELAY_ON_OPEN,
+    RELAY_ON_CLOSE,
+} relay_state_t;
+
+typedef struct {
+    relay_state_t state;
+    motion_dir_t  dir;          // last energised direction, for the dead time
+    motion_dir_t  pending;
+    int64_t       off_us;       // when the motor was last cut
+    int64_t       due_us;       // end of the running dead time
+} relay_fsm_t;
+
+#define RELAY_FSM_INIT { RELAY_OFF, MOTION_STOPPED, MOTION_STOPPED, 0, 0 }
+
+static inline bool relay_fsm_on(const relay_fsm_t *r) {
+    return r->state == RELAY_ON_OPEN || r->state == RELAY_ON_CLOSE;
+}
+
+static inline bool relay_fsm_open(const relay_fsm_t *r) {
+    return r->state == RELAY_ON_OPEN;
+}
+
+static inline bool relay_fsm_close(const relay_fsm_t *r) {
+    return r->state == RELAY_ON_CLOSE;
+}
+
+static inline void relay_fsm_energise(relay_fsm_t *r, motion_dir_t dir) {
+    r->dir     = dir;
+    r->state   = (dir == MOTION_OPENING) ? RELAY_ON_OPEN : RELAY_ON_CLOSE;
+    r->pending = MOTION_STOPPED;
+}
+
+// Cutting during a dead time keeps the original off time, so the remaining
+// dead time is still honoured afterwards.
+static inline void relay_fsm_cut(relay_fsm_t *r, int64_t now_us) {
+    if (relay_fsm_on(r)) {
+        r->off_us = now_us;
+    }
+    r->state   = RELAY_OFF;
+    r->pending = MOTION_STOPPED;
+}
+
+// Drive in dir, or stop with MOTION_STOPPED. A reversal inside the dead time
+// leaves both relays off with dir pending; a newer request replaces the
+// pending direction, a stop cancels it. Returns the dead time left in µs
+// (0 = energised now, or stopped).
+static inline int64_t relay_fsm_request(relay_fsm_t *r, motion_dir_t dir, int64_t now_us,
+                                        int64_t dead_us) {
+    int64_t wait_us = 0;
+
+    if (dir == MOTION_STOPPED) {
+        relay_fsm_cut(r, now_us);
+        return 0;
+    }
+    if (relay_fsm_on(r) && r->dir == dir) {
+        return 0;
+    }
+    relay_fsm_cut(r, now_us);
+    if (r->dir != MOTION_STOPPED && r->dir != dir) {
+        wait_us = r->off_us + dead_us - now_us;
+    }
+    if (wait_us > 0) {
+        r->state   = RELAY_DEAD_TIME;
+        r->pending = dir;
+        r->due_us  = now_us + wait_us;
+        return wait_us;
+    }
+    relay_fsm_energise(r, dir);
+    return 0;
+}
+
+// End of a dead time: energises the pending direction once due_us has
+// passed. Returns true if it did; a stale call changes nothing.
+static inline bool relay_fsm_expire(relay_fsm_t *r, int64_t now_us) {
+    if (r->state != RELAY_DEAD_TIME || now_us < r->due_us) {
+        return false;
+    }
+    relay_fsm_energise(r, r->pending);
+    return true;
+}
+
+// ── Motion segments ─────────────────────────────────────────────────────────
+// A command either stops the shade where it is or starts a segment towards
+// its target; the segment starts when the relay closes and ends on one stop
+// deadline. A move to 0 % or 100 % runs ENDSTOP_OVERRUN_PCT of full travel
+// longer, so the shade really reaches its end stop even if the model is a
+// little fast.
+#define ENDSTOP_OVERRUN_PCT     20
+
+// Direction of a move from pos to target (both percent), or MOTION_STOPPED
+// if the command stops the shade where it is.
+static inline motion_dir_t motion_decide(bool stop, int pos, int target) {
+    if (stop || target == pos) {
+        return MOTION_STOPPED;
+    }
+    return (target > pos) ? MOTION_OPENING : MOTION_CLOSING;
+}
+
+// Relay-on time of the segment from start_ppm to target (percent), end-stop
+// overrun included; the stop deadline lies this long after the relay closed.
+static inline int64_t motion_run_us(const travel_model_t *m, int32_t start_ppm, int target) {
+    int64_t run_us = travel_run_us(m, start_ppm, pos_pct_to_ppm(target));
+
+    if (target == 0 || target == 100) {
+        run_us += (int64_t)travel_ms(m, target == 100) * ENDSTOP_OVERRUN_PCT * 10;
+    }
+    return run_us;
+}
+
+// ── Target settle window ────────────────────────────────────────────────────
+// HomeKit target writes settle for settle_ms before the relays are touched: a
+// slider drag or a scene delivers a stream of values and only the last one,
+// once the stream has paused, is driven. Every write restarts the window.
+typedef struct {
+    bool     pending;
+    int      target;        // percent
+    int64_t  cmd_us;        // when the settling write arrived (latency trace)
+    uint32_t t0_ms;         // start of the window
+} settle_window_t;
+
+static inline void settle_offer(settle_window_t *w, int target, int64_t cmd_us,
+                                uint32_t now_ms) {
+    w->pending = true;
+    w->target  = target;
+    w->cmd_us  = cmd_us;
+    w->t0_ms   = now_ms;
+}
+
+// Drops a settling target; returns true if there was one.
+static inline bool settle_cancel(settle_window_t *w) {
+    bool was = w->pending;
+    w->pending = false;
+    return was;
+}
+
+// Milliseconds until the settling target is due, 0 if it is, UINT32_MAX if
+// nothing is settling.
+static inline uint32_t settle_wait_ms(const settle_window_t *w, uint32_t now_ms,
+                                      uint32_t settle_ms) {
+    if (!w->pending) {
+        return UINT32_MAX;
+    }
+    uint32_t elapsed = now_ms - w->t0_ms;
+    return (elapsed >= settle_ms) ? 0 : settle_ms - elapsed;
+}
+
+// Takes the settling target once its window has run out. Returns true and
+// empties the window if it was due.
+static inline bool settle_take(settle_window_t *w, uint32_t now_ms, uint32_t settle_ms) {
+    if (settle_wait_ms(w, now_ms, settle_ms) != 0) {
+        return false;
+    }
+    w->pending = false;
+    return true;
+}
+
+// The latest user intent: a target still settling, else current.
+static inline int settle_intent(const settle_window_t *w, int current) {
+    return w->pending ? w->target : current;
 }
 
 // ── Generic high-value protection hysteresis ────────────────────────────────
@@ -61,6 +358,188 @@ static inline sensor_action_t sensor_hysteresis(bool closed, int value,
     return SENSOR_NO_ACTION;
 }
 
+// ── Protection arbiter ──────────────────────────────────────────────────────
+// Wind, rain and lux protection share one arbiter instead of each saving and
+// restoring its own position. The arbiter remembers a single user position
+// (taken when the first protection engages), drives the position of the
+// highest-priority active protection, and restores the user position only once
+// every protection has cleared. User moves while protected are not driven;
+// they replace the position to restore. Each update returns the position to
+// drive, or PROT_NO_MOVE when the effective target would not change, so
+// overlapping triggers never cost an extra motor cycle.
+typedef enum {
+    PROT_WIND = 0,      // highest priority
+    PROT_RAIN,
+    PROT_LUX,
+    PROT_COUNT,
+} prot_source_t;
+
+#define PROT_NO_MOVE  (-1)
+
+typedef struct {
+    uint8_t active;                 // bit per prot_source_t
+    int     user_pos;               // restored once no protection is active
+    int     hold_pos[PROT_COUNT];   // position each protection drives to
+} prot_arbiter_t;
+
+static inline void prot_init(prot_arbiter_t *a) {
+    a->active   = 0;
+    a->user_pos = 0;
+    for (int i = 0; i < PROT_COUNT; i++) {
+        a->hold_pos[i] = 0;         // every protection closes fully
+    }
+}
+
+static inline bool prot_is_active(const prot_arbiter_t *a, prot_source_t src) {
+    return (a->active & (1u << src)) != 0;
+}
+
+// Highest-priority active protection, or -1 when none is active.
+static inline int prot_owner(const prot_arbiter_t *a) {
+    for (int i = 0; i < PROT_COUNT; i++) {
+        if (a->active & (1u << i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline int prot_effective(const prot_arbiter_t *a) {
+    int owner = prot_owner(a);
+    return (owner < 0) ? a->user_pos : a->hold_pos[owner];
+}
+
+// Engage or release one protection. cur_target is the target the motion
+// engine is currently driving (or resting at); it seeds the user position on
+// the first engagement and suppresses moves that would not change anything.
+static inline int prot_update(prot_arbiter_t *a, prot_source_t src, bool engage,
+                              int cur_target) {
+    uint8_t bit = (uint8_t)(1u << src);
+    if (engage == ((a->active & bit) != 0)) {
+        return PROT_NO_MOVE;
+    }
+    if (engage && a->active == 0) {
+        a->user_pos = cur_target;
+    }
+    if (engage) {
+        a->active |= bit;
+    } else {
+        a->active &= (uint8_t)~bit;
+    }
+    int eff = prot_effective(a);
+    return (eff == cur_target) ? PROT_NO_MOVE : eff;
+}
+
+// A user move. Returns true if it may be driven now; while any protection is
+// active it only replaces the position to restore later.
+static inline bool prot_user_move(prot_arbiter_t *a, int target) {
+    if (a->active != 0) {
+        a->user_pos = target;
+        return false;
+    }
+    return true;
+}
+
+// Homing and calibration drop every move while they run, the protection moves
+// included, but the arbiter still records each engage and release. When such
+// a lockout ends, want is where it leaves or would restore the shade. While a
+// protection is active want becomes the position to restore, and the
+// protection's position is returned instead.
+static inline int prot_resume(prot_arbiter_t *a, int want) {
+    if (a->active != 0) {
+        a->user_pos = want;
+        return prot_effective(a);
+    }
+    return want;
+}
+
+// ── Streaming gust filter ───────────────────────────────────────────────────
+// Allocation-free rolling window over the last `window` samples with O(1)
+// (amortised) max and O(1) mean, plus an exponential moving average. The max
+// is kept in a monotonic deque of sample sequence numbers whose values are
+// strictly decreasing, so the front is always the window peak. Closing on the
+// window peak bounds the detection latency of a gust to one sample period.
+#define GUST_WINDOW_MAX  32
+
+typedef struct {
+    int      window;                    // samples per window, 1..GUST_WINDOW_MAX
+    int      count;                     // samples currently in the window
+    uint32_t seq;                       // total samples pushed
+    int32_t  samples[GUST_WINDOW_MAX];  // ring, indexed by seq % window
+    int64_t  sum;                       // sum of the samples in the window
+    uint32_t dq[GUST_WINDOW_MAX];       // max deque (sequence numbers), ring
+    int      dq_head;
+    int      dq_len;
+    int      alpha_q8;                  // EMA weight of a new sample, 1..256 / 256
+    int32_t  ema_q8;                    // EMA value × 256
+} gust_filter_t;
+
+static inline void gust_init(gust_filter_t *g, int window, int alpha_q8) {
+    if (window < 1)               window = 1;
+    if (window > GUST_WINDOW_MAX) window = GUST_WINDOW_MAX;
+    if (alpha_q8 < 1)             alpha_q8 = 1;
+    if (alpha_q8 > 256)           alpha_q8 = 256;
+
+    g->window   = window;
+    g->count    = 0;
+    g->seq      = 0;
+    g->sum      = 0;
+    g->dq_head  = 0;
+    g->dq_len   = 0;
+    g->alpha_q8 = alpha_q8;
+    g->ema_q8   = 0;
+}
+
+static inline void gust_push(gust_filter_t *g, int32_t value) {
+    int w = g->window;
+
+    // Drop the deque front once its sample has left the window.
+    if (g->dq_len > 0 && g->seq - g->dq[g->dq_head] >= (uint32_t)w) {
+        g->dq_head = (g->dq_head + 1) % GUST_WINDOW_MAX;
+        g->dq_len--;
+    }
+
+    int slot = (int)(g->seq % (uint32_t)w);
+    if (g->count == w) {
+        g->sum -= g->samples[slot];
+    } else {
+        g->count++;
+    }
+    g->samples[slot] = value;
+    g->sum          += value;
+
+    // Samples not larger than the new one can never be the peak again.
+    while (g->dq_len > 0) {
+        int      back = (g->dq_head + g->dq_len - 1) % GUST_WINDOW_MAX;
+        uint32_t idx  = g->dq[back];
+        if (g->samples[idx % (uint32_t)w] > value) {
+            break;
+        }
+        g->dq_len--;
+    }
+    g->dq[(g->dq_head + g->dq_len) % GUST_WINDOW_MAX] = g->seq;
+    g->dq_len++;
+
+    if (g->seq == 0) {
+        g->ema_q8 = value * 256;
+    } else {
+        g->ema_q8 += (int32_t)(((int64_t)value * 256 - g->ema_q8) * g->alpha_q8 / 256);
+    }
+    g->seq++;
+}
+
+static inline int32_t gust_max(const gust_filter_t *g) {
+    return (g->dq_len > 0) ? g->samples[g->dq[g->dq_head] % (uint32_t)g->window] : 0;
+}
+
+static inline int32_t gust_mean(const gust_filter_t *g) {
+    return (g->count > 0) ? (int32_t)(g->sum / g->count) : 0;
+}
+
+static inline int32_t gust_ema(const gust_filter_t *g) {
+    return g->ema_q8 / 256;
+}
+
 // ── Sensor conversions ──────────────────────────────────────────────────────
 // Convert divided ADC millivolts to wind speed in dm/s (1 dm/s = 0.1 m/s).
 static inline int wind_speed_ds(int mv, int full_scale_mv, int max_speed_ds) {
@@ -78,6 +557,49 @@ static inline int bh1750_raw_to_lux(uint16_t raw) {
     return (int)((float)raw / 1.2f + 0.5f);
 }
 
+// BH1750 measurement-time register (MTreg). At the default of 69 a count is
+// 1/1.2 lux; the sensitivity scales with MTreg/69, so a smaller MTreg widens
+// the range (31 -> ~121 klux full scale, enough for direct sun) at the cost of
+// resolution, and a larger one does the opposite.
+#define BH1750_MTREG_DEFAULT  69
+#define BH1750_MTREG_MIN      31
+#define BH1750_MTREG_MAX      254
+#define BH1750_RAW_MAX        65535
+
+// Convert a raw sample taken with the given MTreg to lux. L-resolution mode
+// uses the same scale, it only reports in coarser steps.
+static inline int bh1750_raw_to_lux_mt(uint16_t raw, uint8_t mtreg) {
+    if (mtreg < BH1750_MTREG_MIN) {
+        return 0;
+    }
+    return (int)((float)raw * (float)BH1750_MTREG_DEFAULT / (1.2f * (float)mtreg) + 0.5f);
+}
+
+// Largest (finest) MTreg whose full scale still covers max_lux. Full scale
+// is 65535 / 1.2 * 69 / MTreg lux; integer form avoids float rounding.
+static inline uint8_t bh1750_mtreg_for_lux(int max_lux) {
+    if (max_lux <= 0) {
+        return BH1750_MTREG_MAX;
+    }
+    uint32_t m = (uint32_t)BH1750_RAW_MAX * BH1750_MTREG_DEFAULT * 10u /
+                 (12u * (uint32_t)max_lux);
+    if (m < BH1750_MTREG_MIN) m = BH1750_MTREG_MIN;
+    if (m > BH1750_MTREG_MAX) m = BH1750_MTREG_MAX;
+    return (uint8_t)m;
+}
+
+// True when lux lies within a quarter of the threshold that can fire next:
+// the close threshold while open, the reopen threshold while closed. Used to
+// switch the light sensor into its fine, fast-polling mode only when a
+// protection decision is actually close.
+static inline bool lux_near_threshold(bool closed, int lux,
+                                      int close_lux, int reopen_lux) {
+    int thr    = closed ? reopen_lux : close_lux;
+    int margin = thr / 4;
+    int diff   = lux - thr;
+    return diff >= -margin && diff <= margin;
+}
+
 // ── SHT3x temperature / humidity conversions ────────────────────────────────
 // Sensirion SHT3x datasheet conversions for a raw 16-bit sample.
 static inline float sht3x_raw_to_celsius(uint16_t raw) {
@@ -105,3 +627,756 @@ static inline uint8_t sensirion_crc8(uint8_t msb, uint8_t lsb) {
     }
     return crc;
 }
+
+// ── Position journal ────────────────────────────────────────────────────────
+// Fixed-size record appended to a small ring of NVS slots by the write-behind
+// position persistence. The newest valid record (highest sequence number, CRC
+// intact) wins at boot, so a torn or stale slot is simply skipped.
+#define JOURNAL_RECORD_VERSION  1
+
+#define JOURNAL_F_STOPPED  0x01u   // motion was stopped when captured
+
+typedef struct {
+    uint32_t seq;        // write sequence, increments per record
+    uint32_t uptime_ms;  // capture time since boot
+    uint16_t pos_pm;     // position in per-mille (0..1000)
+    uint8_t  target;     // last commanded target, 0..100 %
+    uint8_t  dir;        // direction of the last move (firmware motion_dir_t)
+    uint8_t  flags;      // JOURNAL_F_*
+    uint8_t  version;    // JOURNAL_RECORD_VERSION
+    uint16_t crc;        // CRC-16/CCITT-FALSE over all preceding bytes
+} journal_record_t;
+
+// CRC-16/CCITT-FALSE (polynomial 0x1021, init 0xFFFF). Check value for the
+// ASCII string "123456789" is 0x29B1.
+static inline uint16_t crc16_ccitt(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)((uint16_t)data[i] << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021)
+                                 : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static inline void journal_seal(journal_record_t *rec) {
+    rec->version = JOURNAL_RECORD_VERSION;
+    rec->crc     = crc16_ccitt((const uint8_t *)rec, offsetof(journal_record_t, crc));
+}
+
+static inline bool journal_valid(const journal_record_t *rec) {
+    return rec->version == JOURNAL_RECORD_VERSION &&
+           rec->pos_pm <= 1000 && rec->target <= 100 &&
+           rec->crc == crc16_ccitt((const uint8_t *)rec, offsetof(journal_record_t, crc));
+}
+
+// Index of the newest valid record among n slots, or -1 if none is valid.
+// Sequence numbers are compared with serial arithmetic so wrap-around is safe.
+static inline int journal_newest(const journal_record_t *slots, int n) {
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+        if (!journal_valid(&slots[i])) {
+            continue;
+        }
+        if (best < 0 || (int32_t)(slots[i].seq - slots[best].seq) > 0) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// A record is trusted for fast boot only if motion had stopped when it was
+// captured and the position matches the target it settled on, to within the
+// rounding of the reported percent (a stop mid-move settles on the nearest
+// percent while the journal keeps per-mille). Anything else (captured
+// mid-move, or from before a power cut mid-write) needs homing.
+static inline bool journal_clean(const journal_record_t *rec) {
+    int diff = (int)rec->pos_pm - (int)rec->target * 10;
+    return journal_valid(rec) && (rec->flags & JOURNAL_F_STOPPED) &&
+           diff >= -5 && diff <= 5;
+}
+
+// ── Shade config blob ───────────────────────────────────────────────────────
+// Calibration and boot state live in one versioned blob in the "shade"
+// namespace, read with a single nvs_get_blob() at boot and always rewritten
+// whole, so related fields change together. A blob with a bad CRC or an
+// unknown version is ignored and the firmware falls back to its defaults.
+// Version 1 blobs (no close time or lag) are converted on load.
+#define SHADE_CONFIG_VERSION    2
+
+#define SHADE_CFG_F_CALIBRATED  0x01u   // cal_ms holds a measured travel time
+#define SHADE_CFG_F_LEARNED     0x02u   // close_ms and lag_ms hold learned values
+
+typedef struct {
+    uint32_t cal_ms;       // measured full travel time (opening)
+    uint32_t close_ms;     // learned full closing time
+    uint16_t lag_ms;       // learned motor start lag
+    uint8_t  version;      // SHADE_CONFIG_VERSION
+    uint8_t  flags;        // SHADE_CFG_F_*
+    uint8_t  fast_boots;   // consecutive boots without homing
+    uint8_t  reserved;     // zero
+    uint16_t crc;          // CRC-16/CCITT-FALSE over all preceding bytes
+} shade_config_t;
+
+#define SHADE_CONFIG_V1_VERSION 1
+
+typedef struct {
+    uint32_t cal_ms;
+    uint8_t  version;      // SHADE_CONFIG_V1_VERSION
+    uint8_t  flags;
+    uint8_t  fast_boots;
+    uint8_t  reserved[3];
+    uint16_t crc;
+} shade_config_v1_t;
+
+static inline void shade_config_seal(shade_config_t *cfg) {
+    cfg->version = SHADE_CONFIG_VERSION;
+    cfg->crc     = crc16_ccitt((const uint8_t *)cfg, offsetof(shade_config_t, crc));
+}
+
+static inline bool shade_config_valid(const shade_config_t *cfg) {
+    return cfg->version == SHADE_CONFIG_VERSION &&
+           cfg->crc == crc16_ccitt((const uint8_t *)cfg, offsetof(shade_config_t, crc));
+}
+
+// Convert a version 1 blob. Returns false if it is not a valid one.
+static inline bool shade_config_from_v1(const shade_config_v1_t *v1, shade_config_t *out) {
+    if (v1->version != SHADE_CONFIG_V1_VERSION ||
+        v1->crc != crc16_ccitt((const uint8_t *)v1, offsetof(shade_config_v1_t, crc))) {
+        return false;
+    }
+    shade_config_t cfg = {0};
+    cfg.cal_ms     = v1->cal_ms;
+    cfg.flags      = v1->flags & SHADE_CFG_F_CALIBRATED;
+    cfg.fast_boots = v1->fast_boots;
+    *out = cfg;
+    return true;
+}
+
+// Calibrated travel time, or 0 when the device has not been calibrated.
+static inline uint32_t shade_config_cal_ms(const shade_config_t *cfg) {
+    return (cfg->flags & SHADE_CFG_F_CALIBRATED) ? cfg->cal_ms : 0;
+}
+
+// Travel model for the blob. Until a close time and lag have been learned,
+// closing takes close_pct % of the open time and the lag is default_lag_ms.
+static inline travel_model_t shade_config_model(const shade_config_t *cfg,
+                                                uint32_t default_ms, int close_pct,
+                                                uint32_t default_lag_ms) {
+    travel_model_t m;
+    uint32_t       cal = shade_config_cal_ms(cfg);
+
+    m.open_ms = (cal > 0) ? cal : default_ms;
+    if ((cfg->flags & SHADE_CFG_F_LEARNED) && cfg->close_ms > 0) {
+        m.close_ms = cfg->close_ms;
+        m.lag_ms   = cfg->lag_ms;
+    } else {
+        m.close_ms = (uint32_t)((uint64_t)m.open_ms * (uint32_t)close_pct / 100);
+        m.lag_ms   = default_lag_ms;
+    }
+    if (m.close_ms == 0) {
+        m.close_ms = 1;
+    }
+    return m;
+}
+
+// ── Latency histogram ───────────────────────────────────────────────────────
+// Fixed log2 buckets so a trace point costs a few instructions and no heap.
+// Bucket 0 holds samples below 16 µs, bucket i (1..LAT_BUCKETS-2) holds
+// [16 << (i-1), 16 << i) µs, and the last bucket is open-ended (>= ~4.2 s).
+#define LAT_BUCKETS       20
+#define LAT_BUCKET0_US    16u
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t bucket[LAT_BUCKETS];
+} lat_hist_t;
+
+static inline int lat_bucket(uint32_t us) {
+    int b = 0;
+    uint32_t upper = LAT_BUCKET0_US;
+    while (b < LAT_BUCKETS - 1 && us >= upper) {
+        b++;
+        upper <<= 1;
+    }
+    return b;
+}
+
+// Exclusive upper bound of bucket b in µs; UINT32_MAX for the open-ended one.
+static inline uint32_t lat_bucket_upper_us(int b) {
+    if (b >= LAT_BUCKETS - 1) return UINT32_MAX;
+    return LAT_BUCKET0_US << b;
+}
+
+static inline void lat_record(lat_hist_t *h, uint32_t us) {
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us) h->max_us = us;
+    h->bucket[lat_bucket(us)]++;
+}
+
+// Upper bound of the bucket containing the pct-th percentile, capped at the
+// observed maximum so a sparse histogram never reports more than it has seen.
+// Returns 0 for an empty histogram.
+static inline uint32_t lat_percentile_us(const lat_hist_t *h, int pct) {
+    if (h->count == 0) return 0;
+    if (pct < 0) pct = 0;
+    if (pct > 100) pct = 100;
+    uint64_t rank = ((uint64_t)h->count * (uint32_t)pct + 99) / 100;
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += h->bucket[b];
+        if (seen >= rank) {
+            uint32_t upper = lat_bucket_upper_us(b);
+            return upper < h->max_us ? upper : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+static inline uint32_t lat_mean_us(const lat_hist_t *h) {
+    return h->count ? (uint32_t)(h->sum_us / h->count) : 0;
+}
+
+// ── Motion state seqlock ────────────────────────────────────────────────────
+// Position, target and direction of a shade are read together by HomeKit
+// notify, the journal and the protection layer on either core, so they are
+// published as one snapshot. The writer makes the sequence odd, stores both
+// words and makes it even again; a reader retries until it saw the same even
+// sequence before and after its loads, so it never sees half an update and
+// never blocks the writer. Writers must be serialised by the caller. Two
+// 32-bit words keep every access a native atomic on Xtensa.
+typedef struct {
+    int32_t pos_ppm;    // authoritative position, see the position model
+    uint8_t pos;        // pos_ppm in percent, as reported to HomeKit
+    uint8_t target;     // percent
+    uint8_t dir;        // 0 closing, 1 opening, 2 stopped (HAP PositionState)
+} motion_state_t;
+
+typedef struct {
+    _Atomic uint32_t seq;
+    _Atomic uint32_t w0;        // pos_ppm
+    _Atomic uint32_t w1;        // pos | target << 8 | dir << 16
+} motion_seqlock_t;
+
+#define MSTATE_W1(pos, target, dir) \
+    ((uint32_t)(pos) | ((uint32_t)(target) << 8) | ((uint32_t)(dir) << 16))
+
+// Static initialiser for a seqlock holding the given state.
+#define MSTATE_INIT(ppm, pos, target, dir) \
+    { .seq = 0, .w0 = (uint32_t)(ppm), .w1 = MSTATE_W1(pos, target, dir) }
+
+static inline void mstate_write_begin(motion_seqlock_t *l) {
+    uint32_t seq = atomic_load_explicit(&l->seq, memory_order_relaxed);
+    atomic_store_explicit(&l->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void mstate_write_end(motion_seqlock_t *l) {
+    uint32_t seq = atomic_load_explicit(&l->seq, memory_order_relaxed);
+    atomic_store_explicit(&l->seq, seq + 1, memory_order_release);
+}
+
+static inline void mstate_write(motion_seqlock_t *l, const motion_state_t *st) {
+    mstate_write_begin(l);
+    atomic_store_explicit(&l->w0, (uint32_t)st->pos_ppm, memory_order_relaxed);
+    atomic_store_explicit(&l->w1, MSTATE_W1(st->pos, st->target, st->dir),
+                          memory_order_relaxed);
+    mstate_write_end(l);
+}
+
+// One lock-free read attempt; false if a write was in progress or completed
+// meanwhile, in which case *out must not be used.
+static inline bool mstate_try_read(motion_seqlock_t *l, motion_state_t *out) {
+    uint32_t s1 = atomic_load_explicit(&l->seq, memory_order_acquire);
+    uint32_t w0 = atomic_load_explicit(&l->w0, memory_order_relaxed);
+    uint32_t w1 = atomic_load_explicit(&l->w1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t s2 = atomic_load_explicit(&l->seq, memory_order_relaxed);
+
+    if ((s1 & 1u) || s1 != s2) {
+        return false;
+    }
+    out->pos_ppm = (int32_t)w0;
+    out->pos     = (uint8_t)(w1 & 0xFF);
+    out->target  = (uint8_t)((w1 >> 8) & 0xFF);
+    out->dir     = (uint8_t)((w1 >> 16) & 0xFF);
+    return true;
+}
+
+static inline motion_state_t mstate_read(motion_seqlock_t *l) {
+    motion_state_t st;
+    while (!mstate_try_read(l, &st)) {
+    }
+    return st;
+}
+
+// ── Motor end-stop detection ────────────────────────────────────────────────
+// A tubular motor's internal limit switch cuts the motor, so its supply
+// current drops to zero at the end stop. The sensor (ACS712, CT clamp) reads
+// around a resting offset; the amplitude of one sample window is the largest
+// deviation from that offset, which works for DC and, with a window of one
+// mains cycle, for AC motors alike. The detector needs the motor to have been
+// seen running before a drop counts, so a dead sensor never fakes an end stop.
+typedef enum {
+    ENDSTOP_WAIT = 0,       // no running current seen yet
+    ENDSTOP_RUNNING,
+    ENDSTOP_REACHED,
+} endstop_state_t;
+
+typedef struct {
+    int             run_mv;         // amplitude at or above: motor running
+    int             stop_mv;        // amplitude below: motor stopped
+    uint32_t        stop_ms;        // how long it must stay below
+    endstop_state_t state;
+    bool            below;
+    uint32_t        below_since_ms; // when the current dropped
+} endstop_detector_t;
+
+static inline void endstop_init(endstop_detector_t *d, int run_mv, int stop_mv,
+                                uint32_t stop_ms) {
+    d->run_mv         = run_mv;
+    d->stop_mv        = stop_mv;
+    d->stop_ms        = stop_ms;
+    d->state          = ENDSTOP_WAIT;
+    d->below          = false;
+    d->below_since_ms = 0;
+}
+
+static inline endstop_state_t endstop_push(endstop_detector_t *d, int amp_mv, uint32_t t_ms) {
+    if (d->state == ENDSTOP_WAIT) {
+        if (amp_mv >= d->run_mv) {
+            d->state = ENDSTOP_RUNNING;
+        }
+    } else if (d->state == ENDSTOP_RUNNING) {
+        if (amp_mv >= d->stop_mv) {
+            d->below = false;
+        } else {
+            if (!d->below) {
+                d->below          = true;
+                d->below_since_ms = t_ms;
+            }
+            if (t_ms - d->below_since_ms >= d->stop_ms) {
+                d->state = ENDSTOP_REACHED;
+            }
+        }
+    }
+    return d->state;
+}
+
+// Largest deviation of n samples from the resting offset.
+static inline int current_amplitude(const int *samples, int n, int offset) {
+    int amp = 0;
+    for (int i = 0; i < n; i++) {
+        int dev = samples[i] - offset;
+        if (dev < 0) dev = -dev;
+        if (dev > amp) amp = dev;
+    }
+    return amp;
+}
+
+// ── Binary event log ────────────────────────────────────────────────────────
+// Fixed-size records in a RAM ring, written without a lock: a writer reserves
+// an index with one atomic increment, fills the slot and then publishes it by
+// storing the slot's stamp (index + 1). Readers keep their own tail, so the
+// console and a remote reader drain the same ring independently, and format
+// records only when they read them. A slow reader never blocks a writer; it
+// loses the records that were overwritten and counts them. As with the
+// motion seqlock the words are atomics, so a torn copy is detected by the
+// stamp changing underneath it rather than being undefined behaviour.
+#define EVLOG_SLOTS   64      // power of two
+#define EVLOG_VALUES  4
+
+typedef struct {
+    uint32_t t_ms;
+    uint16_t id;
+    int32_t  v[EVLOG_VALUES];
+} evlog_event_t;
+
+typedef struct {
+    _Atomic uint32_t stamp;               // index + 1 of the record held, 0 while written
+    _Atomic uint32_t w[2 + EVLOG_VALUES];
+} evlog_slot_t;
+
+typedef struct {
+    _Atomic uint32_t head;                // records ever reserved
+    evlog_slot_t     slot[EVLOG_SLOTS];
+} evlog_ring_t;
+
+typedef struct {
+    uint32_t tail;                        // next index to read
+    uint32_t lost;                        // overwritten before they were read
+} evlog_reader_t;
+
+static inline void evlog_write(evlog_ring_t *r, const evlog_event_t *ev) {
+    uint32_t      idx = atomic_fetch_add_explicit(&r->head, 1, memory_order_relaxed);
+    evlog_slot_t *s   = &r->slot[idx & (EVLOG_SLOTS - 1)];
+
+    atomic_store_explicit(&s->stamp, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&s->w[0], ev->t_ms, memory_order_relaxed);
+    atomic_store_explicit(&s->w[1], ev->id, memory_order_relaxed);
+    for (int i = 0; i < EVLOG_VALUES; i++) {
+        atomic_store_explicit(&s->w[2 + i], (uint32_t)ev->v[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&s->stamp, idx + 1, memory_order_release);
+}
+
+// Copy the reader's next record into out. Returns false once the reader has
+// caught up, including with a record that is still being written.
+static inline bool evlog_read(evlog_ring_t *r, evlog_reader_t *rd, evlog_event_t *out) {
+    for (;;) {
+        uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (head - rd->tail > EVLOG_SLOTS) {
+            rd->lost += head - rd->tail - EVLOG_SLOTS;
+            rd->tail  = head - EVLOG_SLOTS;
+        }
+        if (rd->tail == head) {
+            return false;
+        }
+
+        evlog_slot_t *s     = &r->slot[rd->tail & (EVLOG_SLOTS - 1)];
+        uint32_t      want  = rd->tail + 1;
+        uint32_t      stamp = atomic_load_explicit(&s->stamp, memory_order_acquire);
+        if (stamp != want) {
+            if (stamp == 0 || (int32_t)(stamp - want) < 0) {
+                return false;                   // not published yet
+            }
+            rd->lost++;                         // already overwritten
+            rd->tail++;
+            continue;
+        }
+
+        uint32_t w[2 + EVLOG_VALUES];
+        for (int i = 0; i < 2 + EVLOG_VALUES; i++) {
+            w[i] = atomic_load_explicit(&s->w[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        rd->tail++;
+        if (atomic_load_explicit(&s->stamp, memory_order_relaxed) != stamp) {
+            rd->lost++;                         // overwritten while copying
+            continue;
+        }
+
+        out->t_ms = w[0];
+        out->id   = (uint16_t)w[1];
+        for (int i = 0; i < EVLOG_VALUES; i++) {
+            out->v[i] = (int32_t)w[2 + i];
+        }
+        return true;
+    }
+}
+
+// Start a reader at the newest record, skipping everything older.
+static inline void evlog_reader_sync(evlog_ring_t *r, evlog_reader_t *rd) {
+    rd->tail = atomic_load_explicit(&r->head, memory_order_acquire);
+    rd->lost = 0;
+}
+
+// ── Telemetry history ───────────────────────────────────────────────────────
+// Fixed-memory history of one sensor value at three resolutions: the raw
+// samples of about the last minute, then 1-minute and 15-minute buckets with
+// min, max and mean. Buckets are aligned to multiples of their length since
+// boot and carry their start time, so a gap (a sensor that stopped answering)
+// shows as missing buckets rather than shifting the ones after it. Every ring
+// counts the records ever written, and readers address records by that
+// absolute number: a reader streaming a ring while it is being appended to
+// simply stops finding the records that were overwritten in the meantime.
+#define TELE_LEVELS         2
+#define TELE_L1_MS          60000u       // 1-minute buckets
+#define TELE_L2_MS          900000u      // 15-minute buckets
+#define TELE_L1_SLOTS       60           // the last hour
+#define TELE_L2_SLOTS       96           // the last day
+
+typedef struct {
+    uint32_t t_ms;
+    int32_t  v;
+} tele_sample_t;
+
+typedef struct {
+    uint32_t t_ms;         // bucket start
+    int32_t  min, max, mean;
+} tele_bucket_t;
+
+typedef struct {
+    tele_bucket_t *buf;
+    uint16_t       cap;
+    uint32_t       period_ms;
+    uint32_t       total;  // buckets ever closed
+    // Bucket being filled; n == 0 while empty.
+    uint32_t       t0_ms;
+    int32_t        min, max;
+    int64_t        sum;
+    uint32_t       n;
+} tele_level_t;
+
+typedef struct {
+    tele_sample_t *raw;
+    uint16_t       raw_cap;
+    uint32_t       raw_total;
+    tele_level_t   level[TELE_LEVELS];
+} tele_series_t;
+
+static inline void tele_init(tele_series_t *s, tele_sample_t *raw, uint16_t raw_cap,
+                             tele_bucket_t *l1, tele_bucket_t *l2) {
+    tele_series_t z = {0};
+    z.raw     = raw;
+    z.raw_cap = raw_cap;
+    z.level[0].buf       = l1;
+    z.level[0].cap       = TELE_L1_SLOTS;
+    z.level[0].period_ms = TELE_L1_MS;
+    z.level[1].buf       = l2;
+    z.level[1].cap       = TELE_L2_SLOTS;
+    z.level[1].period_ms = TELE_L2_MS;
+    *s = z;
+}
+
+// The bucket being filled, as it stands. Returns false while it is empty.
+static inline bool tele_level_open(const tele_level_t *l, tele_bucket_t *out) {
+    if (l->n == 0) {
+        return false;
+    }
+    out->t_ms = l->t0_ms;
+    out->min  = l->min;
+    out->max  = l->max;
+    out->mean = (int32_t)(l->sum / (int64_t)l->n);
+    return true;
+}
+
+static inline void tele_level_push(tele_level_t *l, uint32_t t_ms, int32_t v) {
+    uint32_t t0 = t_ms - t_ms % l->period_ms;
+
+    if (l->n > 0 && t0 != l->t0_ms) {
+        tele_level_open(l, &l->buf[l->total % l->cap]);
+        l->total++;
+        l->n = 0;
+    }
+    if (l->n == 0) {
+        l->t0_ms = t0;
+        l->min   = v;
+        l->max   = v;
+        l->sum   = 0;
+    }
+    if (v < l->min) l->min = v;
+    if (v > l->max) l->max = v;
+    l->sum += v;
+    l->n++;
+}
+
+static inline void tele_push(tele_series_t *s, uint32_t t_ms, int32_t v) {
+    tele_sample_t *slot = &s->raw[s->raw_total % s->raw_cap];
+    slot->t_ms = t_ms;
+    slot->v    = v;
+    s->raw_total++;
+
+    for (int i = 0; i < TELE_LEVELS; i++) {
+        tele_level_push(&s->level[i], t_ms, v);
+    }
+}
+
+// Absolute number of the oldest record still held.
+static inline uint32_t tele_first(uint32_t total, uint16_t cap) {
+    return (total > cap) ? total - cap : 0;
+}
+
+// Raw sample number k. Returns false if it is not (or no longer) held.
+static inline bool tele_raw_get(const tele_series_t *s, uint32_t k, tele_sample_t *out) {
+    if (k >= s->raw_total || k < tele_first(s->raw_total, s->raw_cap)) {
+        return false;
+    }
+    *out = s->raw[k % s->raw_cap];
+    return true;
+}
+
+// Closed bucket number k of a level. Returns false if it is not held.
+static inline bool tele_bucket_get(const tele_level_t *l, uint32_t k, tele_bucket_t *out) {
+    if (k >= l->total || k < tele_first(l->total, l->cap)) {
+        return false;
+    }
+    *out = l->buf[k % l->cap];
+    return true;
+}
+
+// ── Solar position ──────────────────────────────────────────────────────────
+// Sun azimuth and elevation from UTC time and the site's latitude/longitude,
+// using the low-precision formulae of the Astronomical Almanac (good to about
+// 0.01° in declination between 1950 and 2050, ample for deciding whether the
+// sun is on a facade). It runs a few hundred times a day, never on a hot
+// path. Angles are in degrees, azimuth clockwise from north, results in
+// hundredths of a degree.
+#define SUN_PI              3.14159265358979323846
+#define SUN_DEG             (SUN_PI / 180.0)
+#define SUN_J2000_UNIX      946728000.0     // 2000-01-01 12:00 UTC
+
+typedef struct {
+    int32_t lat_cdeg;       // + north
+    int32_t lon_cdeg;       // + east
+    int16_t facade_az;      // direction the window faces, ° from north
+    int16_t half_width;     // sun counts as on the facade within ± this of facade_az
+    int16_t min_elev;       // and above this elevation (horizon, obstructions)
+} sun_site_t;
+
+typedef struct {
+    int32_t az_cdeg;        // 0..35999
+    int32_t el_cdeg;        // -9000..9000
+} sun_pos_t;
+
+// Reduce to [0, 360).
+static inline double sun_wrap360(double d) {
+    d = fmod(d, 360.0);
+    return (d < 0.0) ? d + 360.0 : d;
+}
+
+static inline double sun_sin_deg(double d) {
+    return sin(d * SUN_DEG);
+}
+
+static inline double sun_cos_deg(double d) {
+    return cos(d * SUN_DEG);
+}
+
+// atan2 in degrees, [-180, 180].
+static inline double sun_atan2_deg(double y, double x) {
+    return atan2(y, x) / SUN_DEG;
+}
+
+static inline int32_t sun_round_cdeg(double d) {
+    return (int32_t)((d < 0.0) ? d * 100.0 - 0.5 : d * 100.0 + 0.5);
+}
+
+static inline sun_pos_t sun_position(const sun_site_t *site, uint32_t unix_s) {
+    double n   = ((double)unix_s - SUN_J2000_UNIX) / 86400.0;    // days since J2000.0
+    double L   = sun_wrap360(280.460 + 0.9856474 * n);           // mean longitude
+    double g   = sun_wrap360(357.528 + 0.9856003 * n);           // mean anomaly
+    double lam = L + 1.915 * sun_sin_deg(g) + 0.020 * sun_sin_deg(2.0 * g);
+    double eps = 23.439 - 0.0000004 * n;                         // obliquity
+    double gmst = sun_wrap360(280.46061837 + 360.98564736629 * n);
+    double lst  = gmst + (double)site->lon_cdeg / 100.0;         // local sidereal
+    double lat  = (double)site->lat_cdeg / 100.0;
+
+    // Unit vector to the sun: ecliptic -> equatorial, then the hour-angle
+    // rotation into the local east/north/up frame (no declination/RA needed).
+    double X = sun_cos_deg(lam);
+    double Y = sun_cos_deg(eps) * sun_sin_deg(lam);
+    double Z = sun_sin_deg(eps) * sun_sin_deg(lam);
+    double st = sun_sin_deg(lst), ct = sun_cos_deg(lst);
+    double sp = sun_sin_deg(lat), cp = sun_cos_deg(lat);
+    double merid = X * ct + Y * st;                              // cos(dec) cos(H)
+    double east  = -(X * st - Y * ct);                           // -cos(dec) sin(H)
+    double north = Z * cp - merid * sp;
+    double up    = Z * sp + merid * cp;
+
+    sun_pos_t p;
+    p.az_cdeg = sun_round_cdeg(sun_wrap360(sun_atan2_deg(east, north)));
+    p.el_cdeg = sun_round_cdeg(sun_atan2_deg(up, sqrt(east * east + north * north)));
+    if (p.az_cdeg >= 36000) p.az_cdeg -= 36000;
+    return p;
+}
+
+// True if the sun is high enough and within half_width of the facade normal.
+static inline bool sun_on_facade(const sun_site_t *site, sun_pos_t p) {
+    if (p.el_cdeg < site->min_elev * 100) {
+        return false;
+    }
+    int32_t off = p.az_cdeg - site->facade_az * 100;
+    off %= 36000;
+    if (off > 18000)   off -= 36000;
+    if (off <= -18000) off += 36000;
+    if (off < 0)       off = -off;
+    return off <= site->half_width * 100;
+}
+
+// ── Sun exposure schedule ───────────────────────────────────────────────────
+// The windows in which the sun is on the facade over the next span, found by
+// stepping SUN_STEP_S and refining every edge by bisection to SUN_EDGE_S. At
+// mid latitudes a facade sees at most one window a day; SUN_WINDOWS_MAX
+// leaves room for a span that crosses midnight.
+#define SUN_STEP_S          300
+#define SUN_EDGE_S          15
+#define SUN_WINDOWS_MAX     4
+
+typedef struct {
+    uint32_t start, end;    // UTC seconds; the sun is on the facade in [start, end)
+} sun_window_t;
+
+typedef struct {
+    uint32_t     from, to;  // span covered; to == 0 while never built
+    uint8_t      count;
+    sun_window_t w[SUN_WINDOWS_MAX];
+} sun_schedule_t;
+
+static inline bool sun_exposed_at(const sun_site_t *site, uint32_t t) {
+    return sun_on_facade(site, sun_position(site, t));
+}
+
+// First second in (lo, hi] whose exposure differs from lo's, given hi differs.
+static inline uint32_t sun_edge(const sun_site_t *site, uint32_t lo, uint32_t hi) {
+    bool at_lo = sun_exposed_at(site, lo);
+
+    while (hi - lo > SUN_EDGE_S) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (sun_exposed_at(site, mid) == at_lo) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return hi;
+}
+
+static inline void sun_schedule_build(sun_schedule_t *s, const sun_site_t *site,
+                                      uint32_t from, uint32_t span_s) {
+    bool     in    = sun_exposed_at(site, from);
+    uint32_t start = from;
+
+    s->from  = from;
+    s->to    = from + span_s;
+    s->count = 0;
+
+    for (uint32_t t = from; t < s->to; ) {
+        uint32_t next = (s->to - t > SUN_STEP_S) ? t + SUN_STEP_S : s->to;
+        bool     now  = sun_exposed_at(site, next);
+
+        if (now != in) {
+            uint32_t edge = sun_edge(site, t, next);
+            if (now) {
+                start = edge;
+            } else if (s->count < SUN_WINDOWS_MAX) {
+                s->w[s->count].start = start;
+                s->w[s->count].end   = edge;
+                s->count++;
+            }
+            in = now;
+        }
+        t = next;
+    }
+    if (in && s->count < SUN_WINDOWS_MAX) {     // still on the facade at the end
+        s->w[s->count].start = start;
+        s->w[s->count].end   = s->to;
+        s->count++;
+    }
+}
+
+// True if t lies in a window or less than lead_s before one. Otherwise
+// *until_s is the time to the next such moment, UINT32_MAX if none is known.
+static inline bool sun_schedule_active(const sun_schedule_t *s, uint32_t t,
+                                       uint32_t lead_s, uint32_t *until_s) {
+    uint32_t best = UINT32_MAX;
+
+    for (int i = 0; i < s->count; i++) {
+        uint32_t open = (s->w[i].start > lead_s) ? s->w[i].start - lead_s : 0;
+        if (t >= open && t < s->w[i].end) {
+            return true;
+        }
+        if (open > t && open - t < best) {
+            best = open - t;
+        }
+    }
+    *until_s = best;
+    return false;
+}
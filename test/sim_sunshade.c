@@ -0,0 +1,907 @@
+/**
+   Copyright 2026 Achim Pieters | StudioPieters®
+
+   Host-side motor/sensor simulator and replay benchmark. The motor is a
+   travel-time plant with relay operate/release lag and end stops. HomeKit
+   writes, touch presses and wind/rain/lux traces are replayed against the
+   pure logic in sunshade_logic.h (relay driver, travel model, motion
+   segments, settle window, gust filter, hysteresis, protection arbiter,
+   latency histogram), wired up the same way main.c wires it: one stop
+   deadline per segment and per-sensor poll periods.
+
+   Every built-in scenario reports the position error, relay actuations,
+   overshoot and decision latencies and fails when one of them leaves its
+   limit, so a regression in these numbers fails CI.
+
+   Build & run:
+       cc -std=c11 -Wall -Wextra -Werror -I main test/sim_sunshade.c -o /tmp/sim -lm && /tmp/sim
+   Replay a recorded trace (one "t_ms,event,value" line per event, see
+   parse_event_name() for the event names); metrics are printed, no limits:
+       /tmp/sim trace.csv
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sunshade_logic.h"
+
+// ── Trace events ────────────────────────────────────────────────────────────
+typedef enum {
+    EV_HK_TARGET = 0,   // HomeKit target write, value = percent
+    EV_HK_HOLD,         // HomeKit hold position (stop)
+    EV_TOUCH_UP,
+    EV_TOUCH_DOWN,
+    EV_TOUCH_STOP,
+    EV_WIND,            // wind speed from now on, value = dm/s
+    EV_RAIN,            // rain sensor wet (1) or dry (0) from now on
+    EV_LUX,             // illuminance from now on, value = lux
+} event_kind_t;
+
+typedef struct {
+    uint32_t     t_ms;
+    event_kind_t kind;
+    int          value;
+} sim_event_t;
+
+#define MAX_EVENTS  4096
+
+// ── Configuration (defaults mirror Kconfig.projbuild) ───────────────────────
+typedef struct {
+    travel_model_t travel;      // calibrated travel model the firmware uses
+    uint32_t motor_ms;          // real travel time of the plant
+    uint32_t operate_us;        // relay energised -> motor turning
+    uint32_t release_us;        // relay released -> motor stopped
+    uint32_t settle_ms;         // ESP_TARGET_SETTLE_MS
+    uint32_t reverse_ms;        // ESP_RELAY_REVERSE_DELAY_MS
+    uint32_t progress_ms;       // SUNSHADE_PROGRESS_NOTIFY_MS
+    uint32_t wind_poll_ms;
+    uint32_t gust_window_ms;
+    int      wind_close_ds;
+    int      wind_reopen_ds;
+    uint32_t rain_poll_ms;
+    uint32_t rain_debounce_ms;
+    uint32_t lux_poll_ms;
+    uint32_t lux_fast_ms;
+    int      lux_close;
+    int      lux_reopen;
+} sim_config_t;
+
+static sim_config_t config_default(void) {
+    sim_config_t c = {
+        .travel           = { .open_ms = 20000, .close_ms = 20000, .lag_ms = 0 },
+        .motor_ms         = 20000,
+        .operate_us       = 10000,
+        .release_us       = 10000,
+        .settle_ms        = 200,
+        .reverse_ms       = 500,
+        .progress_ms      = 1000,
+        .wind_poll_ms     = 500,
+        .gust_window_ms   = 3000,
+        .wind_close_ds    = 80,
+        .wind_reopen_ds   = 50,
+        .rain_poll_ms     = 500,
+        .rain_debounce_ms = 2000,
+        .lux_poll_ms      = 5000,
+        .lux_fast_ms      = 1000,
+        .lux_close        = 40000,
+        .lux_reopen       = 20000,
+    };
+    return c;
+}
+
+// ── Motor plant ─────────────────────────────────────────────────────────────
+// Ground truth, deliberately in floating point and independent of the
+// firmware's fixed-point model. Relay changes reach the motor after the
+// operate/release lag; the tubular motor's limit switches clamp at the ends.
+typedef struct {
+    double  pos;            // 0 = closed .. 1 = open
+    int     dir;            // -1 closing, 0 stopped, +1 opening
+    int     next_dir;
+    int64_t next_at_us;     // 0 = no change pending
+    int64_t t_us;           // time pos was last integrated to
+} plant_t;
+
+static void plant_advance(plant_t *p, const sim_config_t *c, int64_t to_us) {
+    while (p->t_us < to_us) {
+        int64_t end = (p->next_at_us != 0 && p->next_at_us <= to_us) ? p->next_at_us : to_us;
+        if (end < p->t_us) {
+            end = p->t_us;
+        }
+        p->pos += (double)p->dir * (double)(end - p->t_us) / ((double)c->motor_ms * 1000.0);
+        if (p->pos < 0.0) p->pos = 0.0;
+        if (p->pos > 1.0) p->pos = 1.0;
+        p->t_us = end;
+        if (p->next_at_us != 0 && p->next_at_us <= end) {
+            p->dir        = p->next_dir;
+            p->next_at_us = 0;
+        }
+        if (end == to_us) {
+            break;
+        }
+    }
+}
+
+static void plant_drive(plant_t *p, const sim_config_t *c, int64_t now, int dir) {
+    plant_advance(p, c, now);
+    uint32_t lag  = (dir != 0) ? c->operate_us : c->release_us;
+    p->next_dir   = dir;
+    p->next_at_us = now + lag;
+    if (lag == 0) {
+        p->dir        = dir;
+        p->next_at_us = 0;
+    }
+}
+
+static int32_t plant_ppm(const plant_t *p) {
+    return (int32_t)(p->pos * (double)POS_PPM_FULL + 0.5);
+}
+
+// ── Firmware model ──────────────────────────────────────────────────────────
+// The state machines are the firmware's own; what remains here is the glue
+// main.c wraps around them, with the same names. Everything runs
+// synchronously in simulated time; the queue, timers and spinlocks are not
+// modelled.
+typedef enum {
+    SRC_HOMEKIT = 0, SRC_TOUCH, SRC_WIND, SRC_RAIN, SRC_LUX,
+} motion_source_t;
+typedef enum { CMD_MOVE = 0, CMD_STOP } cmd_type_t;
+
+typedef struct {
+    cmd_type_t      type;
+    motion_source_t source;
+    int             target;
+    int64_t         t_us;
+} motion_cmd_t;
+
+typedef struct {
+    uint32_t   relay_starts;        // relay energised
+    uint32_t   relay_cuts;          // energised relay released
+    int64_t    min_reverse_gap_us;  // shortest off time before a reversal
+    int32_t    max_overshoot_ppm;   // plant travel beyond the commanded span
+    int32_t    max_rest_err_ppm;    // |estimate - plant| after each segment
+    uint32_t   missed;              // threshold crossings that never engaged
+    lat_hist_t hk_relay;           // HomeKit write -> relay switched
+    lat_hist_t touch_relay;        // touch edge -> relay switched
+    lat_hist_t decision;           // sensor crossing -> protection engaged
+} metrics_t;
+
+typedef struct {
+    sim_config_t cfg;
+    plant_t      plant;
+    metrics_t    m;
+    int64_t      now;
+
+    // Motion engine.
+    int32_t      pos_ppm;
+    int          cur_pos;
+    int          tgt_pos;
+    motion_dir_t motion;
+    bool         active;
+    int64_t      seg_t0_us;
+    int32_t      seg_start_ppm;
+    int64_t      deadline_us;       // 0 = none
+    int64_t      last_tick_us;
+    settle_window_t settle;
+
+    // Pending command-to-relay trace, recorded when the relay switches.
+    lat_hist_t  *trace_hist;
+    int64_t      trace_t0_us;
+
+    // Overshoot check once the motor has run down after a finished segment:
+    // the plant's travel is compared with the travel the segment commanded.
+    // Moves to an end stop overrun on purpose and the limit switch ends them,
+    // so they only count for the rest error.
+    int32_t      seg_plant_ppm;     // plant position when the segment started
+    int64_t      check_at_us;       // 0 = none
+    int32_t      check_span_ppm;
+    int32_t      check_plant_ppm;
+    int          check_dir;         // 0 = end stop, no overshoot check
+
+    relay_fsm_t  relay;
+
+    // Protection and sensors.
+    prot_arbiter_t prot;
+    gust_filter_t  gust;
+    int64_t        wind_next_us;
+    int64_t        rain_next_us;
+    int64_t        lux_next_us;
+    bool           rain_last_raw;
+    bool           rain_stable;
+    bool           rain_prev;
+    int64_t        rain_changed_us;
+    int            lux;
+    bool           lux_fast;
+
+    // Raw sensor inputs from the trace and pending threshold crossings.
+    int            in_wind_ds;
+    bool           in_rain;
+    int            in_lux;
+    int64_t        cross_us[PROT_COUNT];    // -1 = no crossing pending
+} sim_t;
+
+static void position_set(sim_t *s, int32_t ppm) {
+    s->pos_ppm = pos_clamp_ppm(ppm);
+    s->cur_pos = pos_ppm_to_pct(s->pos_ppm);
+}
+
+static void trace_done(sim_t *s) {
+    if (s->trace_hist != NULL) {
+        lat_record(s->trace_hist, (uint32_t)(s->now - s->trace_t0_us));
+        s->trace_hist = NULL;
+    }
+}
+
+static uint32_t sim_ms(const sim_t *s) {
+    return (uint32_t)(s->now / 1000);
+}
+
+// Follows the driver's outputs the way the relays would: every edge reaches
+// the plant, and starts, cuts and reversal gaps are counted.
+static void relay_outputs(sim_t *s, const relay_fsm_t *before) {
+    if (relay_fsm_on(before) && before->state != s->relay.state) {
+        s->m.relay_cuts++;
+        plant_drive(&s->plant, &s->cfg, s->now, 0);
+    }
+    if (relay_fsm_on(&s->relay) && s->relay.state != before->state) {
+        if (before->dir != MOTION_STOPPED && before->dir != s->relay.dir) {
+            int64_t gap = s->now - s->relay.off_us;
+            if (s->m.min_reverse_gap_us < 0 || gap < s->m.min_reverse_gap_us) {
+                s->m.min_reverse_gap_us = gap;
+            }
+        }
+        s->m.relay_starts++;
+        plant_drive(&s->plant, &s->cfg, s->now, s->relay.dir == MOTION_OPENING ? 1 : -1);
+        trace_done(s);
+    }
+}
+
+static void relay_dead_time_cb(sim_t *s) {
+    relay_fsm_t before = s->relay;
+    if (relay_fsm_expire(&s->relay, s->now)) {
+        relay_outputs(s, &before);
+    }
+}
+
+static void relay_cut(sim_t *s) {
+    relay_fsm_t before = s->relay;
+    relay_fsm_cut(&s->relay, s->now);
+    relay_outputs(s, &before);
+}
+
+// Returns the dead time in ms, rounded up, like relay_request() in main.c.
+static uint32_t relay_request(sim_t *s, motion_dir_t dir) {
+    relay_fsm_t before  = s->relay;
+    int64_t     wait_us = relay_fsm_request(&s->relay, dir, s->now,
+                                            (int64_t)s->cfg.reverse_ms * 1000);
+    relay_outputs(s, &before);
+    return (uint32_t)((wait_us + 999) / 1000);
+}
+
+static int32_t motion_estimate(const sim_t *s) {
+    return travel_estimate(&s->cfg.travel, s->seg_start_ppm, pos_pct_to_ppm(s->tgt_pos),
+                           s->now - s->seg_t0_us);
+}
+
+static void motion_segment_end(sim_t *s) {
+    s->deadline_us = 0;
+}
+
+static void motion_stop_here(sim_t *s) {
+    motion_segment_end(s);
+    s->motion  = MOTION_STOPPED;
+    s->tgt_pos = s->cur_pos;
+    relay_request(s, MOTION_STOPPED);
+    s->active  = false;
+}
+
+static void motion_finish(sim_t *s) {
+    int32_t target = pos_pct_to_ppm(s->tgt_pos);
+
+    motion_segment_end(s);
+    s->check_at_us     = s->now + s->cfg.release_us + 1;
+    s->check_span_ppm  = target - s->seg_start_ppm;
+    s->check_plant_ppm = s->seg_plant_ppm;
+    s->check_dir       = (s->tgt_pos == 0 || s->tgt_pos == 100) ? 0
+                       : (target >= s->seg_start_ppm) ? 1 : -1;
+
+    position_set(s, target);
+    s->motion = MOTION_STOPPED;
+    relay_request(s, MOTION_STOPPED);
+    s->active = false;
+}
+
+static void motion_apply(sim_t *s, const motion_cmd_t *cmd) {
+    lat_hist_t *hist = (cmd->source == SRC_HOMEKIT) ? &s->m.hk_relay
+                     : (cmd->source == SRC_TOUCH)   ? &s->m.touch_relay : NULL;
+
+    if (s->active) {
+        position_set(s, motion_estimate(s));
+    }
+
+    int          target = clamp_position(cmd->target);
+    motion_dir_t dir    = motion_decide(cmd->type == CMD_STOP, s->cur_pos, target);
+    if (dir == MOTION_STOPPED) {
+        s->trace_hist  = hist;
+        s->trace_t0_us = cmd->t_us;
+        motion_stop_here(s);
+        trace_done(s);
+        return;
+    }
+
+    motion_segment_end(s);
+    s->tgt_pos = target;
+    s->motion  = dir;
+
+    // A dead time defers the relay; the trace completes in relay_outputs().
+    s->trace_hist  = hist;
+    s->trace_t0_us = cmd->t_us;
+    uint32_t delay_ms = relay_request(s, dir);
+    if (relay_fsm_on(&s->relay)) {
+        trace_done(s);
+    }
+
+    s->seg_t0_us     = s->now + (int64_t)delay_ms * 1000;
+    s->seg_start_ppm = s->pos_ppm;
+    plant_advance(&s->plant, &s->cfg, s->now);
+    s->seg_plant_ppm = plant_ppm(&s->plant);
+    s->last_tick_us  = s->now;
+    s->deadline_us   = s->now + motion_run_us(&s->cfg.travel, s->seg_start_ppm, target) +
+                       (int64_t)delay_ms * 1000;
+    s->active        = true;
+}
+
+// Mirrors motion_post() plus the settle handling in motion_task().
+static void motion_post(sim_t *s, cmd_type_t type, int target, motion_source_t source) {
+    motion_cmd_t cmd = { .type = type, .source = source, .target = target, .t_us = s->now };
+
+    if (s->cfg.settle_ms > 0 && type == CMD_MOVE && source == SRC_HOMEKIT) {
+        settle_offer(&s->settle, target, s->now, sim_ms(s));
+        return;
+    }
+    settle_cancel(&s->settle);
+    motion_apply(s, &cmd);
+}
+
+static bool protection_defers(sim_t *s, int target, motion_source_t source) {
+    if (source != SRC_HOMEKIT && source != SRC_TOUCH) {
+        return false;
+    }
+    return !prot_user_move(&s->prot, target);
+}
+
+static void sunshade_move_to(sim_t *s, int target, motion_source_t source) {
+    target = clamp_position(target);
+    if (!protection_defers(s, target, source)) {
+        motion_post(s, CMD_MOVE, target, source);
+    }
+}
+
+static void sunshade_stop(sim_t *s, motion_source_t source) {
+    motion_post(s, CMD_STOP, 0, source);
+}
+
+static void protection_set(sim_t *s, prot_source_t src, bool engage) {
+    static const motion_source_t motion_src[PROT_COUNT] = { SRC_WIND, SRC_RAIN, SRC_LUX };
+
+    if (engage && s->cross_us[src] >= 0) {
+        lat_record(&s->m.decision, (uint32_t)(s->now - s->cross_us[src]));
+        s->cross_us[src] = -1;
+    }
+
+    // A target still settling is the latest user intent (shade_t.settle_target).
+    int cur  = settle_intent(&s->settle, s->tgt_pos);
+    int move = prot_update(&s->prot, src, engage, cur);
+    if (move != PROT_NO_MOVE) {
+        sunshade_move_to(s, move, motion_src[src]);
+    }
+}
+
+// ── Sensors ─────────────────────────────────────────────────────────────────
+static void wind_poll(sim_t *s) {
+    gust_push(&s->gust, s->in_wind_ds);
+    int gust = (int)gust_max(&s->gust);
+
+    sensor_action_t act = sensor_hysteresis(prot_is_active(&s->prot, PROT_WIND), gust,
+                                            s->cfg.wind_close_ds, s->cfg.wind_reopen_ds);
+    if (act == SENSOR_TRIGGER_CLOSE) {
+        protection_set(s, PROT_WIND, true);
+    } else if (act == SENSOR_TRIGGER_REOPEN) {
+        protection_set(s, PROT_WIND, false);
+    }
+}
+
+static void rain_poll(sim_t *s) {
+    if (s->in_rain != s->rain_last_raw) {
+        s->rain_last_raw   = s->in_rain;
+        s->rain_changed_us = s->now;
+    }
+    if (s->now - s->rain_changed_us >= (int64_t)s->cfg.rain_debounce_ms * 1000) {
+        s->rain_stable = s->rain_last_raw;
+    }
+
+    if (s->rain_stable && !s->rain_prev) {
+        protection_set(s, PROT_RAIN, true);
+    } else if (!s->rain_stable && s->rain_prev) {
+        protection_set(s, PROT_RAIN, false);
+    }
+    s->rain_prev = s->rain_stable;
+}
+
+static void lux_poll(sim_t *s) {
+    s->lux = s->in_lux;
+
+    sensor_action_t act = sensor_hysteresis(prot_is_active(&s->prot, PROT_LUX), s->lux,
+                                            s->cfg.lux_close, s->cfg.lux_reopen);
+    if (act == SENSOR_TRIGGER_CLOSE) {
+        protection_set(s, PROT_LUX, true);
+    } else if (act == SENSOR_TRIGGER_REOPEN) {
+        protection_set(s, PROT_LUX, false);
+    }
+
+    s->lux_fast = lux_near_threshold(prot_is_active(&s->prot, PROT_LUX), s->lux,
+                                     s->cfg.lux_close, s->cfg.lux_reopen);
+}
+
+// A raw value crossing the close threshold starts a decision-latency
+// measurement; dropping back below the reopen threshold before protection
+// engaged counts the crossing as missed (e.g. a rain blip inside the debounce).
+static void input_crossing(sim_t *s, prot_source_t src, bool above, bool below) {
+    if (prot_is_active(&s->prot, src)) {
+        s->cross_us[src] = -1;
+        return;
+    }
+    if (above && s->cross_us[src] < 0) {
+        s->cross_us[src] = s->now;
+    } else if (below && s->cross_us[src] >= 0) {
+        s->cross_us[src] = -1;
+        s->m.missed++;
+    }
+}
+
+static void apply_event(sim_t *s, const sim_event_t *ev) {
+    switch (ev->kind) {
+    case EV_HK_TARGET:  sunshade_move_to(s, ev->value, SRC_HOMEKIT); break;
+    case EV_HK_HOLD:    sunshade_stop(s, SRC_HOMEKIT);               break;
+    case EV_TOUCH_UP:   sunshade_move_to(s, 100, SRC_TOUCH);         break;
+    case EV_TOUCH_DOWN: sunshade_move_to(s, 0, SRC_TOUCH);           break;
+    case EV_TOUCH_STOP: sunshade_stop(s, SRC_TOUCH);                 break;
+    case EV_WIND:
+        s->in_wind_ds = ev->value;
+        input_crossing(s, PROT_WIND, ev->value >= s->cfg.wind_close_ds,
+                       ev->value < s->cfg.wind_reopen_ds);
+        break;
+    case EV_RAIN:
+        s->in_rain = (ev->value != 0);
+        input_crossing(s, PROT_RAIN, s->in_rain, !s->in_rain);
+        break;
+    case EV_LUX:
+        s->in_lux = ev->value;
+        input_crossing(s, PROT_LUX, ev->value >= s->cfg.lux_close,
+                       ev->value < s->cfg.lux_reopen);
+        break;
+    }
+}
+
+// ── Simulation loop ─────────────────────────────────────────────────────────
+#define SIM_STEP_US  1000
+
+static void sim_init(sim_t *s, const sim_config_t *cfg, int start_pos) {
+    memset(s, 0, sizeof(*s));
+    s->cfg    = *cfg;
+    s->motion = MOTION_STOPPED;
+    position_set(s, pos_pct_to_ppm(start_pos));
+    s->tgt_pos       = s->cur_pos;
+    s->plant.pos     = (double)s->pos_ppm / (double)POS_PPM_FULL;
+    s->relay         = (relay_fsm_t)RELAY_FSM_INIT;
+    s->m.min_reverse_gap_us = -1;
+    prot_init(&s->prot);
+    for (int i = 0; i < PROT_COUNT; i++) {
+        s->cross_us[i] = -1;
+    }
+
+    int samples = (int)((cfg->gust_window_ms + cfg->wind_poll_ms - 1) / cfg->wind_poll_ms);
+    gust_init(&s->gust, samples, 64);
+    s->wind_next_us = (int64_t)cfg->wind_poll_ms * 1000;
+    s->rain_next_us = (int64_t)cfg->rain_poll_ms * 1000;
+    s->lux_next_us  = (int64_t)cfg->lux_poll_ms * 1000;
+}
+
+// Timed firmware work that is due at or before the current time.
+static void sim_timers(sim_t *s) {
+    relay_dead_time_cb(s);
+    if (s->deadline_us != 0 && s->now >= s->deadline_us) {
+        relay_cut(s);
+        motion_finish(s);
+    }
+    if (settle_take(&s->settle, sim_ms(s), s->cfg.settle_ms)) {
+        motion_cmd_t cmd = { .type = CMD_MOVE, .source = SRC_HOMEKIT,
+                             .target = s->settle.target, .t_us = s->settle.cmd_us };
+        motion_apply(s, &cmd);
+    }
+    if (s->active && s->now - s->last_tick_us >= (int64_t)s->cfg.progress_ms * 1000) {
+        s->last_tick_us = s->now;
+        position_set(s, motion_estimate(s));
+    }
+    if (s->check_at_us != 0 && s->now >= s->check_at_us) {
+        plant_advance(&s->plant, &s->cfg, s->now);
+        int32_t truth = plant_ppm(&s->plant);
+        int32_t over  = (truth - s->check_plant_ppm - s->check_span_ppm) * s->check_dir;
+        int32_t err   = truth - s->pos_ppm;
+        if (err < 0) err = -err;
+        if (over > s->m.max_overshoot_ppm) s->m.max_overshoot_ppm = over;
+        if (err > s->m.max_rest_err_ppm)   s->m.max_rest_err_ppm  = err;
+        s->check_at_us = 0;
+    }
+    while (s->now >= s->wind_next_us) {
+        wind_poll(s);
+        s->wind_next_us += (int64_t)s->cfg.wind_poll_ms * 1000;
+    }
+    while (s->now >= s->rain_next_us) {
+        rain_poll(s);
+        s->rain_next_us += (int64_t)s->cfg.rain_poll_ms * 1000;
+    }
+    if (s->now >= s->lux_next_us) {
+        lux_poll(s);
+        s->lux_next_us = s->now + (int64_t)(s->lux_fast ? s->cfg.lux_fast_ms
+                                                        : s->cfg.lux_poll_ms) * 1000;
+    }
+}
+
+// Earliest exact-time deadline inside (now, limit], so relay edges land on the
+// microsecond the firmware's esp_timer would fire rather than on a step.
+static int64_t sim_next_deadline(const sim_t *s, int64_t limit) {
+    int64_t next = limit;
+    if (s->relay.state == RELAY_DEAD_TIME && s->relay.due_us > s->now &&
+        s->relay.due_us < next) {
+        next = s->relay.due_us;
+    }
+    if (s->deadline_us != 0 && s->deadline_us > s->now && s->deadline_us < next) {
+        next = s->deadline_us;
+    }
+    return next;
+}
+
+static void sim_run(sim_t *s, const sim_event_t *events, size_t n, uint32_t duration_ms) {
+    size_t  next_ev = 0;
+    int64_t end_us  = (int64_t)duration_ms * 1000;
+
+    while (s->now <= end_us) {
+        while (next_ev < n && (int64_t)events[next_ev].t_ms * 1000 <= s->now) {
+            apply_event(s, &events[next_ev++]);
+        }
+        sim_timers(s);
+
+        int64_t step_end = s->now + SIM_STEP_US;
+        for (;;) {
+            int64_t t = sim_next_deadline(s, step_end);
+            s->now = t;
+            if (t == step_end) {
+                break;
+            }
+            sim_timers(s);
+        }
+    }
+    plant_advance(&s->plant, &s->cfg, s->now);
+}
+
+// ── Scenarios ───────────────────────────────────────────────────────────────
+typedef struct {
+    int32_t  max_err_ppm;       // final and per-segment |estimate - plant|
+    int32_t  max_overshoot_ppm;
+    uint32_t max_starts;
+    uint32_t max_hk_p99_ms;     // 0 = not checked
+    uint32_t max_touch_p99_ms;
+    uint32_t max_decision_ms;
+    uint32_t max_missed;
+    int      expect_target;     // final commanded target, -1 = not checked
+} limits_t;
+
+typedef struct {
+    const char  *name;
+    int          start_pos;
+    uint32_t     duration_ms;
+    sim_config_t cfg;
+    sim_event_t  events[MAX_EVENTS];
+    size_t       n;
+    limits_t     lim;
+} scenario_t;
+
+static void add_event(scenario_t *sc, uint32_t t_ms, event_kind_t kind, int value) {
+    if (sc->n < MAX_EVENTS) {
+        sc->events[sc->n++] = (sim_event_t){ t_ms, kind, value };
+    }
+}
+
+// Deterministic noise so the traces, and with them the metrics, are stable.
+static uint32_t s_rng = 0x5eed1234u;
+static int rng_range(int lo, int hi) {
+    s_rng = s_rng * 1664525u + 1013904223u;
+    return lo + (int)((s_rng >> 8) % (uint32_t)(hi - lo + 1));
+}
+
+// A slider drag: eight intermediate targets 40 ms apart must cost one start.
+static void build_slider_burst(scenario_t *sc) {
+    sc->name        = "slider burst";
+    sc->start_pos   = 0;
+    sc->duration_ms = 30000;
+    for (int i = 1; i <= 8; i++) {
+        add_event(sc, 1000 + (uint32_t)i * 40, EV_HK_TARGET, i * 10);
+    }
+    sc->lim = (limits_t){ .max_err_ppm = 50, .max_overshoot_ppm = 50, .max_starts = 1,
+                          .max_hk_p99_ms = 300, .expect_target = 80 };
+}
+
+// Touch reversal mid-travel, a stop, then two HomeKit writes inside one
+// settle window and a repeat of the current target.
+static void build_reversal(scenario_t *sc) {
+    sc->name        = "reversal";
+    sc->start_pos   = 50;
+    sc->duration_ms = 40000;
+    add_event(sc, 0,     EV_TOUCH_UP,   0);
+    add_event(sc, 3000,  EV_TOUCH_DOWN, 0);
+    add_event(sc, 6000,  EV_TOUCH_STOP, 0);
+    add_event(sc, 7000,  EV_HK_TARGET,  75);
+    add_event(sc, 7100,  EV_HK_TARGET,  25);
+    add_event(sc, 25000, EV_HK_TARGET,  25);
+    sc->lim = (limits_t){ .max_err_ppm = 100, .max_overshoot_ppm = 50, .max_starts = 3,
+                          .max_hk_p99_ms = 300, .max_touch_p99_ms = 600,
+                          .expect_target = 25 };
+}
+
+// Breezy afternoon sampled once a second: a short gust burst, calm, then a
+// sustained storm whose lulls dip to just above the reopen threshold. Each
+// storm must close once and reopen once, with no chatter in between.
+static void build_gusty(scenario_t *sc) {
+    sc->name        = "gusty afternoon";
+    sc->start_pos   = 0;
+    sc->duration_ms = 900000;
+    add_event(sc, 1000, EV_HK_TARGET, 80);
+    for (uint32_t t = 0; t < 900; t++) {
+        int ds;
+        if (t >= 120 && t < 130) {
+            ds = (t % 2) ? rng_range(82, 95) : rng_range(35, 48);
+        } else if (t >= 400 && t < 600) {
+            ds = (t % 7 == 0) ? rng_range(52, 60) : rng_range(65, 100);
+        } else {
+            ds = rng_range(15, 45);
+        }
+        add_event(sc, t * 1000 + 370, EV_WIND, ds);     // not aligned to the poll
+    }
+    sc->lim = (limits_t){ .max_err_ppm = 100, .max_overshoot_ppm = 50, .max_starts = 5,
+                          .max_hk_p99_ms = 300, .max_decision_ms = 600,
+                          .expect_target = 80 };
+}
+
+// Sun closes the shade, rain takes over, a HomeKit write during protection is
+// deferred and becomes the position restored once both have cleared. A rain
+// blip shorter than the debounce must not move anything.
+static void build_sun_rain(scenario_t *sc) {
+    sc->name        = "sun then rain";
+    sc->start_pos   = 0;
+    sc->duration_ms = 400000;
+    add_event(sc, 0,      EV_LUX,       15000);
+    add_event(sc, 1000,   EV_HK_TARGET, 60);
+    add_event(sc, 50000,  EV_LUX,       32000);
+    add_event(sc, 60000,  EV_LUX,       42000);
+    add_event(sc, 100000, EV_RAIN,      1);
+    add_event(sc, 101000, EV_RAIN,      0);
+    add_event(sc, 120000, EV_RAIN,      1);
+    add_event(sc, 150000, EV_HK_TARGET, 30);
+    add_event(sc, 200000, EV_LUX,       15000);
+    add_event(sc, 300000, EV_RAIN,      0);
+    sc->lim = (limits_t){ .max_err_ppm = 100, .max_overshoot_ppm = 50, .max_starts = 3,
+                          .max_hk_p99_ms = 300, .max_decision_ms = 3000, .max_missed = 1,
+                          .expect_target = 30 };
+}
+
+// A gust lands while a HomeKit write is still settling. The protection drops
+// the write, so the arbiter must restore it, not the target from before it.
+static void build_settle_gust(scenario_t *sc) {
+    sc->name        = "settle then gust";
+    sc->start_pos   = 20;
+    sc->duration_ms = 60000;
+    add_event(sc, 1400,  EV_HK_TARGET, 80);
+    add_event(sc, 1410,  EV_WIND,      100);
+    add_event(sc, 10000, EV_WIND,      20);
+    sc->lim = (limits_t){ .max_err_ppm = 100, .max_overshoot_ppm = 50, .max_starts = 2,
+                          .max_decision_ms = 600, .expect_target = 80 };
+}
+
+// Long mixed traffic with asymmetric relay lag and a motor 0.2 % slower than
+// calibrated: measures how far the time-based estimate drifts between homings.
+static void build_drift(scenario_t *sc) {
+    sc->name        = "drift";
+    sc->start_pos   = 0;
+    sc->duration_ms = 0;
+    sc->cfg.motor_ms   = 20040;
+    sc->cfg.operate_us = 8000;
+    sc->cfg.release_us = 14000;
+
+    uint32_t t = 1000;
+    for (int i = 0; i < 400; i++) {
+        int pick = rng_range(0, 9);
+        if (pick < 6) {
+            add_event(sc, t, EV_HK_TARGET, rng_range(0, 100));
+        } else if (pick == 6) {
+            add_event(sc, t, EV_TOUCH_UP, 0);
+        } else if (pick == 7) {
+            add_event(sc, t, EV_TOUCH_DOWN, 0);
+        } else {
+            add_event(sc, t, EV_TOUCH_STOP, 0);
+        }
+        t += (uint32_t)rng_range(300, 25000);
+    }
+    sc->duration_ms = t + 30000;
+    sc->lim = (limits_t){ .max_err_ppm = 4000, .max_overshoot_ppm = 1000,
+                          .max_starts = 400, .max_hk_p99_ms = 800,
+                          .max_touch_p99_ms = 600, .expect_target = -1 };
+}
+
+// ── Reporting ───────────────────────────────────────────────────────────────
+static int g_failures = 0;
+
+static void limit_check(const char *scenario, const char *what, long long value,
+                        long long limit, bool ok) {
+    if (!ok) {
+        g_failures++;
+        printf("  FAIL: %s: %s = %lld (limit %lld)\n", scenario, what, value, limit);
+    }
+}
+
+static uint32_t p99_ms(const lat_hist_t *h) {
+    return (lat_percentile_us(h, 99) + 999) / 1000;
+}
+
+static void report(const char *name, const sim_t *s) {
+    int32_t err = plant_ppm(&s->plant) - s->pos_ppm;
+    if (err < 0) err = -err;
+
+    printf("%-16s %7ld %9ld %6lu %7lu %7lu %8lu %8lu %6lu\n", name,
+           (long)(err > s->m.max_rest_err_ppm ? err : s->m.max_rest_err_ppm),
+           (long)s->m.max_overshoot_ppm, (unsigned long)s->m.relay_starts,
+           (unsigned long)s->m.hk_relay.count, (unsigned long)p99_ms(&s->m.hk_relay),
+           (unsigned long)p99_ms(&s->m.touch_relay), (unsigned long)p99_ms(&s->m.decision),
+           (unsigned long)s->m.missed);
+}
+
+static void report_header(void) {
+    printf("%-16s %7s %9s %6s %7s %7s %8s %8s %6s\n", "scenario", "err", "overshoot",
+           "starts", "hk_cmds", "hk_p99", "touch99", "decide99", "missed");
+    printf("%-16s %7s %9s %6s %7s %7s %8s %8s %6s\n", "", "ppm", "ppm", "",
+           "", "ms", "ms", "ms", "");
+}
+
+static void run_scenario(scenario_t *sc) {
+    static sim_t s;
+    sim_init(&s, &sc->cfg, sc->start_pos);
+    sim_run(&s, sc->events, sc->n, sc->duration_ms);
+    report(sc->name, &s);
+
+    const limits_t *l = &sc->lim;
+    int32_t err = plant_ppm(&s.plant) - s.pos_ppm;
+    if (err < 0) err = -err;
+    if (s.m.max_rest_err_ppm > err) err = s.m.max_rest_err_ppm;
+
+    limit_check(sc->name, "position error ppm", err, l->max_err_ppm, err <= l->max_err_ppm);
+    limit_check(sc->name, "overshoot ppm", s.m.max_overshoot_ppm, l->max_overshoot_ppm,
+                s.m.max_overshoot_ppm <= l->max_overshoot_ppm);
+    limit_check(sc->name, "relay starts", s.m.relay_starts, l->max_starts,
+                s.m.relay_starts <= l->max_starts);
+    limit_check(sc->name, "relay starts vs cuts", s.m.relay_cuts, s.m.relay_starts,
+                s.m.relay_cuts == s.m.relay_starts);
+    limit_check(sc->name, "missed crossings", s.m.missed, l->max_missed,
+                s.m.missed <= l->max_missed);
+    if (s.m.min_reverse_gap_us >= 0) {
+        int64_t need = (int64_t)sc->cfg.reverse_ms * 1000;
+        limit_check(sc->name, "reversal gap us", s.m.min_reverse_gap_us, need,
+                    s.m.min_reverse_gap_us >= need);
+    }
+    if (l->max_hk_p99_ms) {
+        limit_check(sc->name, "hk p99 ms", p99_ms(&s.m.hk_relay), l->max_hk_p99_ms,
+                    p99_ms(&s.m.hk_relay) <= l->max_hk_p99_ms);
+    }
+    if (l->max_touch_p99_ms) {
+        limit_check(sc->name, "touch p99 ms", p99_ms(&s.m.touch_relay), l->max_touch_p99_ms,
+                    p99_ms(&s.m.touch_relay) <= l->max_touch_p99_ms);
+    }
+    if (l->max_decision_ms) {
+        limit_check(sc->name, "decision p99 ms", p99_ms(&s.m.decision), l->max_decision_ms,
+                    p99_ms(&s.m.decision) <= l->max_decision_ms);
+    }
+    if (l->expect_target >= 0) {
+        limit_check(sc->name, "final target", s.tgt_pos, l->expect_target,
+                    s.tgt_pos == l->expect_target && !s.active);
+    }
+}
+
+// ── Trace replay ────────────────────────────────────────────────────────────
+static bool parse_event_name(const char *name, event_kind_t *kind) {
+    static const struct { const char *name; event_kind_t kind; } names[] = {
+        { "hk",    EV_HK_TARGET  }, { "hold", EV_HK_HOLD }, { "up",   EV_TOUCH_UP },
+        { "down",  EV_TOUCH_DOWN }, { "stop", EV_TOUCH_STOP },
+        { "wind",  EV_WIND       }, { "rain", EV_RAIN    }, { "lux",  EV_LUX      },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i].name) == 0) {
+            *kind = names[i].kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int replay_file(const char *path) {
+    static scenario_t sc;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        printf("cannot open %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    sc.name = path;
+    sc.cfg  = config_default();
+    char line[128];
+    int  lineno = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        unsigned long t_ms;
+        char          name[16];
+        int           value = 0;
+        event_kind_t  kind;
+        if (sscanf(line, "%lu,%15[a-z],%d", &t_ms, name, &value) < 2 ||
+            !parse_event_name(name, &kind)) {
+            printf("%s:%d: cannot parse \"%s\"\n", path, lineno, strtok(line, "\n"));
+            fclose(f);
+            return EXIT_FAILURE;
+        }
+        if (sc.n > 0 && t_ms < sc.events[sc.n - 1].t_ms) {
+            printf("%s:%d: events must be in time order\n", path, lineno);
+            fclose(f);
+            return EXIT_FAILURE;
+        }
+        add_event(&sc, (uint32_t)t_ms, kind, value);
+    }
+    fclose(f);
+
+    sc.duration_ms = (sc.n > 0 ? sc.events[sc.n - 1].t_ms : 0) + 60000;
+
+    static sim_t s;
+    sim_init(&s, &sc.cfg, 0);
+    sim_run(&s, sc.events, sc.n, sc.duration_ms);
+    report_header();
+    report("replay", &s);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        return replay_file(argv[1]);
+    }
+
+    static void (*const builders[])(scenario_t *) = {
+        build_slider_burst, build_reversal, build_gusty, build_sun_rain, build_settle_gust,
+        build_drift,
+    };
+
+    printf("== sunshade motor/sensor simulation ==\n");
+    report_header();
+    for (size_t i = 0; i < sizeof(builders) / sizeof(builders[0]); i++) {
+        static scenario_t sc;
+        memset(&sc, 0, sizeof(sc));
+        sc.cfg = config_default();
+        builders[i](&sc);
+        run_scenario(&sc);
+    }
+
+    printf("\n%d limit failures\n", g_failures);
+    if (g_failures != 0) {
+        printf("RESULT: FAIL\n");
+        return EXIT_FAILURE;
+    }
+    printf("RESULT: PASS\n");
+    return EXIT_SUCCESS;
+}
@@ -3,10 +3,15 @@
 
    Host-side unit tests for the pure sunshade logic. These compile with a plain
    host compiler (no ESP-IDF) and run in CI to guard the hardware-independent
-   behaviour: relay polarity, position math, sensor conversions and hysteresis.
+   behaviour: relay polarity, position math and the travel model, the relay
+   driver, motion segments and settle window, sensor conversions,
+   hysteresis, the protection arbiter, the gust filter, the position journal
+   record format, the shade config blob, the latency histogram, the binary
+   event log, the telemetry history and the solar position and exposure
+   schedule.
 
    Build & run:
-       cc -std=c11 -Wall -Wextra -Werror -I main test/test_sunshade_logic.c -o /tmp/t && /tmp/t
+       cc -std=c11 -Wall -Wextra -Werror -I main test/test_sunshade_logic.c -o /tmp/t -lm && /tmp/t
  **/
 
 #include <stdio.h>
@@ -54,14 +59,176 @@ static void test_clamp_position(void) {
     CHECK(clamp_position(101) == 100);
 }
 
-static void test_position_delta(void) {
-    printf("position_delta_per_tick\n");
-    // 20 s full travel, 500 ms tick -> 2.5 % per tick.
-    CHECK_FLOAT(position_delta_per_tick(20000, 500), 2.5f);
-    // 10 s full travel, 500 ms tick -> 5 % per tick.
-    CHECK_FLOAT(position_delta_per_tick(10000, 500), 5.0f);
+static void test_position_model(void) {
+    printf("fixed-point position model\n");
+    CHECK(pos_pct_to_ppm(37)  == 370000);
+    CHECK(pos_pct_to_ppm(120) == POS_PPM_FULL);
+    CHECK(pos_ppm_to_pct(374999) == 37);
+    CHECK(pos_ppm_to_pct(375000) == 38);
+    CHECK(pos_ppm_to_pct(-5) == 0);
+    CHECK(pos_ppm_to_pct(POS_PPM_FULL + 9) == 100);
+    CHECK(pos_ppm_to_pm(379500) == 380);
+
+    // 20 s full travel: 500 ms covers 2.5 %, the full time covers 100 %.
+    CHECK(pos_ppm_travelled(500000, 20000) == 25000);
+    CHECK(pos_ppm_travelled(20000000, 20000) == POS_PPM_FULL);
+    CHECK(pos_ppm_travelled(90000000, 20000) == POS_PPM_FULL);
+    CHECK(pos_ppm_travelled(-1000, 20000) == 0);
     // Guard against divide-by-zero (treated as 1 ms travel).
-    CHECK(position_delta_per_tick(0, 500) > 0.0f);
+    CHECK(pos_ppm_travelled(500, 0) == 500000);
+
+    // Run time is the inverse, rounded up.
+    CHECK(pos_ppm_run_us(250000, 20000) == 5000000);
+    CHECK(pos_ppm_run_us(-250000, 20000) == 5000000);
+    CHECK(pos_ppm_run_us(1, 20000) == 20);
+    CHECK(pos_ppm_travelled(pos_ppm_run_us(333333, 17777), 17777) >= 333333);
+
+    // Estimates move towards the target and are capped at it.
+    CHECK(pos_ppm_estimate(200000, 800000, 2000000, 20000) == 300000);
+    CHECK(pos_ppm_estimate(200000, 800000, 60000000, 20000) == 800000);
+    CHECK(pos_ppm_estimate(800000, 200000, 2000000, 20000) == 700000);
+    CHECK(pos_ppm_estimate(800000, 200000, 60000000, 20000) == 200000);
+    CHECK(pos_ppm_estimate(500000, 900000, -3000, 20000) == 500000);
+
+    // Many interrupted moves of odd lengths drift < 1 ppm each against the
+    // exact position (the old integer-percent segments could lose ~1 % each).
+    const uint32_t travel_ms = 23456;
+    int32_t model = 0;
+    double  exact = 0.0;
+    uint32_t seed = 12345;
+    int moves = 2000;
+    for (int i = 0; i < moves; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int64_t run_us = 1000 + (int64_t)((seed >> 8) % 4000000u);
+        bool    up     = (exact < 500000.0) ? true : ((seed >> 3) & 1u);
+        int32_t target = up ? POS_PPM_FULL : 0;
+        int32_t next   = pos_ppm_estimate(model, target, run_us, travel_ms);
+        double  d      = (double)run_us * 1000.0 / (double)travel_ms;
+        exact = up ? exact + d : exact - d;
+        if (exact > POS_PPM_FULL) exact = POS_PPM_FULL;
+        if (exact < 0.0)          exact = 0.0;
+        // Clamping at the end stops resynchronises both models.
+        if (next == POS_PPM_FULL || next == 0) exact = next;
+        model = next;
+    }
+    double err = (double)model - exact;
+    if (err < 0) err = -err;
+    CHECK(err <= (double)moves);
+    CHECK(err < (double)POS_PPM_PER_PCT);
+}
+
+static void test_travel_model(void) {
+    printf("asymmetric travel model\n");
+    travel_model_t m = { .open_ms = 20000, .close_ms = 16000, .lag_ms = 500 };
+
+    // Nothing moves during the lag; then each direction runs at its own rate.
+    CHECK(travel_estimate(&m, 200000, 800000, 400000) == 200000);
+    CHECK(travel_estimate(&m, 200000, 800000, 2500000) == 300000);
+    CHECK(travel_estimate(&m, 800000, 200000, 2100000) == 700000);
+    CHECK(travel_estimate(&m, 800000, 200000, 60000000) == 200000);
+    CHECK(travel_run_us(&m, 0, POS_PPM_FULL) == 20500000);
+    CHECK(travel_run_us(&m, POS_PPM_FULL, 0) == 16500000);
+    CHECK(travel_run_us(&m, 600000, 100000) == 8500000);
+    CHECK(travel_estimate(&m, 100000, 700000, travel_run_us(&m, 100000, 700000)) == 700000);
+
+    // Learning converges from the symmetric calibration to the true motor,
+    // from end-stop runs of mixed lengths in both directions.
+    const travel_model_t truth = { .open_ms = 21000, .close_ms = 15500, .lag_ms = 350 };
+    travel_model_t       learn = { .open_ms = 20000, .close_ms = 20000, .lag_ms = 0 };
+    static const int spans_pct[] = { 100, 60, 100, 35, 80, 100, 50, 25 };
+    for (int i = 0; i < 40; i++) {
+        bool     opening = (i & 1) != 0;
+        int32_t  span    = pos_pct_to_ppm(spans_pct[i % 8]);
+        uint32_t obs     = (uint32_t)(travel_run_us(&truth, 0, opening ? span : -span) / 1000);
+        CHECK(travel_learn(&learn, opening, span, obs));
+    }
+    // Every run length is then predicted within 1.5 %, in both directions.
+    for (int pct = 25; pct <= 100; pct += 25) {
+        int32_t span = pos_pct_to_ppm(pct);
+        for (int up = 0; up <= 1; up++) {
+            int64_t want = travel_run_us(&truth, 0, up ? span : -span);
+            int64_t got  = travel_run_us(&learn, 0, up ? span : -span);
+            int64_t diff = (got > want) ? got - want : want - got;
+            CHECK(diff * 1000 <= want * 15);
+        }
+    }
+    CHECK(learn.close_ms < 16000 && learn.open_ms > 21000);
+
+    // Short runs and outliers leave the model alone.
+    travel_model_t before = learn;
+    CHECK(!travel_learn(&learn, true, pos_pct_to_ppm(10), 2000));
+    CHECK(!travel_learn(&learn, true, POS_PPM_FULL, 40000));     // stalled
+    CHECK(!travel_learn(&learn, false, POS_PPM_FULL, 5000));     // missed end stop
+    CHECK(learn.open_ms == before.open_ms && learn.close_ms == before.close_ms &&
+          learn.lag_ms == before.lag_ms);
+
+    // The lag stays within bounds however the runs fall.
+    travel_model_t slow = { .open_ms = 20000, .close_ms = 20000, .lag_ms = TRAVEL_LAG_MAX_MS };
+    CHECK(travel_learn(&slow, true, pos_pct_to_ppm(20), 8000));
+    CHECK(slow.lag_ms == TRAVEL_LAG_MAX_MS);
+}
+
+static void test_relay_driver(void) {
+    printf("relay driver\n");
+    relay_fsm_t r    = RELAY_FSM_INIT;
+    int64_t     dead = 500000;
+
+    // First start and a repeat in the same direction energise at once.
+    CHECK(relay_fsm_request(&r, MOTION_OPENING, 1000000, dead) == 0);
+    CHECK(relay_fsm_open(&r) && !relay_fsm_close(&r));
+    CHECK(relay_fsm_request(&r, MOTION_OPENING, 1100000, dead) == 0);
+    CHECK(r.state == RELAY_ON_OPEN);
+
+    // A reversal cuts now and waits out the full dead time.
+    CHECK(relay_fsm_request(&r, MOTION_CLOSING, 2000000, dead) == dead);
+    CHECK(r.state == RELAY_DEAD_TIME && r.pending == MOTION_CLOSING);
+    CHECK(!relay_fsm_on(&r) && r.off_us == 2000000);
+    CHECK(!relay_fsm_expire(&r, 2499999));
+    CHECK(relay_fsm_expire(&r, 2500000));
+    CHECK(relay_fsm_close(&r) && r.dir == MOTION_CLOSING);
+    CHECK(!relay_fsm_expire(&r, 2600000));
+
+    // A stop inside a dead time cancels it but keeps the original off time.
+    relay_fsm_request(&r, MOTION_OPENING, 3000000, dead);
+    relay_fsm_request(&r, MOTION_STOPPED, 3200000, dead);
+    CHECK(r.state == RELAY_OFF && r.off_us == 3000000);
+    CHECK(!relay_fsm_expire(&r, 3600000));
+    CHECK(relay_fsm_request(&r, MOTION_OPENING, 3300000, dead) == 200000);
+    CHECK(relay_fsm_request(&r, MOTION_OPENING, 3600000, dead) == 0);
+    CHECK(relay_fsm_open(&r));
+
+    // Same direction again after a stop: no dead time.
+    relay_fsm_cut(&r, 4000000);
+    CHECK(relay_fsm_request(&r, MOTION_OPENING, 4000001, dead) == 0);
+}
+
+static void test_motion_segment(void) {
+    printf("motion segments and settle window\n");
+    CHECK(motion_decide(false, 40, 70) == MOTION_OPENING);
+    CHECK(motion_decide(false, 40, 10) == MOTION_CLOSING);
+    CHECK(motion_decide(false, 40, 40) == MOTION_STOPPED);
+    CHECK(motion_decide(true, 40, 70)  == MOTION_STOPPED);
+
+    // Only moves to an end stop run on, by a fifth of that direction's travel.
+    travel_model_t m = { .open_ms = 20000, .close_ms = 16000, .lag_ms = 500 };
+    CHECK(motion_run_us(&m, 200000, 60) == travel_run_us(&m, 200000, 600000));
+    CHECK(motion_run_us(&m, 200000, 100) == travel_run_us(&m, 200000, POS_PPM_FULL) + 4000000);
+    CHECK(motion_run_us(&m, 200000, 0) == travel_run_us(&m, 200000, 0) + 3200000);
+
+    // Each write restarts the window; the last one is taken once it expires.
+    settle_window_t w = {0};
+    CHECK(settle_wait_ms(&w, 1000, 200) == UINT32_MAX);
+    CHECK(settle_intent(&w, 30) == 30);
+    settle_offer(&w, 50, 1000000, 1000);
+    settle_offer(&w, 80, 1040000, 1040);
+    CHECK(settle_intent(&w, 30) == 80);
+    CHECK(settle_wait_ms(&w, 1100, 200) == 140);
+    CHECK(!settle_take(&w, 1239, 200));
+    CHECK(settle_take(&w, 1240, 200));
+    CHECK(w.target == 80 && w.cmd_us == 1040000);
+    CHECK(!settle_take(&w, 1300, 200) && settle_intent(&w, 30) == 30);
+    settle_offer(&w, 10, 2000000, 2000);
+    CHECK(settle_cancel(&w) && !settle_cancel(&w));
 }
 
 static void test_sensor_hysteresis(void) {
@@ -99,6 +266,35 @@ static void test_bh1750_lux(void) {
     CHECK(bh1750_raw_to_lux(60000) == 50000);
 }
 
+static void test_bh1750_mtreg(void) {
+    printf("bh1750 MTreg scaling + near-threshold band\n");
+    // Default MTreg matches the plain conversion.
+    CHECK(bh1750_raw_to_lux_mt(60000, BH1750_MTREG_DEFAULT) == 50000);
+    // MTreg 31: full scale widens to ~121 klux, enough for direct sun.
+    CHECK(bh1750_raw_to_lux_mt(BH1750_RAW_MAX, BH1750_MTREG_MIN) == 121557);
+    CHECK(bh1750_raw_to_lux_mt(1000, 138) == 417);
+    // Out-of-range MTreg never divides by zero.
+    CHECK(bh1750_raw_to_lux_mt(1000, 0) == 0);
+
+    // Finest MTreg that still covers the requested range.
+    CHECK(bh1750_mtreg_for_lux(54612) == BH1750_MTREG_DEFAULT);
+    CHECK(bh1750_mtreg_for_lux(50000) == 75);
+    CHECK(bh1750_raw_to_lux_mt(BH1750_RAW_MAX, bh1750_mtreg_for_lux(50000)) >= 50000);
+    CHECK(bh1750_mtreg_for_lux(200000) == BH1750_MTREG_MIN);
+    CHECK(bh1750_mtreg_for_lux(100)    == BH1750_MTREG_MAX);
+    CHECK(bh1750_mtreg_for_lux(0)      == BH1750_MTREG_MAX);
+
+    // Open: only the close threshold (40000, margin 10000) matters.
+    CHECK(lux_near_threshold(false, 30000, 40000, 20000));
+    CHECK(lux_near_threshold(false, 50000, 40000, 20000));
+    CHECK(!lux_near_threshold(false, 29999, 40000, 20000));
+    CHECK(!lux_near_threshold(false, 20000, 40000, 20000));
+    // Closed: only the reopen threshold (20000, margin 5000) matters.
+    CHECK(lux_near_threshold(true, 20000, 40000, 20000));
+    CHECK(!lux_near_threshold(true, 40000, 40000, 20000));
+    CHECK(!lux_near_threshold(true, 14999, 40000, 20000));
+}
+
 static void test_sht3x(void) {
     printf("sht3x conversions + CRC\n");
     // Datasheet endpoints: raw 0 -> -45 C, raw 65535 -> +130 C.
@@ -115,15 +311,528 @@ static void test_sht3x(void) {
     CHECK(sensirion_crc8(0x00, 0x00) == 0x81);
 }
 
+static void test_prot_arbiter(void) {
+    printf("protection arbiter\n");
+    prot_arbiter_t a;
+    prot_init(&a);
+    CHECK(prot_owner(&a) == -1);
+    CHECK(prot_user_move(&a, 70));
+
+    // Lux engages at 70 %: save 70, close.
+    CHECK(prot_update(&a, PROT_LUX, true, 70) == 0);
+    CHECK(a.user_pos == 70);
+    CHECK(prot_owner(&a) == PROT_LUX);
+    // Repeated engage is ignored.
+    CHECK(prot_update(&a, PROT_LUX, true, 0) == PROT_NO_MOVE);
+
+    // Wind joins while already closed: takes ownership, no extra move, and
+    // the saved user position is not overwritten with 0.
+    CHECK(prot_update(&a, PROT_WIND, true, 0) == PROT_NO_MOVE);
+    CHECK(prot_owner(&a) == PROT_WIND);
+    CHECK(a.user_pos == 70);
+
+    // Lux clears first: wind still holds, nothing moves.
+    CHECK(prot_update(&a, PROT_LUX, false, 0) == PROT_NO_MOVE);
+    CHECK(prot_is_active(&a, PROT_WIND));
+    CHECK(!prot_is_active(&a, PROT_LUX));
+
+    // User moves while protected are deferred and become the restore target.
+    CHECK(!prot_user_move(&a, 40));
+    CHECK(a.user_pos == 40);
+
+    // Last protection clears: restore the (latest) user position once.
+    CHECK(prot_update(&a, PROT_WIND, false, 0) == 40);
+    CHECK(prot_owner(&a) == -1);
+    CHECK(prot_update(&a, PROT_WIND, false, 40) == PROT_NO_MOVE);
+    CHECK(prot_user_move(&a, 100));
+
+    // Engaging when already at the hold position, and restoring to where the
+    // shade already is, are both dropped.
+    CHECK(prot_update(&a, PROT_RAIN, true, 0) == PROT_NO_MOVE);
+    CHECK(prot_update(&a, PROT_RAIN, false, 0) == PROT_NO_MOVE);
+
+    // Priority decides the hold position when protections disagree.
+    a.hold_pos[PROT_LUX] = 30;
+    CHECK(prot_update(&a, PROT_LUX, true, 80) == 30);
+    CHECK(prot_update(&a, PROT_RAIN, true, 30) == 0);
+    CHECK(prot_update(&a, PROT_RAIN, false, 0) == 30);
+    CHECK(prot_update(&a, PROT_LUX, false, 30) == 80);
+
+    // Wind engages during homing: the close it asks for is dropped, so the end
+    // of homing holds the shade closed instead of restoring the boot target,
+    // which is restored once the wind clears.
+    prot_init(&a);
+    CHECK(prot_update(&a, PROT_WIND, true, 0) == PROT_NO_MOVE);
+    CHECK(prot_resume(&a, 70) == 0);
+    CHECK(prot_is_active(&a, PROT_WIND));
+    CHECK(prot_update(&a, PROT_WIND, false, 0) == 70);
+
+    // Engaged and released within the lockout: the boot target is restored.
+    CHECK(prot_update(&a, PROT_RAIN, true, 0) == PROT_NO_MOVE);
+    CHECK(prot_update(&a, PROT_RAIN, false, 0) == PROT_NO_MOVE);
+    CHECK(prot_resume(&a, 55) == 55);
+    CHECK(prot_user_move(&a, 55));
+}
+
+static void test_gust_filter(void) {
+    printf("gust_filter\n");
+    gust_filter_t g;
+    gust_init(&g, 4, 128);
+    CHECK(gust_max(&g) == 0 && gust_mean(&g) == 0);
+
+    // A single gust is held for exactly one window, then expires.
+    const int32_t in[] = { 10, 20, 80, 30, 20, 10, 10, 10 };
+    const int32_t peak[] = { 10, 20, 80, 80, 80, 80, 30, 20 };
+    for (int i = 0; i < 8; i++) {
+        gust_push(&g, in[i]);
+        CHECK(gust_max(&g) == peak[i]);
+    }
+    CHECK(gust_mean(&g) == 12);          // (20 + 10 + 10 + 10) / 4
+
+    // EMA with alpha 1/2 converges on a constant input.
+    gust_init(&g, 4, 128);
+    gust_push(&g, 0);
+    gust_push(&g, 100);
+    CHECK(gust_ema(&g) == 50);
+    for (int i = 0; i < 20; i++) gust_push(&g, 100);
+    CHECK(gust_ema(&g) >= 99);
+
+    // Rolling max and mean match a brute-force window over a long sequence.
+    gust_init(&g, 7, 64);
+    uint32_t lcg = 12345;
+    int32_t  hist[200];
+    int      mismatches = 0;
+    for (int i = 0; i < 200; i++) {
+        lcg     = lcg * 1103515245u + 12345u;
+        hist[i] = (int32_t)((lcg >> 16) % 150);
+        gust_push(&g, hist[i]);
+        int32_t mx = hist[i], sum = 0;
+        int     n  = 0;
+        for (int j = i; j >= 0 && j > i - 7; j--, n++) {
+            if (hist[j] > mx) mx = hist[j];
+            sum += hist[j];
+        }
+        if (gust_max(&g) != mx || gust_mean(&g) != sum / n) mismatches++;
+    }
+    CHECK(mismatches == 0);
+}
+
+static journal_record_t make_record(uint32_t seq, uint16_t pos_pm, uint8_t target) {
+    journal_record_t r = {0};
+    r.seq    = seq;
+    r.pos_pm = pos_pm;
+    r.target = target;
+    r.flags  = JOURNAL_F_STOPPED;
+    journal_seal(&r);
+    return r;
+}
+
+static void test_journal(void) {
+    printf("journal\n");
+    CHECK(sizeof(journal_record_t) == 16);
+    CHECK(crc16_ccitt((const uint8_t *)"123456789", 9) == 0x29B1);
+
+    journal_record_t r = make_record(7, 425, 50);
+    CHECK(journal_valid(&r));
+    r.target = 51;                       // corrupt a payload byte
+    CHECK(!journal_valid(&r));
+
+    journal_record_t blank = {0};        // never-written slot
+    CHECK(!journal_valid(&blank));
+
+    journal_record_t ring[4] = {
+        make_record(10, 0, 0), make_record(11, 500, 50),
+        make_record(8, 1000, 100), make_record(9, 300, 30),
+    };
+    CHECK(journal_newest(ring, 4) == 1);
+
+    ring[1].crc ^= 1;                    // torn write: fall back to previous record
+    CHECK(journal_newest(ring, 4) == 0);
+
+    // Sequence wrap-around: 0x00000001 is newer than 0xFFFFFFFF.
+    journal_record_t wrap[2] = { make_record(0xFFFFFFFFu, 0, 0), make_record(1, 0, 0) };
+    CHECK(journal_newest(wrap, 2) == 1);
+
+    journal_record_t none[2] = { {0}, {0} };
+    CHECK(journal_newest(none, 2) == -1);
+
+    journal_record_t clean = make_record(3, 500, 50);
+    CHECK(journal_clean(&clean));
+    journal_record_t moving = clean;
+    moving.flags = 0;
+    journal_seal(&moving);
+    CHECK(!journal_clean(&moving));
+    journal_record_t off_target = make_record(3, 420, 50);
+    CHECK(!journal_clean(&off_target));
+    // A stop mid-move settles on the nearest percent; per-mille may differ.
+    journal_record_t partial = make_record(3, 375, 37);
+    CHECK(journal_clean(&partial));
+    journal_record_t partial_off = make_record(3, 376, 37);
+    CHECK(!journal_clean(&partial_off));
+}
+
+static void test_shade_config(void) {
+    printf("shade config blob\n");
+    CHECK(sizeof(shade_config_t) == 16);
+    CHECK(offsetof(shade_config_t, crc) == 14);
+    CHECK(sizeof(shade_config_v1_t) == 12);
+    CHECK(offsetof(shade_config_v1_t, crc) == 10);
+
+    shade_config_t cfg = {0};
+    CHECK(!shade_config_valid(&cfg));              // blank blob
+    CHECK(shade_config_cal_ms(&cfg) == 0);
+
+    cfg.cal_ms     = 21500;
+    cfg.flags      = SHADE_CFG_F_CALIBRATED;
+    cfg.fast_boots = 3;
+    shade_config_seal(&cfg);
+    CHECK(cfg.version == SHADE_CONFIG_VERSION);
+    CHECK(shade_config_valid(&cfg));
+    CHECK(shade_config_cal_ms(&cfg) == 21500);
+
+    shade_config_t torn = cfg;
+    torn.fast_boots = 4;                           // field changed without reseal
+    CHECK(!shade_config_valid(&torn));
+
+    shade_config_t future = cfg;
+    future.version = SHADE_CONFIG_VERSION + 1;
+    future.crc = crc16_ccitt((const uint8_t *)&future, offsetof(shade_config_t, crc));
+    CHECK(!shade_config_valid(&future));           // unknown layout is not trusted
+
+    shade_config_t uncal = cfg;
+    uncal.flags = 0;
+    shade_config_seal(&uncal);
+    CHECK(shade_config_valid(&uncal));
+    CHECK(shade_config_cal_ms(&uncal) == 0);
+
+    // Version 1 blobs convert; the learned fields start out unset.
+    shade_config_v1_t v1 = { .cal_ms = 18000, .version = SHADE_CONFIG_V1_VERSION,
+                             .flags = SHADE_CFG_F_CALIBRATED, .fast_boots = 2 };
+    v1.crc = crc16_ccitt((const uint8_t *)&v1, offsetof(shade_config_v1_t, crc));
+    shade_config_t conv;
+    CHECK(shade_config_from_v1(&v1, &conv));
+    CHECK(shade_config_cal_ms(&conv) == 18000);
+    CHECK(conv.fast_boots == 2 && conv.close_ms == 0 && conv.lag_ms == 0);
+    CHECK(!(conv.flags & SHADE_CFG_F_LEARNED));
+    v1.fast_boots = 3;
+    CHECK(!shade_config_from_v1(&v1, &conv));      // torn
+
+    // Model: seeded from the open time until something has been learned.
+    travel_model_t m = shade_config_model(&conv, 20000, 80, 250);
+    CHECK(m.open_ms == 18000 && m.close_ms == 14400 && m.lag_ms == 250);
+    m = shade_config_model(&uncal, 20000, 100, 0);
+    CHECK(m.open_ms == 20000 && m.close_ms == 20000 && m.lag_ms == 0);
+    conv.flags   |= SHADE_CFG_F_LEARNED;
+    conv.close_ms = 13900;
+    conv.lag_ms   = 420;
+    m = shade_config_model(&conv, 20000, 80, 250);
+    CHECK(m.open_ms == 18000 && m.close_ms == 13900 && m.lag_ms == 420);
+}
+
+static void test_motion_seqlock(void) {
+    printf("motion state seqlock\n");
+    motion_seqlock_t l = MSTATE_INIT(0, 0, 0, 2);
+    motion_state_t   st;
+
+    CHECK(mstate_try_read(&l, &st));
+    CHECK(st.pos_ppm == 0 && st.pos == 0 && st.target == 0 && st.dir == 2);
+
+    motion_state_t w = { .pos_ppm = POS_PPM_FULL, .pos = 100, .target = 37, .dir = 0 };
+    mstate_write(&l, &w);
+    st = mstate_read(&l);
+    CHECK(st.pos_ppm == POS_PPM_FULL);
+    CHECK(st.pos == 100 && st.target == 37 && st.dir == 0);
+    CHECK(atomic_load(&l.seq) == 2);
+
+    // A reader that overlaps a write must retry rather than use the words.
+    mstate_write_begin(&l);
+    CHECK(!mstate_try_read(&l, &st));
+    mstate_write_end(&l);
+    CHECK(mstate_try_read(&l, &st));
+    CHECK(st.target == 37);
+}
+
+static void test_endstop_detector(void) {
+    printf("end-stop detector\n");
+    int dc[]  = { 1500, 1502, 1498, 1501 };
+    int ac[]  = { 1500, 1900, 1500, 1100 };
+    CHECK(current_amplitude(dc, 4, 1500) == 2);
+    CHECK(current_amplitude(ac, 4, 1500) == 400);
+    CHECK(current_amplitude(ac, 0, 1500) == 0);
+
+    endstop_detector_t d;
+    endstop_init(&d, 200, 80, 300);
+
+    // A dead sensor or a motor already at its end stop never counts.
+    CHECK(endstop_push(&d, 10, 0) == ENDSTOP_WAIT);
+    CHECK(endstop_push(&d, 10, 5000) == ENDSTOP_WAIT);
+
+    CHECK(endstop_push(&d, 400, 5100) == ENDSTOP_RUNNING);
+    CHECK(endstop_push(&d, 150, 5200) == ENDSTOP_RUNNING);    // between thresholds
+    CHECK(endstop_push(&d, 20, 5300) == ENDSTOP_RUNNING);
+    CHECK(d.below_since_ms == 5300);
+    CHECK(endstop_push(&d, 400, 5400) == ENDSTOP_RUNNING);    // a blip resets
+    CHECK(endstop_push(&d, 20, 5500) == ENDSTOP_RUNNING);
+    CHECK(endstop_push(&d, 20, 5700) == ENDSTOP_RUNNING);
+    CHECK(endstop_push(&d, 20, 5800) == ENDSTOP_REACHED);
+    CHECK(d.below_since_ms == 5500);
+    CHECK(endstop_push(&d, 400, 5900) == ENDSTOP_REACHED);    // latched
+
+    endstop_init(&d, 200, 80, 0);
+    endstop_push(&d, 300, 0);
+    CHECK(endstop_push(&d, 0, 100) == ENDSTOP_REACHED);
+}
+
+static evlog_event_t make_event(uint32_t t, uint16_t id, int32_t v0) {
+    evlog_event_t ev = { .t_ms = t, .id = id, .v = { v0, -v0, 7, INT32_MIN } };
+    return ev;
+}
+
+static void test_event_log(void) {
+    printf("binary event log\n");
+    static evlog_ring_t r;
+    evlog_reader_t      a = {0}, b = {0};
+    evlog_event_t       ev;
+
+    CHECK(!evlog_read(&r, &a, &ev));                // empty
+
+    for (int i = 0; i < 3; i++) {
+        evlog_event_t in = make_event(100u + (uint32_t)i, 2, i * 1000);
+        evlog_write(&r, &in);
+    }
+    CHECK(evlog_read(&r, &a, &ev));
+    CHECK(ev.t_ms == 100 && ev.id == 2 && ev.v[0] == 0);
+    CHECK(evlog_read(&r, &a, &ev));
+    CHECK(ev.t_ms == 101 && ev.v[0] == 1000 && ev.v[1] == -1000);
+    CHECK(ev.v[2] == 7 && ev.v[3] == INT32_MIN);
+    CHECK(evlog_read(&r, &a, &ev) && ev.t_ms == 102);
+    CHECK(!evlog_read(&r, &a, &ev));
+    CHECK(a.lost == 0);
+
+    // A second reader drains the same records on its own.
+    int n = 0;
+    while (evlog_read(&r, &b, &ev)) n++;
+    CHECK(n == 3 && b.lost == 0);
+
+    // A reader lapped by the writers loses the oldest records, and counts them.
+    for (int i = 0; i < EVLOG_SLOTS + 10; i++) {
+        evlog_event_t in = make_event(1000u + (uint32_t)i, 5, i);
+        evlog_write(&r, &in);
+    }
+    CHECK(evlog_read(&r, &a, &ev));
+    CHECK(a.lost == 10 && ev.t_ms == 1010);
+    n = 1;
+    uint32_t last = ev.t_ms;
+    bool     ordered = true;
+    while (evlog_read(&r, &a, &ev)) {
+        ordered &= (ev.t_ms == last + 1);
+        last = ev.t_ms;
+        n++;
+    }
+    CHECK(ordered && n == EVLOG_SLOTS && last == 1000u + EVLOG_SLOTS + 9);
+
+    // A reserved slot that is not published yet holds the reader back.
+    evlog_reader_sync(&r, &b);
+    uint32_t idx = atomic_fetch_add(&r.head, 1);              // writer paused mid-write
+    atomic_store(&r.slot[idx & (EVLOG_SLOTS - 1)].stamp, 0);
+    CHECK(!evlog_read(&r, &b, &ev));
+    CHECK(b.tail == idx && b.lost == 0);
+    atomic_store(&r.slot[idx & (EVLOG_SLOTS - 1)].stamp, idx + 1);
+    CHECK(evlog_read(&r, &b, &ev));
+    CHECK(!evlog_read(&r, &b, &ev));
+}
+
+static void test_telemetry(void) {
+    printf("telemetry history\n");
+    static tele_sample_t raw[8];
+    static tele_bucket_t l1[TELE_L1_SLOTS], l2[TELE_L2_SLOTS];
+    tele_series_t s;
+    tele_sample_t r;
+    tele_bucket_t b;
+
+    tele_init(&s, raw, 8, l1, l2);
+    CHECK(!tele_raw_get(&s, 0, &r));
+    CHECK(!tele_level_open(&s.level[0], &b));
+
+    // One sample every 10 s for two minutes: 12 per 1-minute bucket.
+    for (uint32_t i = 0; i < 24; i++) {
+        tele_push(&s, 5000u + i * 10000u, (int32_t)i - 10);
+    }
+    CHECK(s.raw_total == 24);
+    CHECK(tele_first(s.raw_total, s.raw_cap) == 16);
+    CHECK(!tele_raw_get(&s, 15, &r));                    // overwritten
+    CHECK(tele_raw_get(&s, 16, &r) && r.t_ms == 165000 && r.v == 6);
+    CHECK(tele_raw_get(&s, 23, &r) && r.v == 13);
+    CHECK(!tele_raw_get(&s, 24, &r));                    // not written yet
+
+    // Samples 0..5 fall in [0, 60 s), 6..11 in [60, 120 s), and so on.
+    CHECK(s.level[0].total == 3);
+    CHECK(tele_bucket_get(&s.level[0], 0, &b));
+    CHECK(b.t_ms == 0 && b.min == -10 && b.max == -5 && b.mean == -7);
+    CHECK(tele_bucket_get(&s.level[0], 2, &b));
+    CHECK(b.t_ms == 120000 && b.min == 2 && b.max == 7 && b.mean == 4);
+    CHECK(!tele_bucket_get(&s.level[0], 3, &b));
+    CHECK(tele_level_open(&s.level[0], &b));
+    CHECK(b.t_ms == 180000 && b.min == 8 && b.max == 13 && b.mean == 10);
+
+    // Still inside the first quarter hour: nothing closed, all 24 in the open one.
+    CHECK(s.level[1].total == 0);
+    CHECK(tele_level_open(&s.level[1], &b));
+    CHECK(b.t_ms == 0 && b.min == -10 && b.max == 13 && b.mean == 1);
+
+    // A gap skips buckets instead of shifting the next one.
+    tele_push(&s, 3600000u + 30000u, 100);
+    CHECK(s.level[0].total == 4);
+    CHECK(tele_bucket_get(&s.level[0], 3, &b) && b.t_ms == 180000);
+    CHECK(tele_level_open(&s.level[0], &b) && b.t_ms == 3600000 && b.mean == 100);
+    CHECK(s.level[1].total == 1);
+    CHECK(tele_bucket_get(&s.level[1], 0, &b) && b.t_ms == 0 && b.max == 13);
+
+    // A level holds its last TELE_L1_SLOTS buckets.
+    for (uint32_t m = 0; m < TELE_L1_SLOTS + 5; m++) {
+        tele_push(&s, 7200000u + m * TELE_L1_MS, (int32_t)m);
+    }
+    uint32_t first = tele_first(s.level[0].total, s.level[0].cap);
+    CHECK(s.level[0].total - first == TELE_L1_SLOTS);
+    CHECK(!tele_bucket_get(&s.level[0], first - 1, &b));
+    CHECK(tele_bucket_get(&s.level[0], s.level[0].total - 1, &b));
+    CHECK(b.t_ms == 7200000u + (TELE_L1_SLOTS + 3) * TELE_L1_MS);
+}
+
+// 2024-06-21 00:00 UTC; Amsterdam sunrise 03:18 and sunset 20:06 UTC.
+#define SUN_JUN21 1718928000u
+#define SUN_DEC21 1734739200u
+
+static void test_sun_position(void) {
+    printf("solar position\n");
+    CHECK_FLOAT(sun_sin_deg(30.0), 0.5);
+    CHECK_FLOAT(sun_sin_deg(-390.0), -0.5);
+    CHECK_FLOAT(sun_cos_deg(180.0), -1.0);
+    CHECK_FLOAT(sun_atan2_deg(1.0, 1.0), 45.0);
+    CHECK_FLOAT(sun_atan2_deg(-1.0, -1.0), -135.0);
+    CHECK_FLOAT(sun_atan2_deg(3.0, 1.0), 71.56505);
+    CHECK_FLOAT(sun_atan2_deg(1.0, 0.0), 90.0);
+
+    sun_site_t ams = { .lat_cdeg = 5237, .lon_cdeg = 490,
+                       .facade_az = 180, .half_width = 80, .min_elev = 10 };
+
+    // Solar noon: due south at 90 - 52.37 + 23.44 degrees.
+    sun_pos_t p = sun_position(&ams, SUN_JUN21 + 11 * 3600 + 42 * 60);
+    CHECK(p.el_cdeg > 6090 && p.el_cdeg < 6120);
+    CHECK(p.az_cdeg > 17800 && p.az_cdeg < 18200);
+
+    // Sunrise and sunset are where the centre is 0.83 degrees below the horizon.
+    CHECK(sun_position(&ams, SUN_JUN21 + 3 * 3600 + 10 * 60).el_cdeg < -83);
+    CHECK(sun_position(&ams, SUN_JUN21 + 3 * 3600 + 26 * 60).el_cdeg > -83);
+    CHECK(sun_position(&ams, SUN_JUN21 + 20 * 3600).el_cdeg > -83);
+    CHECK(sun_position(&ams, SUN_JUN21 + 20 * 3600 + 12 * 60).el_cdeg < -83);
+    p = sun_position(&ams, SUN_JUN21 + 3 * 3600 + 18 * 60);
+    CHECK(p.az_cdeg > 4500 && p.az_cdeg < 5100);            // north-east
+
+    // Equator at the June solstice: the sun stands 23.44 degrees north.
+    sun_site_t eq = { 0 };
+    p = sun_position(&eq, SUN_JUN21 + 12 * 3600);
+    CHECK(p.el_cdeg > 6630 && p.el_cdeg < 6680);
+    CHECK(p.az_cdeg < 300 || p.az_cdeg > 35700);
+
+    // Facade test: azimuth distance wraps through north.
+    sun_site_t north = { .facade_az = 10, .half_width = 30, .min_elev = 5 };
+    CHECK(sun_on_facade(&north, (sun_pos_t){ .az_cdeg = 35000, .el_cdeg = 1000 }));
+    CHECK(!sun_on_facade(&north, (sun_pos_t){ .az_cdeg = 35000, .el_cdeg = 400 }));
+    CHECK(!sun_on_facade(&north, (sun_pos_t){ .az_cdeg = 4500, .el_cdeg = 1000 }));
+}
+
+static void test_sun_schedule(void) {
+    printf("sun exposure schedule\n");
+    sun_site_t     ams = { .lat_cdeg = 5237, .lon_cdeg = 490,
+                           .facade_az = 180, .half_width = 80, .min_elev = 10 };
+    sun_schedule_t s;
+    uint32_t       until;
+
+    // A south facade in June: one window around solar noon.
+    sun_schedule_build(&s, &ams, SUN_JUN21, 86400);
+    CHECK(s.count == 1);
+    uint32_t noon = SUN_JUN21 + 11 * 3600 + 42 * 60;
+    CHECK(s.w[0].start < noon && s.w[0].end > noon);
+    CHECK(s.w[0].start > SUN_JUN21 + 7 * 3600 && s.w[0].end < SUN_JUN21 + 16 * 3600);
+    CHECK(sun_exposed_at(&ams, s.w[0].start) && !sun_exposed_at(&ams, s.w[0].start - SUN_EDGE_S));
+    CHECK(!sun_exposed_at(&ams, s.w[0].end) && sun_exposed_at(&ams, s.w[0].end - SUN_EDGE_S));
+
+    CHECK(!sun_schedule_active(&s, SUN_JUN21, 900, &until));
+    CHECK(until == s.w[0].start - 900 - SUN_JUN21);
+    CHECK(sun_schedule_active(&s, s.w[0].start - 600, 900, &until));
+    CHECK(sun_schedule_active(&s, noon, 0, &until));
+    CHECK(!sun_schedule_active(&s, s.w[0].end, 900, &until));
+    CHECK(until == UINT32_MAX);
+
+    // A span that starts inside the window keeps it, clipped to the span.
+    sun_schedule_build(&s, &ams, noon, 86400);
+    CHECK(s.count == 2);
+    CHECK(s.w[0].start == noon && s.w[1].start > noon + 12 * 3600);
+
+    // A north facade in December never sees the sun.
+    ams.facade_az = 0;
+    sun_schedule_build(&s, &ams, SUN_DEC21, 86400);
+    CHECK(s.count == 0);
+    CHECK(!sun_schedule_active(&s, SUN_DEC21 + 43200, 900, &until) && until == UINT32_MAX);
+}
+
+static void test_latency_hist(void) {
+    printf("latency histogram\n");
+    CHECK(lat_bucket(0) == 0);
+    CHECK(lat_bucket(15) == 0);
+    CHECK(lat_bucket(16) == 1);
+    CHECK(lat_bucket(31) == 1);
+    CHECK(lat_bucket(32) == 2);
+    CHECK(lat_bucket(UINT32_MAX) == LAT_BUCKETS - 1);
+    CHECK(lat_bucket_upper_us(0) == 16);
+    CHECK(lat_bucket_upper_us(LAT_BUCKETS - 1) == UINT32_MAX);
+
+    lat_hist_t h = {0};
+    CHECK(lat_percentile_us(&h, 50) == 0);
+    CHECK(lat_mean_us(&h) == 0);
+
+    for (int i = 0; i < 98; i++) lat_record(&h, 100);   // bucket [64,128)
+    lat_record(&h, 5000);                               // bucket [4096,8192)
+    lat_record(&h, 6000);
+    CHECK(h.count == 100);
+    CHECK(h.max_us == 6000);
+    CHECK(lat_mean_us(&h) == (98 * 100 + 5000 + 6000) / 100);
+    CHECK(lat_percentile_us(&h, 50) == 128);
+    CHECK(lat_percentile_us(&h, 98) == 128);
+    CHECK(lat_percentile_us(&h, 99) == 6000);          // capped at max
+    CHECK(lat_percentile_us(&h, 100) == 6000);
+
+    lat_hist_t one = {0};
+    lat_record(&one, 40);
+    CHECK(lat_percentile_us(&one, 0) == 40);
+    CHECK(lat_percentile_us(&one, 99) == 40);
+}
+
 int main(void) {
     printf("== sunshade logic unit tests ==\n");
     test_relay_output_level();
     test_clamp_position();
-    test_position_delta();
+    test_position_model();
+    test_travel_model();
+    test_relay_driver();
+    test_motion_segment();
     test_sensor_hysteresis();
     test_wind_speed_ds();
     test_bh1750_lux();
+    test_bh1750_mtreg();
     test_sht3x();
+    test_prot_arbiter();
+    test_gust_filter();
+    test_journal();
+    test_shade_config();
+    test_latency_hist();
+    test_motion_seqlock();
+    test_endstop_detector();
+    test_event_log();
+    test_telemetry();
+    test_sun_position();
+    test_sun_schedule();
 
     printf("\n%d checks, %d failures\n", g_checks, g_failures);
     if (g_failures != 0) {